@@ -1,5 +1,9 @@
 TEMPLATE = subdirs
 SUBDIRS = rockwork rockworkd
+
+# Headless codec and upload benchmarks, qmake CONFIG+=bench. bench.pro lists one project per benchmark.
+bench: SUBDIRS += rockworkd/bench/bench.pro
+
 OTHER_FILES += \
     README.md \
     rpm/rockpool.spec \
@@ -0,0 +1,297 @@
+#include "blobdb.h"
+#include "packetcodec.h"
+#include "timelineitem.h"
+#include "watchconnection.h"
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Every heap allocation goes through malloc, Qt's containers included, so counting there sees all of them
+static quint64 s_allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    s_allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    s_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    s_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+}
+#else
+#warning "Allocations are only counted with glibc"
+#endif
+
+// Results feed into this so the compiler can't drop the work
+static volatile qint64 s_sink = 0;
+
+class CodecBench
+{
+public:
+    CodecBench(const char *filter, int minMsecs):
+        m_filter(filter), m_minNsecs(qint64(minMsecs) * 1000000)
+    {}
+
+    template <typename F>
+    void run(const char *name, F body)
+    {
+        if (m_filter && !strstr(name, m_filter)) {
+            return;
+        }
+        // Doubles the iteration count until a run takes long enough to trust the clock
+        quint64 iterations = 1;
+        qint64 nsecs = 0;
+        quint64 allocations = 0;
+        forever {
+            const quint64 allocationsBefore = s_allocations;
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            qint64 sink = 0;
+            for (quint64 i = 0; i < iterations; i++) {
+                sink += body();
+            }
+            nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            allocations = s_allocations - allocationsBefore;
+            s_sink = s_sink + sink;
+            if (nsecs >= m_minNsecs || iterations >= (Q_UINT64_C(1) << 40)) {
+                break;
+            }
+            iterations *= 2;
+        }
+        printf("%-36s %12llu %12.1f %12.2f\n", name, (unsigned long long)iterations,
+               double(nsecs) / iterations, double(allocations) / iterations);
+        fflush(stdout);
+    }
+
+    void runAll();
+
+private:
+    static TimelineItem notificationItem();
+    static WatchConnection::Dict appMessageDict();
+
+    const char *m_filter;
+    qint64 m_minNsecs;
+};
+
+// A notification as the notification endpoint sends it: text attributes, an icon and two actions
+TimelineItem CodecBench::notificationItem()
+{
+    TimelineItem item(QUuid("{5d5a0e8c-7e0e-4a3e-9f4c-2b8a4f9b1c11}"), TimelineItem::TypeNotification,
+                      TimelineItem::FlagSingleEvent, QDateTime::fromTime_t(1476700000), 0);
+    item.setLayout(0x01);
+    TimelineAttribute title(0x01, QByteArray());
+    title.setContent(QString("Jane Doe"));
+    item.appendAttribute(title);
+    TimelineAttribute subtitle(0x02, QByteArray());
+    subtitle.setContent(QString("Dinner tonight?"));
+    item.appendAttribute(subtitle);
+    TimelineAttribute body(0x03, QByteArray());
+    body.setContent(QString("Hey! Are we still on for tonight? I booked a table at the Italian place around the corner "
+                            "for 8 pm. Let me know if that works for you, otherwise we can move it to Friday."));
+    item.appendAttribute(body);
+    item.appendAttribute(TimelineAttribute(0x04, quint32(0x80000000 | 45)));
+
+    TimelineAction dismiss(0, TimelineAction::TypeDismiss);
+    TimelineAttribute dismissTitle(0x01, QByteArray());
+    dismissTitle.setContent(QString("Dismiss"));
+    dismiss.appendAttribute(dismissTitle);
+    item.appendAction(dismiss);
+
+    TimelineAction reply(1, TimelineAction::TypeResponse);
+    TimelineAttribute replyTitle(0x01, QByteArray());
+    replyTitle.setContent(QString("Reply"));
+    reply.appendAttribute(replyTitle);
+    reply.appendAttribute(TimelineAttribute(0x08, QStringList() << "Ok" << "Yes" << "No" << "Call me" << "Later"));
+    item.appendAction(reply);
+    return item;
+}
+
+// What a weather watchface typically gets from its companion JS
+WatchConnection::Dict CodecBench::appMessageDict()
+{
+    WatchConnection::Dict dict;
+    dict.insert(0, 17);
+    dict.insert(1, QString("Partly Cloudy"));
+    dict.insert(2, QString("Amsterdam"));
+    dict.insert(3, 4);
+    dict.insert(4, uint(1476700000));
+    dict.insert(5, QByteArray(16, '\x2a'));
+    dict.insert(6, -3);
+    dict.insert(7, QString("Wind 4 Bft SW"));
+    return dict;
+}
+
+void CodecBench::runAll()
+{
+    printf("%-36s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+
+    QByteArray scalars;
+    {
+        WatchDataWriter writer(&scalars);
+        writer.write<quint8>(0x42);
+        writer.write<quint16>(0x1234);
+        writer.write<quint32>(0xdeadbeef);
+        writer.writeLE<quint32>(0xcafebabe);
+        writer.writeUuid(QUuid("{5d5a0e8c-7e0e-4a3e-9f4c-2b8a4f9b1c11}"));
+        writer.writeFixedString(32, "Pebble Time Steel");
+    }
+    const WatchConnection::Dict dict = appMessageDict();
+    QByteArray encodedDict(WatchDataWriter::dictSize(dict), Qt::Uninitialized);
+    {
+        WatchDataWriter writer(&encodedDict, 0);
+        writer.writeDict(dict);
+    }
+    const TimelineItem item = notificationItem();
+    const QUuid uuid("{5d5a0e8c-7e0e-4a3e-9f4c-2b8a4f9b1c11}");
+
+    run("reader/scalars", [&scalars]() {
+        WatchDataReader reader(scalars);
+        return qint64(reader.read<quint8>()) + reader.read<quint16>() + reader.read<quint32>() + reader.readLE<quint32>();
+    });
+    run("reader/uuid", [&scalars]() {
+        WatchDataReader reader(scalars);
+        reader.skip(11);
+        return qint64(reader.readUuid().data1);
+    });
+    run("reader/fixedString", [&scalars]() {
+        WatchDataReader reader(scalars);
+        reader.skip(27);
+        return qint64(reader.readFixedString(32).length());
+    });
+    run("reader/readDict", [&encodedDict]() {
+        WatchDataReader reader(encodedDict);
+        return qint64(reader.readDict().count());
+    });
+    run("reader/readDictView", [&encodedDict]() {
+        WatchDataReader reader(encodedDict);
+        const WatchDictView view = reader.readDictView();
+        qint64 keys = 0;
+        for (WatchDictView::const_iterator it = view.begin(); it != view.end(); ++it) {
+            keys += (*it).key;
+        }
+        return keys;
+    });
+
+    QByteArray buffer(256, Qt::Uninitialized);
+    run("writer/scalars", [&buffer]() {
+        WatchDataWriter writer(&buffer, 0);
+        writer.write<quint8>(0x42);
+        writer.write<quint16>(0x1234);
+        writer.write<quint32>(0xdeadbeef);
+        writer.writeLE<quint32>(0xcafebabe);
+        return qint64(writer.offset());
+    });
+    run("writer/scalarsAppend", []() {
+        QByteArray out;
+        WatchDataWriter writer(&out);
+        writer.write<quint8>(0x42);
+        writer.write<quint16>(0x1234);
+        writer.write<quint32>(0xdeadbeef);
+        writer.writeLE<quint32>(0xcafebabe);
+        return qint64(out.size());
+    });
+    run("writer/uuid", [&buffer, &uuid]() {
+        WatchDataWriter writer(&buffer, 0);
+        writer.writeUuid(uuid);
+        return qint64(writer.offset());
+    });
+    const QString text("Hey! Are we still on for tonight?");
+    run("writer/cString", [&buffer, &text]() {
+        WatchDataWriter writer(&buffer, 0);
+        writer.writeCString(text);
+        return qint64(writer.offset());
+    });
+    run("writer/fixedString", [&buffer, &text]() {
+        WatchDataWriter writer(&buffer, 0);
+        writer.writeFixedString(32, text);
+        return qint64(writer.offset());
+    });
+    run("writer/writeDict", [&dict]() {
+        QByteArray out(WatchDataWriter::dictSize(dict), Qt::Uninitialized);
+        WatchDataWriter writer(&out, 0);
+        writer.writeDict(dict);
+        return qint64(out.size());
+    });
+
+    run("timelineItem/serializedSize", [&item]() {
+        return qint64(item.serializedSize());
+    });
+    run("timelineItem/serialize", [&item]() {
+        return qint64(item.serialize().size());
+    });
+
+    run("blobCommand/insertNotification", [&item]() {
+        // As BlobDB::insert() and enqueue() encode it
+        return qint64(PacketCodec::buildBlobCommand(BlobDB::OperationInsert, 0x1234, BlobDB::BlobDBIdNotification,
+                                                    item.itemId().toRfc4122(), QByteArray(), &item).size());
+    });
+    run("blobCommand/delete", [&uuid]() {
+        return qint64(PacketCodec::buildBlobCommand(BlobDB::OperationDelete, 0x1234, BlobDB::BlobDBIdPin, uuid.toRfc4122()).size());
+    });
+
+    run("appMsg/buildPushMessage", [&dict, &uuid]() {
+        return qint64(PacketCodec::buildPushMessage(7, uuid, dict).size());
+    });
+    run("appMsg/unpackPushMessage", [&dict, &uuid]() {
+        static const QByteArray msg = PacketCodec::buildPushMessage(7, uuid, dict);
+        quint8 transaction;
+        QUuid target;
+        WatchDictView view;
+        PacketCodec::unpackPushMessage(msg, &transaction, &target, &view);
+        return qint64(view.count());
+    });
+
+    const QStringList caller = QStringList() << "+31 6 12345678" << "Jane Doe";
+    run("connection/buildData", [&caller]() {
+        return qint64(PacketCodec::buildData(caller).size());
+    });
+    const QStringList track = QStringList() << "Radiohead" << "OK Computer" << "Paranoid Android";
+    run("connection/buildMessageData", [&track]() {
+        return qint64(PacketCodec::buildMessageData(0x10, track).size());
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = nullptr;
+    int minMsecs = 200;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            minMsecs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printf("Usage: %s [filter] [-t msecs]\n"
+                   "Runs the benchmarks whose name contains filter, each for at least msecs (default 200).\n", argv[0]);
+            return 0;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    CodecBench bench(filter, minMsecs);
+    bench.runAll();
+    return s_sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+# Micro-benchmarks of the protocol codec. Builds without the daemon and runs headless:
+#   qmake CONFIG+=release && make && ./codecbench [filter] [-t msecs]
+TEMPLATE = app
+TARGET = codecbench
+
+QT += core gui bluetooth
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../libpebble
+
+SOURCES += codecbench.cpp \
+    ../libpebble/packetcodec.cpp \
+    ../libpebble/timelineitem.cpp \
+    ../libpebble/watchdatareader.cpp \
+    ../libpebble/watchdatawriter.cpp
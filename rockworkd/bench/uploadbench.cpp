@@ -0,0 +1,423 @@
+#include "linkprobe.h"
+#include "socketpairtransport.h"
+#include "stm32crc.h"
+#include "uploadmanager.h"
+#include "watchconnection.h"
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+#include "watchframebuffer.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+static qint64 cpuNsecs(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The watch's end of PutBytes and ping, on the far end of a socketpair and on its own thread.
+ *
+ * The link in between is simulated: frames from the phone go over it one at a time at the given
+ * bandwidth, a reply leaves once its request is through and arrives a round trip later. Replies are
+ * small and don't count against the bandwidth.
+ */
+class SimulatedWatch : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats {
+        int chunks = 0;
+        qint64 bytes = 0;
+        bool committed = false;
+        bool crcMatched = false;
+        // From an ack leaving the watch to the next chunk showing up, the time the link sat idle
+        // waiting on the phone, not counting the simulated round trip
+        QVector<qint64> stallUsecs;
+        qint64 cpuNsecs = 0;
+    };
+
+    SimulatedWatch(int latencyMsecs, qint64 bytesPerSec):
+        m_latencyNsecs(qint64(latencyMsecs) * 1000000),
+        m_bytesPerSec(bytesPerSec),
+        m_deliverTimer(new QTimer(this))
+    {
+        m_deliverTimer->setSingleShot(true);
+        m_deliverTimer->setTimerType(Qt::PreciseTimer);
+        connect(m_deliverTimer, &QTimer::timeout, this, &SimulatedWatch::deliver);
+        m_clock.start();
+    }
+
+    // Resets the stats for the next run
+    Stats takeStats()
+    {
+        QMutexLocker locker(&m_statsLock);
+        Stats stats = m_stats;
+        m_stats = Stats();
+        return stats;
+    }
+
+public slots:
+    void attach(int descriptor)
+    {
+        delete m_socket;
+        m_socket = new QLocalSocket(this);
+        m_socket->setSocketDescriptor(descriptor);
+        connect(m_socket, &QLocalSocket::readyRead, this, &SimulatedWatch::readFrames);
+    }
+
+private slots:
+    void readFrames()
+    {
+        const qint64 cpuBefore = cpuNsecs(CLOCK_THREAD_CPUTIME_ID);
+        forever {
+            if (m_buffer.fill(m_socket) <= 0) {
+                break;
+            }
+            WatchFrameBuffer::Frame frame;
+            while (m_buffer.takeFrame(&frame)) {
+                receive(frame);
+            }
+        }
+        accountCpu(cpuBefore);
+    }
+
+    void deliver()
+    {
+        const qint64 cpuBefore = cpuNsecs(CLOCK_THREAD_CPUTIME_ID);
+        const qint64 now = m_clock.nsecsElapsed();
+        while (!m_outgoing.isEmpty() && m_outgoing.head().due <= now) {
+            const Outgoing outgoing = m_outgoing.dequeue();
+            m_socket->write(outgoing.frame);
+            if (outgoing.putBytes) {
+                m_lastAck = now;
+            }
+        }
+        scheduleDelivery();
+        accountCpu(cpuBefore);
+    }
+
+private:
+    enum PutBytesCommand {
+        PutBytesCommandInit = 1,
+        PutBytesCommandSend = 2,
+        PutBytesCommandCommit = 3,
+        PutBytesCommandAbort = 4,
+        PutBytesCommandComplete = 5
+    };
+
+    struct Outgoing {
+        qint64 due;
+        QByteArray frame;
+        bool putBytes;
+    };
+
+    void receive(const WatchFrameBuffer::Frame &frame)
+    {
+        const qint64 now = m_clock.nsecsElapsed();
+        const qint64 start = qMax(now, m_linkFreeAt);
+        m_linkFreeAt = start + (m_bytesPerSec > 0 ? qint64(frame.length) * 1000000000 / m_bytesPerSec : 0);
+        const qint64 due = m_linkFreeAt + m_latencyNsecs;
+
+        WatchDataReader reader(frame.payload(), frame.payloadLength());
+        if (frame.endpoint == WatchConnection::EndpointWatchPing) {
+            reader.read<quint8>();
+            const quint32 cookie = reader.read<quint32>();
+            QByteArray pong;
+            WatchDataWriter writer(&pong);
+            writer.write<quint8>(1);
+            writer.write<quint32>(cookie);
+            reply(frame.endpoint, pong, due);
+        } else if (frame.endpoint == WatchConnection::EndpointPutBytes) {
+            handlePutBytes(reader, now, due);
+        }
+    }
+
+    void handlePutBytes(WatchDataReader &reader, qint64 now, qint64 due)
+    {
+        const quint8 command = reader.read<quint8>();
+        bool ok = true;
+        switch (command) {
+        case PutBytesCommandInit:
+            m_expected = reader.read<quint32>();
+            m_received = 0;
+            m_crc.reset();
+            m_token = ++m_lastToken;
+            m_lastAck = -1;
+            break;
+        case PutBytesCommandSend: {
+            ok = reader.read<quint32>() == m_token;
+            const int length = reader.read<quint32>();
+            const QByteArray payload = reader.readView(length);
+            m_crc.update(payload);
+            m_received += payload.length();
+
+            QMutexLocker locker(&m_statsLock);
+            m_stats.chunks++;
+            m_stats.bytes += payload.length();
+            if (m_lastAck >= 0) {
+                m_stats.stallUsecs.append((now - m_lastAck) / 1000);
+            }
+            break;
+        }
+        case PutBytesCommandCommit: {
+            ok = reader.read<quint32>() == m_token;
+            const quint32 crc = reader.read<quint32>();
+            QMutexLocker locker(&m_statsLock);
+            m_stats.committed = true;
+            m_stats.crcMatched = m_received == m_expected && crc == m_crc.value();
+            ok = ok && m_stats.crcMatched;
+            break;
+        }
+        case PutBytesCommandAbort:
+        case PutBytesCommandComplete:
+            ok = reader.read<quint32>() == m_token;
+            m_lastAck = -1;
+            break;
+        default:
+            ok = false;
+        }
+
+        QByteArray response;
+        WatchDataWriter writer(&response);
+        writer.write<quint8>(ok && !reader.bad() ? 1 : 2);
+        writer.write<quint32>(m_token);
+        reply(WatchConnection::EndpointPutBytes, response, due);
+    }
+
+    void reply(quint16 endpoint, const QByteArray &payload, qint64 due)
+    {
+        Outgoing outgoing;
+        outgoing.due = due;
+        outgoing.putBytes = endpoint == WatchConnection::EndpointPutBytes;
+        WatchDataWriter writer(&outgoing.frame);
+        writer.write<quint16>(payload.length());
+        writer.write<quint16>(endpoint);
+        outgoing.frame.append(payload);
+        // The link is FIFO and the round trip fixed, so due times only go up
+        m_outgoing.enqueue(outgoing);
+        scheduleDelivery();
+    }
+
+    void scheduleDelivery()
+    {
+        if (m_outgoing.isEmpty()) {
+            return;
+        }
+        const qint64 wait = m_outgoing.head().due - m_clock.nsecsElapsed();
+        m_deliverTimer->start(wait > 0 ? int((wait + 999999) / 1000000) : 0);
+    }
+
+    void accountCpu(qint64 before)
+    {
+        QMutexLocker locker(&m_statsLock);
+        m_stats.cpuNsecs += cpuNsecs(CLOCK_THREAD_CPUTIME_ID) - before;
+    }
+
+    const qint64 m_latencyNsecs;
+    const qint64 m_bytesPerSec;
+    QLocalSocket *m_socket = nullptr;
+    WatchFrameBuffer m_buffer;
+    QElapsedTimer m_clock;
+    qint64 m_linkFreeAt = 0;
+    QQueue<Outgoing> m_outgoing;
+    QTimer *m_deliverTimer;
+    // When the last PutBytes ack reached the phone, -1 if the phone isn't due to send a chunk
+    qint64 m_lastAck = -1;
+
+    quint32 m_lastToken = 0;
+    quint32 m_token = 0;
+    int m_expected = 0;
+    int m_received = 0;
+    Stm32Crc m_crc;
+
+    QMutex m_statsLock;
+    Stats m_stats;
+};
+
+class UploadBench
+{
+public:
+    UploadBench(const char *filter, SimulatedWatch *watch, WatchConnection *connection):
+        m_filter(filter), m_watch(watch), m_connection(connection)
+    {}
+
+    void runAll();
+
+private:
+    void run(const char *name, WatchConnection::UploadType type, int size);
+
+    const char *m_filter;
+    SimulatedWatch *m_watch;
+    WatchConnection *m_connection;
+    QTemporaryDir m_dir;
+};
+
+void UploadBench::run(const char *name, WatchConnection::UploadType type, int size)
+{
+    if (m_filter && !strstr(name, m_filter)) {
+        return;
+    }
+
+    // Random bytes, so nothing along the way gets to take a shortcut
+    QByteArray payload(size, Qt::Uninitialized);
+    qsrand(size);
+    for (int i = 0; i < size; i++) {
+        payload[i] = char(qrand());
+    }
+    const QString fileName = m_dir.path() + "/" + name;
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly) || file.write(payload) != size) {
+        fprintf(stderr, "Cannot write %s\n", qPrintable(fileName));
+        return;
+    }
+    file.close();
+    const quint32 crc = Stm32Crc::compute(payload);
+
+    const bool app = type == WatchConnection::UploadTypeBinary || type == WatchConnection::UploadTypeResources;
+    bool done = false;
+    int error = 0;
+    QEventLoop loop;
+    m_watch->takeStats();
+    const qint64 cpuBefore = cpuNsecs(CLOCK_PROCESS_CPUTIME_ID);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    m_connection->uploadManager()->upload(type, app ? -1 : 0, app ? 1 : 0, fileName, -1, crc,
+        [&]() { done = true; loop.quit(); },
+        [&](int code) { done = true; error = code ? code : -1; loop.quit(); });
+    if (!done) {
+        loop.exec();
+    }
+    const qint64 nsecs = elapsed.nsecsElapsed();
+    const qint64 cpu = cpuNsecs(CLOCK_PROCESS_CPUTIME_ID) - cpuBefore;
+
+    SimulatedWatch::Stats stats = m_watch->takeStats();
+    if (error || !stats.crcMatched) {
+        printf("%-20s failed with %d%s\n", name, error, stats.committed && !stats.crcMatched ? ", crc mismatch" : "");
+        return;
+    }
+
+    std::sort(stats.stallUsecs.begin(), stats.stallUsecs.end());
+    qint64 stallTotal = 0;
+    for (qint64 stall : stats.stallUsecs) {
+        stallTotal += stall;
+    }
+    const int stalls = stats.stallUsecs.count();
+    const double megabytes = double(size) / (1024 * 1024);
+    // The simulated watch's own share is taken out, what's left is the daemon
+    printf("%-20s %8d %8.3f %7d %7d %10.1f %10lld %10lld %10.2f\n", name, size / 1024,
+           megabytes * 1e9 / nsecs, stats.chunks, stats.chunks ? int(stats.bytes / stats.chunks) : 0,
+           stalls ? double(stallTotal) / stalls : 0.0,
+           stalls ? (long long)stats.stallUsecs.at(stalls * 99 / 100) : 0LL,
+           stalls ? (long long)stats.stallUsecs.last() : 0LL,
+           double(cpu - stats.cpuNsecs) / 1e6 / megabytes);
+    fflush(stdout);
+}
+
+void UploadBench::runAll()
+{
+    printf("%-20s %8s %8s %7s %7s %10s %10s %10s %10s\n", "upload", "KiB", "MB/s", "chunks", "chunk",
+           "stall us", "p99 us", "max us", "CPU ms/MB");
+    run("app-binary", WatchConnection::UploadTypeBinary, 64 * 1024);
+    run("app-resources", WatchConnection::UploadTypeResources, 256 * 1024);
+    run("firmware", WatchConnection::UploadTypeFirmware, 640 * 1024);
+    run("system-resources", WatchConnection::UploadTypeSystemResources, 1536 * 1024);
+}
+
+// Per-chunk logging would dominate what is measured
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+    if (type != QtDebugMsg) {
+        fprintf(stderr, "%s\n", qPrintable(message));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const char *filter = nullptr;
+    int latencyMsecs = 30;
+    qint64 bytesPerSec = 60000;
+    bool largeChunks = true;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            latencyMsecs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            bytesPerSec = atoll(argv[++i]);
+        } else if (!strcmp(argv[i], "-s")) {
+            largeChunks = false;
+        } else if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printf("Usage: %s [filter] [-l msecs] [-b bytes/s] [-s] [-v]\n"
+                   "Uploads payloads whose name contains filter to a simulated watch over a link with the given\n"
+                   "round trip (default 30 ms) and bandwidth (default 60000 bytes/s, 0 for unlimited).\n"
+                   "-s sticks to 2000 byte chunks as for a watch without 8k frames, -v keeps the daemon's debug output.\n", argv[0]);
+            return 0;
+        } else {
+            filter = argv[i];
+        }
+    }
+    if (!verbose) {
+        qInstallMessageHandler(quietMessageHandler);
+    }
+
+    QThread watchThread;
+    SimulatedWatch *watch = new SimulatedWatch(latencyMsecs, bytesPerSec);
+    watch->moveToThread(&watchThread);
+    QObject::connect(&watchThread, &QThread::finished, watch, &QObject::deleteLater);
+    watchThread.start();
+
+    WatchConnection connection;
+    SocketPairTransport *transport = new SocketPairTransport;
+    QObject::connect(transport, &SocketPairTransport::peerConnected, watch, &SimulatedWatch::attach);
+    connection.setTransport(transport);
+
+    QEventLoop loop;
+    QObject::connect(&connection, &WatchConnection::watchConnected, &loop, &QEventLoop::quit);
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    connection.connectPebble(QBluetoothAddress());
+    loop.exec();
+    if (!connection.isConnected()) {
+        fprintf(stderr, "The simulated watch didn't connect\n");
+        return 1;
+    }
+
+    // Chunk sizing works off the measured round trip, don't wait for the first periodic probe
+    QEventLoop probeLoop;
+    QObject::connect(connection.linkProbe(), &LinkProbe::rttMeasured, &probeLoop, &QEventLoop::quit);
+    QTimer::singleShot(5000, &probeLoop, SLOT(quit()));
+    connection.linkProbe()->probe();
+    probeLoop.exec();
+    connection.uploadManager()->setLargeChunks(largeChunks);
+
+    printf("link: %d ms round trip, %lld bytes/s, %s chunks\n", latencyMsecs, (long long)bytesPerSec,
+           largeChunks ? "adaptive" : "2000 byte");
+    UploadBench bench(filter, watch, &connection);
+    bench.runAll();
+
+    watchThread.quit();
+    watchThread.wait();
+    return 0;
+}
+
+#include "uploadbench.moc"
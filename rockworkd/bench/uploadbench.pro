@@ -0,0 +1,45 @@
+# End-to-end PutBytes throughput against a simulated watch. Builds without the daemon and runs headless:
+#   qmake CONFIG+=release && make && ./uploadbench [filter] [-l msecs] [-b bytes/s] [-s]
+TEMPLATE = app
+TARGET = uploadbench
+
+QT += core bluetooth dbus network
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../libpebble
+
+SOURCES += uploadbench.cpp \
+    ../libpebble/latencyhistogram.cpp \
+    ../libpebble/linkprobe.cpp \
+    ../libpebble/metricsregistry.cpp \
+    ../libpebble/packetcodec.cpp \
+    ../libpebble/rfcommtransport.cpp \
+    ../libpebble/socketpairtransport.cpp \
+    ../libpebble/stm32crc.cpp \
+    ../libpebble/tcptransport.cpp \
+    ../libpebble/tracing.cpp \
+    ../libpebble/uploadmanager.cpp \
+    ../libpebble/watchconnection.cpp \
+    ../libpebble/watchdatareader.cpp \
+    ../libpebble/watchdatawriter.cpp \
+    ../libpebble/watchframebuffer.cpp \
+    ../libpebble/watchioworker.cpp \
+    ../libpebble/watchtransport.cpp \
+    ../libpebble/bluez/bluezdevicemonitor.cpp \
+    ../libpebble/bluez/freedesktop_objectmanager.cpp \
+    ../libpebble/bluez/freedesktop_properties.cpp
+
+HEADERS += \
+    ../libpebble/linkprobe.h \
+    ../libpebble/metricsregistry.h \
+    ../libpebble/rfcommtransport.h \
+    ../libpebble/socketpairtransport.h \
+    ../libpebble/tcptransport.h \
+    ../libpebble/uploadmanager.h \
+    ../libpebble/watchconnection.h \
+    ../libpebble/watchioworker.h \
+    ../libpebble/watchtransport.h \
+    ../libpebble/bluez/bluezdevicemonitor.h \
+    ../libpebble/bluez/freedesktop_objectmanager.h \
+    ../libpebble/bluez/freedesktop_properties.h
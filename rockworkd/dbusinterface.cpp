@@ -16,6 +16,7 @@ DBusPebble::DBusPebble(Pebble *pebble, QObject *parent):
     connect(pebble, &Pebble::updateAvailableChanged, this, &DBusPebble::FirmwareUpgradeAvailableChanged);
     connect(pebble, &Pebble::upgradingFirmwareChanged, this, &DBusPebble::UpgradingFirmwareChanged);
     connect(pebble, &Pebble::logsDumped, this, &DBusPebble::LogsDumped);
+    connect(pebble, &Pebble::captureReplayFinished, this, &DBusPebble::CaptureReplayFinished);
     connect(pebble, &Pebble::healtParamsChanged, this, &DBusPebble::HealthParamsChanged);
     connect(pebble, &Pebble::imperialUnitsChanged, this, &DBusPebble::ImperialUnitsChanged);
     connect(pebble, &Pebble::profileConnectionSwitchChanged, this, &DBusPebble::onProfileConnectionSwitchChanged);
@@ -262,6 +263,61 @@ void DBusPebble::DumpLogs(const QString &fileName) const
     m_pebble->dumpLogs(fileName);
 }
 
+bool DBusPebble::StartCapture(const QString &fileName)
+{
+    return m_pebble->startCapture(fileName);
+}
+
+void DBusPebble::StopCapture()
+{
+    m_pebble->stopCapture();
+}
+
+bool DBusPebble::ReplayCapture(const QString &fileName, bool realTime)
+{
+    return m_pebble->replayCapture(fileName, realTime);
+}
+
+QVariantMap DBusPebble::LinkLatency() const
+{
+    return m_pebble->linkLatency();
+}
+
+void DBusPebble::ProbeLink()
+{
+    m_pebble->probeLink();
+}
+
+QVariantMap DBusPebble::ConnectionStats() const
+{
+    return m_pebble->connectionStats();
+}
+
+QVariantMap DBusPebble::Metrics() const
+{
+    return m_pebble->metrics();
+}
+
+bool DBusPebble::StartMetricsDump(const QString &fileName, int intervalSecs)
+{
+    return m_pebble->startMetricsDump(fileName, intervalSecs);
+}
+
+void DBusPebble::StopMetricsDump()
+{
+    m_pebble->stopMetricsDump();
+}
+
+bool DBusPebble::StartTrace()
+{
+    return m_pebble->startTrace();
+}
+
+bool DBusPebble::StopTrace(const QString &fileName)
+{
+    return m_pebble->stopTrace(fileName);
+}
+
 QVariantMap DBusPebble::HealthParams() const
 {
     QVariantMap map;
@@ -299,6 +355,26 @@ void DBusPebble::SetImperialUnits(bool imperialUnits)
     m_pebble->setImperialUnits(imperialUnits);
 }
 
+int DBusPebble::DeferWindow() const
+{
+    return m_pebble->deferWindow();
+}
+
+void DBusPebble::SetDeferWindow(int msecs)
+{
+    m_pebble->setDeferWindow(msecs);
+}
+
+int DBusPebble::BlobDBWindow() const
+{
+    return m_pebble->blobDBWindow();
+}
+
+void DBusPebble::SetBlobDBWindow(int commands)
+{
+    m_pebble->setBlobDBWindow(commands);
+}
+
 void DBusPebble::onProfileConnectionSwitchChanged(bool connected) {
     if (connected)
         emit ProfileWhenConnectedChanged();
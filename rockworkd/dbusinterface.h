@@ -25,6 +25,7 @@ signals:
     void FirmwareUpgradeAvailableChanged();
     void UpgradingFirmwareChanged();
     void LogsDumped(bool success);
+    void CaptureReplayFinished(quint64 frames, qint64 handlerNsecs, qint64 wallNsecs);
 
     void HealthParamsChanged();
     void ImperialUnitsChanged();
@@ -79,6 +80,17 @@ public slots:
     QStringList Screenshots() const;
     void RemoveScreenshot(const QString &filename);
     void DumpLogs(const QString &fileName) const;
+    bool StartCapture(const QString &fileName);
+    void StopCapture();
+    bool ReplayCapture(const QString &fileName, bool realTime);
+    QVariantMap LinkLatency() const;
+    void ProbeLink();
+    QVariantMap ConnectionStats() const;
+    QVariantMap Metrics() const;
+    bool StartMetricsDump(const QString &fileName, int intervalSecs);
+    void StopMetricsDump();
+    bool StartTrace();
+    bool StopTrace(const QString &fileName);
 
     QVariantMap HealthParams() const;
     void SetHealthParams(const QVariantMap &healthParams);
@@ -86,6 +98,12 @@ public slots:
     bool ImperialUnits() const;
     void SetImperialUnits(bool imperialUnits);
 
+    int DeferWindow() const;
+    void SetDeferWindow(int msecs);
+
+    int BlobDBWindow() const;
+    void SetBlobDBWindow(int commands);
+
     QString ProfileWhenConnected();
     void SetProfileWhenConnected(const QString &profile);
 
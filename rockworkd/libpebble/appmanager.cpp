@@ -24,8 +24,8 @@ AppManager::AppManager(Pebble *pebble, WatchConnection *connection)
     }
     qDebug() << "install apps in" << dataDir.absolutePath();
 
-    m_connection->registerEndpointHandler(WatchConnection::EndpointAppFetch, this, "handleAppFetchMessage");
-    m_connection->registerEndpointHandler(WatchConnection::EndpointSorting, this, "sortingReply");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointAppFetch, this, &AppManager::handleAppFetchMessage);
+    m_connection->registerEndpointHandler(WatchConnection::EndpointSorting, this, &AppManager::sortingReply);
 }
 
 QList<QUuid> AppManager::appUuids() const
@@ -232,7 +232,8 @@ void AppManager::setAppOrder(const QList<QUuid> &newList)
     }
 
     qDebug() << "writing" << data.toHex();
-    m_connection->writeToPebble(WatchConnection::EndpointSorting, data);
+    // Only the latest order matters
+    m_connection->deferToPebble(WatchConnection::EndpointSorting, data, 0);
 }
 
 AppFetchResponse::AppFetchResponse(Status status):
@@ -246,11 +247,8 @@ void AppFetchResponse::setStatus(AppFetchResponse::Status status)
     m_status = status;
 }
 
-QByteArray AppFetchResponse::serialize() const
+void AppFetchResponse::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray ret;
-    WatchDataWriter writer(&ret);
     writer.write<quint8>(m_command);
     writer.write<quint8>(m_status);
-    return ret;
 }
@@ -21,7 +21,8 @@ public:
     AppFetchResponse(Status status = StatusNoData);
     void setStatus(Status status);
 
-    QByteArray serialize() const override;
+    int serializedSize() const override { return 2; }
+    void writeTo(WatchDataWriter &writer) const override;
 
 private:
     quint8 m_command = 1; // I guess there's only one command for now
@@ -54,10 +54,8 @@ void AppMetadata::setAppName(const QString &appName)
     m_appName = appName;
 }
 
-QByteArray AppMetadata::serialize() const
+void AppMetadata::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray ret;
-    WatchDataWriter writer(&ret);
     writer.writeUuid(m_uuid);
     writer.writeLE<quint32>(m_flags);
     writer.writeLE<quint32>(m_icon);
@@ -68,6 +66,5 @@ QByteArray AppMetadata::serialize() const
     writer.writeLE<quint8>(m_appFaceBgColor);
     writer.writeLE<quint8>(m_appFaceTemplateId);
     writer.writeFixedString(96, m_appName);
-    return ret;
 }
 
@@ -18,7 +18,8 @@ public:
     void setAppFaceTemplateId(quint8 templateId);
     void setAppName(const QString &appName);
 
-    QByteArray serialize() const;
+    int serializedSize() const override { return 16 + 4 + 4 + 6 + 96; }
+    void writeTo(WatchDataWriter &writer) const override;
 signals:
 
 public slots:
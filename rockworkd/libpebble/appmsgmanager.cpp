@@ -2,8 +2,15 @@
 
 #include "pebble.h"
 #include "appmsgmanager.h"
+#include "packetcodec.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
+#include "linkprobe.h"
+#include "metricsregistry.h"
+#include "tracing.h"
+
+// Time the watch gets to ack a transaction on a fast link, stretched to the measured one
+static const int TRANSACTION_TIMEOUT = 3000;
 
 // TODO D-Bus server for non JS kit apps!!!!
 
@@ -24,13 +31,24 @@ AppMsgManager::AppMsgManager(Pebble *pebble, AppManager *apps, WatchConnection *
             this, &AppMsgManager::handlePebbleConnected);
 
     _timeout->setSingleShot(true);
-    _timeout->setInterval(3000);
+    _timeout->setInterval(TRANSACTION_TIMEOUT);
     connect(_timeout, &QTimer::timeout,
             this, &AppMsgManager::handleTimeout);
 
-    m_connection->registerEndpointHandler(WatchConnection::EndpointLauncher, this, "handleLauncherMessage");
-    m_connection->registerEndpointHandler(WatchConnection::EndpointAppLaunch, this, "handleAppLaunchMessage");
-    m_connection->registerEndpointHandler(WatchConnection::EndpointApplicationMessage, this, "handleApplicationMessage");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointLauncher, this, &AppMsgManager::handleLauncherMessage);
+    m_connection->registerEndpointHandler(WatchConnection::EndpointAppLaunch, this, &AppMsgManager::handleAppLaunchMessage);
+    m_connection->registerEndpointHandler(WatchConnection::EndpointApplicationMessage, this, &AppMsgManager::handleApplicationMessage);
+
+    MetricsRegistry *metrics = m_connection->metrics();
+    m_sent = metrics->counter("appmsg.sent");
+    m_acked = metrics->counter("appmsg.acked");
+    m_nacked = metrics->counter("appmsg.nacked");
+    m_timedOut = metrics->counter("appmsg.timedOut");
+    m_received = metrics->counter("appmsg.received");
+    m_transactionTime = metrics->histogram("appmsg.transactionUsecs");
+    metrics->sampledGauge("appmsg.queued", this, [this]() {
+        return qint64(_pending.size());
+    });
 }
 
 void AppMsgManager::handleLauncherMessage(const QByteArray &data)
@@ -129,11 +147,11 @@ void AppMsgManager::launchApp(const QUuid &uuid)
         dict.insert(1, LauncherActionStart);
 
         qDebug() << "Sending start message to launcher" << uuid << dict;
-        QByteArray msg = buildPushMessage(++_lastTransactionId, uuid, dict);
+        QByteArray msg = PacketCodec::buildPushMessage(++_lastTransactionId, uuid, dict);
         m_connection->writeToPebble(WatchConnection::EndpointLauncher, msg);
     }
     else {
-        QByteArray msg = buildLaunchMessage(LauncherActionStart, uuid);
+        QByteArray msg = PacketCodec::buildLaunchMessage(LauncherActionStart, uuid);
         qDebug() << "Sending start message to launcher" << uuid;
         m_connection->writeToPebble(WatchConnection::EndpointAppLaunch, msg);
     }
@@ -146,11 +164,11 @@ void AppMsgManager::closeApp(const QUuid &uuid)
         dict.insert(1, LauncherActionStop);
 
         qDebug() << "Sending stop message to launcher" << uuid << dict;
-        QByteArray msg = buildPushMessage(++_lastTransactionId, uuid, dict);
+        QByteArray msg = PacketCodec::buildPushMessage(++_lastTransactionId, uuid, dict);
         m_connection->writeToPebble(WatchConnection::EndpointLauncher, msg);
     }
     else {
-        QByteArray msg = buildLaunchMessage(LauncherActionStop, uuid);
+        QByteArray msg = PacketCodec::buildLaunchMessage(LauncherActionStop, uuid);
         qDebug() << "Sending stop message to launcher" << uuid;
         m_connection->writeToPebble(WatchConnection::EndpointAppLaunch, msg);
     }
@@ -187,7 +205,7 @@ WatchConnection::Dict AppMsgManager::mapAppKeys(const QUuid &uuid, const QVarian
     return d;
 }
 
-QVariantMap AppMsgManager::mapAppKeys(const QUuid &uuid, const WatchConnection::Dict &dict)
+QVariantMap AppMsgManager::mapAppKeys(const QUuid &uuid, const WatchDictView &dict)
 {
     AppInfo info = apps->info(uuid);
     if (info.uuid() != uuid) {
@@ -195,97 +213,27 @@ QVariantMap AppMsgManager::mapAppKeys(const QUuid &uuid, const WatchConnection::
     }
 
     QVariantMap data;
-
-    for (WatchConnection::Dict::const_iterator it = dict.constBegin(); it != dict.constEnd(); ++it) {
-        qDebug() << "checking app key" << it.key() << info.appKeys().key(it.key());
-        if (info.appKeys().values().contains(it.key())) {
-            data.insert(info.appKeys().key(it.key()), it.value());
+    const QHash<QString, int> appKeys = info.appKeys();
+
+    // Values are only decoded here, straight into the map handed to the app
+    for (WatchDictView::const_iterator it = dict.begin(); it != dict.end(); ++it) {
+        const WatchDictView::Tuple tuple = *it;
+        const QString name = appKeys.key(tuple.key);
+        if (!name.isEmpty()) {
+            data.insert(name, tuple.value());
         } else {
-            qWarning() << "Unknown appKey value" << it.key() << "for app with GUID" << uuid;
-            data.insert(QString::number(it.key()), it.value());
+            qWarning() << "Unknown appKey value" << tuple.key << "for app with GUID" << uuid;
+            data.insert(QString::number(tuple.key), tuple.value());
         }
     }
 
     return data;
 }
 
-bool AppMsgManager::unpackAppLaunchMessage(const QByteArray &msg, QUuid *uuid)
-{
-    WatchDataReader reader(msg);
-    quint8 action = reader.read<quint8>();
-    Q_UNUSED(action);
-
-    *uuid = reader.readUuid();
-
-    if (reader.bad()) {
-        return false;
-    }
-
-    return true;
-}
-
-bool AppMsgManager::unpackPushMessage(const QByteArray &msg, quint8 *transaction, QUuid *uuid, WatchConnection::Dict *dict)
-{
-    WatchDataReader reader(msg);
-    quint8 code = reader.read<quint8>();
-    Q_UNUSED(code);
-    Q_ASSERT(code == AppMessagePush);
-
-    *transaction = reader.read<quint8>();
-    *uuid = reader.readUuid();
-    *dict = reader.readDict();
-
-    if (reader.bad()) {
-        return false;
-    }
-
-    return true;
-}
-
-QByteArray AppMsgManager::buildPushMessage(quint8 transaction, const QUuid &uuid, const WatchConnection::Dict &dict)
-{
-    QByteArray ba;
-    WatchDataWriter writer(&ba);
-    writer.write<quint8>(AppMessagePush);
-    writer.write<quint8>(transaction);
-    writer.writeUuid(uuid);
-    writer.writeDict(dict);
-
-    return ba;
-}
-
-QByteArray AppMsgManager::buildLaunchMessage(quint8 messageType, const QUuid &uuid)
-{
-    QByteArray ba;
-    WatchDataWriter writer(&ba);
-    writer.write<quint8>(messageType);
-    if (!uuid.isNull()) {
-        writer.writeUuid(uuid);
-    }
-
-    return ba;
-}
-
-QByteArray AppMsgManager::buildAckMessage(quint8 transaction)
-{
-    QByteArray ba(2, Qt::Uninitialized);
-    ba[0] = AppMessageAck;
-    ba[1] = transaction;
-    return ba;
-}
-
-QByteArray AppMsgManager::buildNackMessage(quint8 transaction)
-{
-    QByteArray ba(2, Qt::Uninitialized);
-    ba[0] = AppMessageNack;
-    ba[1] = transaction;
-    return ba;
-}
-
 void AppMsgManager::handleAppLaunchMessage(const QByteArray &data)
 {
     QUuid uuid;
-    if (!unpackAppLaunchMessage(data, &uuid)) {
+    if (!PacketCodec::unpackAppLaunchMessage(data, &uuid)) {
         qWarning() << "Failed to parse App Launch message";
         return;
     }
@@ -310,36 +258,37 @@ void AppMsgManager::handleLauncherPushMessage(const QByteArray &data)
 {
     quint8 transaction;
     QUuid uuid;
-    WatchConnection::Dict dict;
+    WatchDictView dict;
 
-    if (!unpackPushMessage(data, &transaction, &uuid, &dict)) {
+    if (!PacketCodec::unpackPushMessage(data, &transaction, &uuid, &dict)) {
         // Failed to parse!
         // Since we're the only one handling this endpoint,
         // all messages must be accepted
         qWarning() << "Failed to parser LAUNCHER PUSH message";
         return;
     }
-    qDebug() << "have launcher push message" << data.toHex() << dict.keys();
-    if (!dict.contains(1)) {
+    qDebug() << "have launcher push message" << data.toHex();
+    WatchDictView::Tuple action;
+    if (!dict.find(1, &action)) {
         qWarning() << "LAUNCHER message has no item in dict";
         return;
     }
 
-    switch (dict.value(1).toInt()) {
+    switch (action.value().toInt()) {
     case LauncherActionStart:
         qDebug() << "App starting in watch:" << uuid;
-        m_connection->writeToPebble(WatchConnection::EndpointLauncher, buildAckMessage(transaction));
+        m_connection->writeToPebble(WatchConnection::EndpointLauncher, PacketCodec::buildAckMessage(transaction));
         m_currentUuid = uuid;
         emit appStarted(uuid);
         break;
     case LauncherActionStop:
         qDebug() << "App stopping in watch:" << uuid;
-        m_connection->writeToPebble(WatchConnection::EndpointLauncher, buildAckMessage(transaction));
+        m_connection->writeToPebble(WatchConnection::EndpointLauncher, PacketCodec::buildAckMessage(transaction));
         emit appStopped(uuid);
         break;
     default:
-        qWarning() << "LAUNCHER pushed unknown message:" << uuid << dict;
-        m_connection->writeToPebble(WatchConnection::EndpointLauncher, buildNackMessage(transaction));
+        qWarning() << "LAUNCHER pushed unknown message:" << uuid << dict.toDict();
+        m_connection->writeToPebble(WatchConnection::EndpointLauncher, PacketCodec::buildNackMessage(transaction));
         break;
     }
 }
@@ -348,15 +297,16 @@ void AppMsgManager::handlePushMessage(const QByteArray &data)
 {
     quint8 transaction;
     QUuid uuid;
-    WatchConnection::Dict dict;
+    WatchDictView dict;
 
-    if (!unpackPushMessage(data, &transaction, &uuid, &dict)) {
+    if (!PacketCodec::unpackPushMessage(data, &transaction, &uuid, &dict)) {
         qWarning() << "Failed to parse APP_MSG PUSH";
-        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, buildNackMessage(transaction));
+        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, PacketCodec::buildNackMessage(transaction));
         return;
     }
 
-    qDebug() << "Received appmsg PUSH from" << uuid << "with" << dict;
+    qDebug() << "Received appmsg PUSH from" << uuid << "with" << dict.count() << "tuples";
+    m_received->add();
 
     QVariantMap msg = mapAppKeys(uuid, dict);
     qDebug() << "Mapped dict" << msg;
@@ -373,10 +323,10 @@ void AppMsgManager::handlePushMessage(const QByteArray &data)
 
     if (result) {
         qDebug() << "ACKing transaction" << transaction;
-        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, buildAckMessage(transaction));
+        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, PacketCodec::buildAckMessage(transaction));
     } else {
         qDebug() << "NACKing transaction" << transaction;
-        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, buildNackMessage(transaction));
+        m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, PacketCodec::buildNackMessage(transaction));
     }
 }
 
@@ -405,12 +355,16 @@ void AppMsgManager::handleAckMessage(const QByteArray &data, bool ack)
     qDebug() << "Got " << (ack ? "ACK" : "NACK") << " to transaction" << trans.transactionId;
 
     _timeout->stop();
+    m_transactionTime->record(m_transactionSent.nsecsElapsed() / 1000);
+    TRACE_ASYNC_END("appmsg", "transaction", trans.transactionId);
 
     if (ack) {
+        m_acked->add();
         if (trans.ackCallback) {
             trans.ackCallback();
         }
     } else {
+        m_nacked->add();
         if (trans.nackCallback) {
             trans.nackCallback();
         }
@@ -448,6 +402,8 @@ void AppMsgManager::handleTimeout()
     PendingTransaction trans = _pending.dequeue();
 
     qWarning() << "timeout on appmsg transaction" << trans.transactionId;
+    m_timedOut->add();
+    TRACE_ASYNC_END("appmsg", "transaction", trans.transactionId);
 
     if (trans.nackCallback) {
         trans.nackCallback();
@@ -463,11 +419,14 @@ void AppMsgManager::transmitNextPendingTransaction()
     Q_ASSERT(!_pending.empty());
     PendingTransaction &trans = _pending.head();
 
-    QByteArray msg = buildPushMessage(trans.transactionId, trans.uuid, trans.dict);
+    QByteArray msg = PacketCodec::buildPushMessage(trans.transactionId, trans.uuid, trans.dict);
 
     m_connection->writeToPebble(WatchConnection::EndpointApplicationMessage, msg);
+    m_sent->add();
+    m_transactionSent.start();
+    TRACE_ASYNC_BEGIN("appmsg", "transaction", trans.transactionId);
 
-    _timeout->start();
+    _timeout->start(m_connection->linkProbe()->timeout(TRANSACTION_TIMEOUT));
 }
 
 void AppMsgManager::abortPendingTransactions()
@@ -2,12 +2,17 @@
 #define APPMSGMANAGER_H
 
 #include <functional>
+#include <QElapsedTimer>
 #include <QUuid>
 #include <QQueue>
 
 #include "watchconnection.h"
 #include "appmanager.h"
 
+class MetricCounter;
+class MetricHistogram;
+class WatchDictView;
+
 class AppMsgManager : public QObject
 {
     Q_OBJECT
@@ -48,15 +53,7 @@ signals:
 
 private:
     WatchConnection::Dict mapAppKeys(const QUuid &uuid, const QVariantMap &data);
-    QVariantMap mapAppKeys(const QUuid &uuid, const WatchConnection::Dict &dict);
-
-    static bool unpackAppLaunchMessage(const QByteArray &msg, QUuid *uuid);
-    static bool unpackPushMessage(const QByteArray &msg, quint8 *transaction, QUuid *uuid, WatchConnection::Dict *dict);
-
-    static QByteArray buildPushMessage(quint8 transaction, const QUuid &uuid, const WatchConnection::Dict &dict);
-    static QByteArray buildLaunchMessage(quint8 messageType, const QUuid &uuid);
-    static QByteArray buildAckMessage(quint8 transaction);
-    static QByteArray buildNackMessage(quint8 transaction);
+    QVariantMap mapAppKeys(const QUuid &uuid, const WatchDictView &dict);
 
     void handleLauncherPushMessage(const QByteArray &data);
     void handlePushMessage(const QByteArray &data);
@@ -91,6 +88,14 @@ private:
     };
     QQueue<PendingTransaction> _pending;
     QTimer *_timeout;
+    QElapsedTimer m_transactionSent;
+
+    MetricCounter *m_sent;
+    MetricCounter *m_acked;
+    MetricCounter *m_nacked;
+    MetricCounter *m_timedOut;
+    MetricCounter *m_received;
+    MetricHistogram *m_transactionTime;
 };
 
 #endif // APPMSGMANAGER_H
@@ -1,39 +1,92 @@
 #include "blobdb.h"
+#include "packetcodec.h"
 #include "watchconnection.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
+#include "linkprobe.h"
+#include "metricsregistry.h"
+#include "tracing.h"
 
 #include <QDebug>
 #include <QDir>
 #include <QSettings>
+#include <QTimer>
+
+#include <algorithm>
+#include <limits>
+
+// Time the watch gets to reply on a fast link, stretched to the measured one
+static const int REPLY_TIMEOUT = 5000;
+static const int MAX_RETRIES = 2;
+// Keeps the link busy over a round trip without piling more on the watch than it buffers
+static const int DEFAULT_WINDOW = 4;
+// Journal records allowed per pending command before it is compacted
+static const int JOURNAL_SLACK = 4;
+static const int MIN_JOURNAL_RECORDS = 256;
+// Batches the app sync state writes of a connect-time sync into one
+static const int SYNC_STATE_SAVE_DELAY = 2000;
 
 BlobDB::BlobDB(Pebble *pebble, WatchConnection *connection):
     QObject(pebble),
     m_pebble(pebble),
-    m_connection(connection)
+    m_connection(connection),
+    m_window(DEFAULT_WINDOW),
+    // Tokens count up from a random start, so no two commands in flight share one and a late reply
+    // from before a restart is unlikely to match
+    m_lastToken(qrand() % 0xfffe),
+    m_replyTimer(new QTimer(this)),
+    m_syncStateTimer(new QTimer(this))
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointBlobDB, this, "blobCommandReply");
-
-    connect(m_connection, &WatchConnection::watchConnected, [this]() {
-        if (m_currentCommand) {
-            delete m_currentCommand;
-            m_currentCommand = nullptr;
-        }
+    m_connection->registerEndpointHandler(WatchConnection::EndpointBlobDB, this, &BlobDB::blobCommandReply);
+
+    m_replyTimer->setSingleShot(true);
+    connect(m_replyTimer, &QTimer::timeout, this, &BlobDB::replyTimedOut);
+    m_clock.start();
+
+    m_syncStateTimer->setSingleShot(true);
+    m_syncStateTimer->setInterval(SYNC_STATE_SAVE_DELAY);
+    connect(m_syncStateTimer, &QTimer::timeout, this, &BlobDB::saveSyncState);
+
+    MetricsRegistry *metrics = m_connection->metrics();
+    m_commandsSent = metrics->counter("blobdb.commandsSent");
+    m_commandsFailed = metrics->counter("blobdb.commandsFailed");
+    m_retries = metrics->counter("blobdb.retries");
+    m_timeouts = metrics->counter("blobdb.timeouts");
+    m_replyTime = metrics->histogram("blobdb.replyUsecs");
+    metrics->sampledGauge("blobdb.queued", this, [this]() {
+        return qint64(m_commandQueue.count());
+    });
+    metrics->sampledGauge("blobdb.inFlight", this, [this]() {
+        return qint64(m_inFlight.count());
     });
 
+    // Whatever was in flight when the link dropped is sent again once the watch is back
+    connect(m_connection, &WatchConnection::watchConnected, this, &BlobDB::requeueInFlight);
+    connect(m_connection, &WatchConnection::watchDisconnected, this, &BlobDB::watchDisconnected);
+    connect(m_pebble, &Pebble::pebbleConnected, this, &BlobDB::watchReady);
+
     m_blobDBStoragePath = m_pebble->storagePath() + "/blobdb/";
     QDir dir(m_blobDBStoragePath);
     if (!dir.exists() && !dir.mkpath(m_blobDBStoragePath)) {
         qWarning() << "Error creating blobdb storage dir.";
         return;
     }
+    loadJournal();
+    loadSyncState();
+}
+
+BlobDB::~BlobDB()
+{
+    if (m_syncStateTimer->isActive()) {
+        saveSyncState();
+    }
 }
 
 void BlobDB::clearApps()
 {
     clear(BlobDBId::BlobDBIdApp);
-    QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
-    s.remove("");
+    m_syncedApps.clear();
+    scheduleSyncStateSave();
 }
 
 void BlobDB::insertAppMetaData(const AppInfo &info,const bool force)
@@ -43,8 +96,7 @@ void BlobDB::insertAppMetaData(const AppInfo &info,const bool force)
         return;
     }
 
-    QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
-    if (s.value(info.uuid().toString(), false).toBool() && !force) {
+    if (m_syncedApps.contains(info.uuid()) && !force) {
         qWarning() << "App already in DB. Not syncing again";
         return;
     }
@@ -57,51 +109,48 @@ void BlobDB::insertAppMetaData(const AppInfo &info,const bool force)
     cmd->m_database = BlobDBIdApp;
 
     cmd->m_key = metaData.uuid().toRfc4122();
-    cmd->m_value = metaData.serialize();
 
-    m_commandQueue.append(cmd);
-    sendNext();
+    enqueue(cmd, &metaData);
 }
 
 void BlobDB::removeApp(const AppInfo &info)
 {
     remove(BlobDBId::BlobDBIdApp, info.uuid());
-    QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
-    s.remove(info.uuid().toString());
+    m_syncedApps.remove(info.uuid());
+    scheduleSyncStateSave();
 }
 
-void BlobDB::insert(BlobDBId database, const TimelineItem &item)
+void BlobDB::insert(BlobDBId database, const TimelineItem &item, bool deferrable)
 {
-    if (!m_connection->isConnected()) {
-        emit blobCommandResult(database,OperationInsert,item.itemId(),StatusIgnore);
+    if (database == BlobDBIdNotification && !m_ready) {
+        // Left to the timeline, which knows when a notification is too old to be worth sending
+        emit blobCommandResult(database, OperationInsert, item.itemId(), StatusIgnore);
         return;
     }
+
     BlobCommand *cmd = new BlobCommand();
     cmd->m_command = BlobDB::OperationInsert;
     cmd->m_token = generateToken();
     cmd->m_database = database;
 
     cmd->m_key = item.itemId().toRfc4122();
-    cmd->m_value = item.serialize();
+    cmd->m_deferrable = deferrable;
+    cmd->m_journaled = database != BlobDBIdNotification;
 
-    m_commandQueue.append(cmd);
-    sendNext();
+    enqueue(cmd, &item);
 }
 
-void BlobDB::remove(BlobDB::BlobDBId database, const QUuid &uuid)
+void BlobDB::remove(BlobDB::BlobDBId database, const QUuid &uuid, bool deferrable)
 {
-    if (!m_connection->isConnected()) {
-        return;
-    }
     BlobCommand *cmd = new BlobCommand();
     cmd->m_command = BlobDB::OperationDelete;
     cmd->m_token = generateToken();
     cmd->m_database = database;
 
     cmd->m_key = uuid.toRfc4122();
+    cmd->m_deferrable = deferrable;
 
-    m_commandQueue.append(cmd);
-    sendNext();
+    enqueue(cmd);
 }
 
 void BlobDB::clear(BlobDB::BlobDBId database)
@@ -111,8 +160,19 @@ void BlobDB::clear(BlobDB::BlobDBId database)
     cmd->m_token = generateToken();
     cmd->m_database = database;
 
-    m_commandQueue.append(cmd);
-    sendNext();
+    enqueue(cmd);
+}
+
+void BlobDB::cancel(BlobDB::BlobDBId database, const QUuid &uuid)
+{
+    const QByteArray key = uuid.toRfc4122();
+    for (int i = m_commandQueue.count() - 1; i >= 0; i--) {
+        BlobCommand *cmd = m_commandQueue.at(i);
+        if (cmd->m_database == database && cmd->m_key == key) {
+            m_commandQueue.removeAt(i);
+            finish(cmd);
+        }
+    }
 }
 
 void BlobDB::setHealthParams(const HealthParams &healthParams)
@@ -123,11 +183,10 @@ void BlobDB::setHealthParams(const HealthParams &healthParams)
     cmd->m_database = BlobDBIdAppSettings;
 
     cmd->m_key = "activityPreferences";
-    cmd->m_value = healthParams.serialize();
+    cmd->m_deferrable = true;
 
-    qDebug() << "Setting health params. Enabled:" << healthParams.enabled() << cmd->serialize().toHex();
-    m_commandQueue.append(cmd);
-    sendNext();
+    enqueue(cmd, &healthParams);
+    qDebug() << "Setting health params. Enabled:" << healthParams.enabled() << cmd->m_encoded.toHex();
 }
 
 void BlobDB::setUnits(bool imperial)
@@ -138,12 +197,24 @@ void BlobDB::setUnits(bool imperial)
     cmd->m_database = BlobDBIdAppSettings;
 
     cmd->m_key = "unitsDistance";
+    cmd->m_deferrable = true;
     WatchDataWriter writer(&cmd->m_value);
     writer.write<quint8>(imperial ? 0x01 : 0x00);
 
-    m_commandQueue.append(cmd);
+    enqueue(cmd);
+}
+
+void BlobDB::setWindow(int commands)
+{
+    m_window = qMax(1, commands);
     sendNext();
 }
+
+int BlobDB::window() const
+{
+    return m_window;
+}
+
 static QString BlobDBErrMsg[9]={"Unknown",
                          "Success",
                          "General Failure",
@@ -160,41 +231,327 @@ void BlobDB::blobCommandReply(const QByteArray &data)
     WatchDataReader reader(data);
     quint16 token = reader.readLE<quint16>();
     Status status = (Status)reader.read<quint8>();
-    if (m_currentCommand->m_token != token) {
-        qWarning() << "Received reply for unexpected token";
-    } else if (status != StatusSuccess) {
+    // Replies may come in any order, the token says which command they are for
+    BlobCommand *cmd = m_inFlight.take(token);
+    if (!cmd) {
+        // A late reply to a command that was already retried and answered
+        qWarning() << "Received reply for token" << token << "with no command pending";
+        return;
+    }
+
+    m_replyTime->record(cmd->m_sent.nsecsElapsed() / 1000);
+    TRACE_ASYNC_END("blobdb", "command", token);
+    if (status != StatusSuccess) {
         qWarning() << "Blob Command failed:" << status << BlobDBErrMsg[status];
-        emit blobCommandResult(m_currentCommand->m_database, m_currentCommand->m_command, QUuid::fromRfc4122(m_currentCommand->m_key), status);
+        m_commandsFailed->add();
+        emit blobCommandResult(cmd->m_database, cmd->m_command, QUuid::fromRfc4122(cmd->m_key), status);
     } else { // All is well
-        if (m_currentCommand->m_database == BlobDBIdApp && m_currentCommand->m_command == OperationInsert) {
-            QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
-            QUuid appUuid = QUuid::fromRfc4122(m_currentCommand->m_key);
-            s.setValue(appUuid.toString(), true);
+        if (cmd->m_database == BlobDBIdApp && cmd->m_command == OperationInsert) {
+            QUuid appUuid = QUuid::fromRfc4122(cmd->m_key);
+            m_syncedApps.insert(appUuid);
+            scheduleSyncStateSave();
             emit appInserted(appUuid);
         } else {
-            emit blobCommandResult(m_currentCommand->m_database, m_currentCommand->m_command, QUuid::fromRfc4122(m_currentCommand->m_key), status);
+            emit blobCommandResult(cmd->m_database, cmd->m_command, QUuid::fromRfc4122(cmd->m_key), status);
         }
     }
+    finish(cmd);
 
-    if (m_currentCommand && token == m_currentCommand->m_token) {
-        delete m_currentCommand;
-        m_currentCommand = nullptr;
-        sendNext();
+    if (m_journal.records() > JOURNAL_SLACK * (m_inFlight.count() + m_commandQueue.count()) + MIN_JOURNAL_RECORDS) {
+        compactJournal();
     }
+    scheduleReplyTimer();
+    sendNext();
 }
 
 void BlobDB::sendNext()
 {
-    if (m_currentCommand || m_commandQueue.isEmpty()) {
+    if (!m_ready) {
+        // Kept for watchReady()
+        return;
+    }
+    // A command that has to wait holds back later ones that depend on it, so they stay in order
+    QList<BlobCommand*> waiting;
+    int i = 0;
+    while (i < m_commandQueue.count() && m_inFlight.count() < m_window) {
+        BlobCommand *cmd = m_commandQueue.at(i);
+        bool blocked = false;
+        for (QHash<quint16, BlobCommand*>::const_iterator it = m_inFlight.constBegin(); it != m_inFlight.constEnd() && !blocked; ++it) {
+            blocked = dependsOn(cmd, it.value());
+        }
+        for (int j = 0; j < waiting.count() && !blocked; j++) {
+            blocked = dependsOn(cmd, waiting.at(j));
+        }
+        if (blocked) {
+            waiting.append(cmd);
+            i++;
+            continue;
+        }
+        m_commandQueue.removeAt(i);
+        send(cmd);
+    }
+}
+
+void BlobDB::send(BlobCommand *cmd)
+{
+    m_inFlight.insert(cmd->m_token, cmd);
+    m_commandsSent->add();
+    cmd->m_sent.start();
+    TRACE_ASYNC_BEGIN("blobdb", "command", cmd->m_token);
+    int timeout = m_connection->linkProbe()->timeout(REPLY_TIMEOUT);
+    if (cmd->m_deferrable) {
+        m_connection->deferToPebble(WatchConnection::EndpointBlobDB, cmd->m_encoded);
+        timeout += m_connection->deferWindow();
+    } else {
+        m_connection->writeToPebble(WatchConnection::EndpointBlobDB, cmd->m_encoded);
+    }
+    cmd->m_deadline = m_clock.elapsed() + timeout;
+    scheduleReplyTimer();
+}
+
+void BlobDB::scheduleReplyTimer()
+{
+    if (m_inFlight.isEmpty()) {
+        m_replyTimer->stop();
+        return;
+    }
+    qint64 deadline = std::numeric_limits<qint64>::max();
+    foreach (const BlobCommand *cmd, m_inFlight) {
+        deadline = qMin(deadline, cmd->m_deadline);
+    }
+    m_replyTimer->start(int(qMax<qint64>(0, deadline - m_clock.elapsed())));
+}
+
+bool BlobDB::dependsOn(const BlobCommand *later, const BlobCommand *earlier)
+{
+    if (later->m_database != earlier->m_database) {
+        return false;
+    }
+    return later->m_command == OperationClear || earlier->m_command == OperationClear || later->m_key == earlier->m_key;
+}
+
+void BlobDB::replyTimedOut()
+{
+    const qint64 now = m_clock.elapsed();
+    QList<BlobCommand*> expired;
+    foreach (BlobCommand *cmd, m_inFlight) {
+        if (cmd->m_deadline <= now) {
+            expired.append(cmd);
+        }
+    }
+
+    foreach (BlobCommand *cmd, expired) {
+        if (cmd->m_retries < MAX_RETRIES && m_connection->isConnected()) {
+            // Same token, so whichever reply comes first completes the command
+            cmd->m_retries++;
+            m_retries->add();
+            qWarning() << "No reply for blob command" << cmd->m_token << "retrying";
+            m_connection->writeToPebble(WatchConnection::EndpointBlobDB, cmd->m_encoded);
+            cmd->m_deadline = now + (m_connection->linkProbe()->timeout(REPLY_TIMEOUT) << cmd->m_retries);
+            continue;
+        }
+
+        qWarning() << "Blob command" << cmd->m_token << "timed out";
+        m_timeouts->add();
+        TRACE_ASYNC_END("blobdb", "command", cmd->m_token);
+        m_inFlight.remove(cmd->m_token);
+        emit blobCommandResult(cmd->m_database, cmd->m_command, QUuid::fromRfc4122(cmd->m_key), StatusTimeout);
+        finish(cmd);
+    }
+
+    scheduleReplyTimer();
+    sendNext();
+}
+
+void BlobDB::enqueue(BlobCommand *cmd, const PebblePacket *value)
+{
+    cmd->m_encoded = PacketCodec::buildBlobCommand(cmd->m_command, cmd->m_token, cmd->m_database, cmd->m_key, cmd->m_value, value);
+
+    supersede(cmd);
+    cmd->m_seq = cmd->m_journaled ? m_journal.append(cmd->m_encoded) : m_journal.nextSeq();
+    m_commandQueue.append(cmd);
+    if (!cmd->m_deferrable) {
+        foreach (const BlobCommand *sent, m_inFlight) {
+            if (sent->m_deferrable) {
+                // Don't let a held command keep this one waiting for the rest of the window
+                m_connection->flushDeferred();
+                break;
+            }
+        }
+    }
+    sendNext();
+}
+
+void BlobDB::supersede(const BlobCommand *cmd)
+{
+    for (int i = m_commandQueue.count() - 1; i >= 0; i--) {
+        BlobCommand *queued = m_commandQueue.at(i);
+        if (queued->m_database != cmd->m_database) {
+            continue;
+        }
+        if (queued->m_command == OperationClear) {
+            // What came before it was dropped when the clear was queued
+            break;
+        }
+        if (cmd->m_command == OperationClear || queued->m_key == cmd->m_key) {
+            m_commandQueue.removeAt(i);
+            finish(queued);
+            if (cmd->m_command != OperationClear) {
+                break;
+            }
+        }
+    }
+}
+
+void BlobDB::requeueInFlight()
+{
+    m_replyTimer->stop();
+    if (m_inFlight.isEmpty()) {
         return;
     }
-    m_currentCommand = m_commandQueue.takeFirst();
-    m_connection->writeToPebble(WatchConnection::EndpointBlobDB, m_currentCommand->serialize());
+    qDebug() << m_inFlight.count() << "BlobDB commands went unanswered, sending them again later";
+    foreach (BlobCommand *cmd, m_inFlight) {
+        TRACE_ASYNC_END("blobdb", "command", cmd->m_token);
+        cmd->m_retries = 0;
+        m_commandQueue.append(cmd);
+    }
+    m_inFlight.clear();
+    // Back in the order they were given in, which keeps every command behind the ones it depends on
+    std::stable_sort(m_commandQueue.begin(), m_commandQueue.end(), [](const BlobCommand *a, const BlobCommand *b) {
+        return a->m_seq < b->m_seq;
+    });
+}
+
+void BlobDB::dropUnjournaled()
+{
+    QList<BlobCommand*> dropped;
+    for (int i = m_commandQueue.count() - 1; i >= 0; i--) {
+        if (!m_commandQueue.at(i)->m_journaled) {
+            dropped.prepend(m_commandQueue.takeAt(i));
+        }
+    }
+    foreach (BlobCommand *cmd, dropped) {
+        emit blobCommandResult(cmd->m_database, cmd->m_command, QUuid::fromRfc4122(cmd->m_key), StatusIgnore);
+        finish(cmd);
+    }
+}
+
+void BlobDB::finish(BlobCommand *cmd)
+{
+    if (cmd->m_journaled) {
+        m_journal.done(cmd->m_seq);
+    }
+    delete cmd;
+}
+
+void BlobDB::watchReady()
+{
+    if (m_pebble->recovery()) {
+        // Nothing to store things in while the watch waits for firmware
+        return;
+    }
+    m_ready = true;
+    if (!m_commandQueue.isEmpty()) {
+        qDebug() << "Sending" << m_commandQueue.count() << "BlobDB commands held while the watch was away";
+    }
+    compactJournal();
+    sendNext();
+}
+
+void BlobDB::watchDisconnected()
+{
+    m_ready = false;
+    requeueInFlight();
+    dropUnjournaled();
+}
+
+void BlobDB::loadJournal()
+{
+    const QList<BlobDBJournal::Entry> entries = m_journal.open(m_blobDBStoragePath + "/journal");
+    foreach (const BlobDBJournal::Entry &entry, entries) {
+        BlobCommand *cmd = new BlobCommand();
+        quint8 command = 0;
+        quint8 database = 0;
+        if (!PacketCodec::readBlobCommand(entry.encoded, &command, &cmd->m_token, &database, &cmd->m_key)) {
+            qWarning() << "Dropping unreadable BlobDB journal entry" << entry.seq;
+            finish(cmd);
+            continue;
+        }
+        cmd->m_command = (Operation)command;
+        cmd->m_database = (BlobDBId)database;
+        if (cmd->m_database == BlobDBIdNotification && cmd->m_command == OperationInsert) {
+            // Logged by an older build, stale by now
+            finish(cmd);
+            continue;
+        }
+        // Tokens aren't kept across restarts, give it one that can't clash
+        cmd->m_token = generateToken();
+        cmd->m_encoded = entry.encoded;
+        WatchDataWriter writer(&cmd->m_encoded, 1);
+        writer.writeLE<quint16>(cmd->m_token);
+        cmd->m_seq = entry.seq;
+
+        supersede(cmd);
+        m_commandQueue.append(cmd);
+    }
+    if (!entries.isEmpty()) {
+        qDebug() << "Journal holds" << m_commandQueue.count() << "BlobDB commands the watch hasn't seen yet";
+        compactJournal();
+    }
+}
+
+void BlobDB::compactJournal()
+{
+    QList<BlobCommand*> pending = m_inFlight.values();
+    pending.append(m_commandQueue);
+    std::sort(pending.begin(), pending.end(), [](const BlobCommand *a, const BlobCommand *b) {
+        return a->m_seq < b->m_seq;
+    });
+
+    QList<BlobDBJournal::Entry> entries;
+    foreach (const BlobCommand *cmd, pending) {
+        if (!cmd->m_journaled) {
+            continue;
+        }
+        BlobDBJournal::Entry entry;
+        entry.seq = cmd->m_seq;
+        entry.encoded = cmd->m_encoded;
+        entries.append(entry);
+    }
+    m_journal.rewrite(entries);
+}
+
+void BlobDB::loadSyncState()
+{
+    QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
+    foreach (const QString &key, s.childKeys()) {
+        if (s.value(key).toBool()) {
+            m_syncedApps.insert(QUuid(key));
+        }
+    }
+}
+
+void BlobDB::scheduleSyncStateSave()
+{
+    if (!m_syncStateTimer->isActive()) {
+        m_syncStateTimer->start();
+    }
+}
+
+void BlobDB::saveSyncState()
+{
+    m_syncStateTimer->stop();
+    QSettings s(m_blobDBStoragePath + "/appsyncstate.conf", QSettings::IniFormat);
+    s.clear();
+    foreach (const QUuid &uuid, m_syncedApps) {
+        s.setValue(uuid.toString(), true);
+    }
 }
 
 quint16 BlobDB::generateToken()
 {
-    return (qrand() % ((int)pow(2, 16) - 2)) + 1;
+    m_lastToken = m_lastToken % 0xfffe + 1;
+    return m_lastToken;
 }
 
 AppMetadata BlobDB::appInfoToMetadata(const AppInfo &info, HardwarePlatform hardwarePlatform)
@@ -246,22 +603,3 @@ AppMetadata BlobDB::appInfoToMetadata(const AppInfo &info, HardwarePlatform hard
     return metadata;
 
 }
-
-QByteArray BlobDB::BlobCommand::serialize() const
-{
-    QByteArray ret;
-    ret.append((quint8)m_command);
-    ret.append(m_token & 0xFF); ret.append(((m_token >> 8) & 0xFF));
-    ret.append((quint8)m_database);
-
-    if (m_command == BlobDB::OperationInsert || m_command == BlobDB::OperationDelete) {
-        ret.append(m_key.length() & 0xFF);
-        ret.append(m_key);
-    }
-    if (m_command == BlobDB::OperationInsert) {
-        ret.append(m_value.length() & 0xFF); ret.append((m_value.length() >> 8) & 0xFF); // value length
-        ret.append(m_value);
-    }
-
-    return ret;
-}
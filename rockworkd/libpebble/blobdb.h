@@ -6,8 +6,15 @@
 #include "timelineitem.h"
 #include "healthparams.h"
 #include "appmetadata.h"
+#include "blobdbjournal.h"
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <QSet>
+
+class MetricCounter;
+class MetricHistogram;
+class QTimer;
 
 class BlobDB : public QObject
 {
@@ -42,37 +49,76 @@ public:
         StatusInvalData = 0x5,
         StatusNoSuchKey = 0x6,
         StatusDbIsFull = 0x7,
-        StatusDbIsStale = 0x8
+        StatusDbIsStale = 0x8,
+        // Not from the watch: it didn't answer, not even to the retries
+        StatusTimeout = 0xff
     };
 
+    // Commands are journaled until the watch answers them. Those given while the watch is away, or
+    // left over from before a restart, go out once it is back and has been identified. Notifications
+    // are the exception: they go stale, so they are reported as ignored while the watch is away and
+    // dropped the same way when it leaves before they went out.
     explicit BlobDB(Pebble *pebble, WatchConnection *connection);
+    ~BlobDB();
 
     void clearApps();
     void insertAppMetaData(const AppInfo &info, const bool force=false);
     void removeApp(const AppInfo &info);
 
-    void insert(BlobDBId database, const TimelineItem &item);
-    void remove(BlobDBId database, const QUuid &uuid);
+    // Deferrable commands wait for the connection's coalescing window, see WatchConnection::deferToPebble()
+    void insert(BlobDBId database, const TimelineItem &item, bool deferrable = false);
+    void remove(BlobDBId database, const QUuid &uuid, bool deferrable = false);
     void clear(BlobDBId database);
+    // Drops the commands for uuid that haven't gone out yet, from the queue and the journal
+    void cancel(BlobDBId database, const QUuid &uuid);
 
     void setHealthParams(const HealthParams &healthParams);
     void setUnits(bool imperial);
 
+    // Commands sent before waiting for a reply, 1 sends them one by one. A command never overtakes an
+    // earlier one for the same key, nor anything for a database that is being cleared.
+    void setWindow(int commands);
+    int window() const;
+
 private slots:
     void blobCommandReply(const QByteArray &data);
     void sendNext();
+    void replyTimedOut();
+    void watchReady();
+    void watchDisconnected();
+    void saveSyncState();
 
 signals:
     void appInserted(const QUuid &uuid);
     void blobCommandResult(BlobDBId db, Operation cmd, const QUuid &uuid, Status ack);
 
 private:
+    class BlobCommand;
+
     quint16 generateToken();
+    void enqueue(BlobCommand *cmd, const PebblePacket *value = nullptr);
+    void send(BlobCommand *cmd);
+    // Arms the reply timer for the command in flight that is due first
+    void scheduleReplyTimer();
+    // Whether later has to wait for earlier to be answered
+    static bool dependsOn(const BlobCommand *later, const BlobCommand *earlier);
+    // Drops queued commands that cmd makes pointless: earlier ones for its key, or for its database if it clears it
+    void supersede(const BlobCommand *cmd);
+    // Puts the commands the watch didn't answer back at the front of the queue
+    void requeueInFlight();
+    // Reports the commands that aren't journaled as ignored and drops them
+    void dropUnjournaled();
+    void finish(BlobCommand *cmd);
+    void loadJournal();
+    void compactJournal();
+    void loadSyncState();
+    // Writes the app sync state a little later, together with whatever else changes meanwhile
+    void scheduleSyncStateSave();
     AppMetadata appInfoToMetadata(const AppInfo &info, HardwarePlatform hardwarePlatform);
 
 private:
 
-    class BlobCommand: public PebblePacket
+    class BlobCommand
     {
     public:
         BlobDB::Operation m_command; // quint8
@@ -82,7 +128,16 @@ private:
         QByteArray m_key;
         QByteArray m_value;
 
-        QByteArray serialize() const override;
+        // The frame sent to the watch, built once when the command is queued
+        QByteArray m_encoded;
+        int m_retries = 0;
+        bool m_deferrable = false;
+        QElapsedTimer m_sent;
+        // Order in which commands were queued, and their key in the journal
+        quint32 m_seq = 0;
+        bool m_journaled = true;
+        // Against BlobDB::m_clock, when the command is retried or given up on
+        qint64 m_deadline = 0;
     };
 
     Pebble *m_pebble;
@@ -90,10 +145,27 @@ private:
 
     HealthParams m_healthParams;
 
-    BlobCommand *m_currentCommand = nullptr;
+    // Sent and waiting for a reply, by token
+    QHash<quint16, BlobCommand*> m_inFlight;
     QList<BlobCommand*> m_commandQueue;
+    int m_window;
+    quint16 m_lastToken;
+    QTimer *m_replyTimer;
+    QElapsedTimer m_clock;
+    // Connected and past the version exchange
+    bool m_ready = false;
+    BlobDBJournal m_journal;
+
+    MetricCounter *m_commandsSent;
+    MetricCounter *m_commandsFailed;
+    MetricCounter *m_retries;
+    MetricCounter *m_timeouts;
+    MetricHistogram *m_replyTime;
 
     QString m_blobDBStoragePath;
+    // Apps the watch has in its app database, mirrors appsyncstate.conf
+    QSet<QUuid> m_syncedApps;
+    QTimer *m_syncStateTimer;
 };
 
 #endif // BLOBDB_H
@@ -0,0 +1,130 @@
+#include "blobdbjournal.h"
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+
+#include <QDebug>
+#include <QMap>
+#include <QSaveFile>
+
+BlobDBJournal::BlobDBJournal()
+{
+}
+
+QList<BlobDBJournal::Entry> BlobDBJournal::open(const QString &fileName)
+{
+    m_file.close();
+    m_file.setFileName(fileName);
+
+    QMap<quint32, QByteArray> pending;
+    if (m_file.open(QFile::ReadOnly)) {
+        const QByteArray data = m_file.readAll();
+        m_file.close();
+
+        WatchDataReader reader(data);
+        while (reader.offset() < data.length()) {
+            const quint8 type = reader.read<quint8>();
+            const quint32 seq = reader.readLE<quint32>();
+            if (type == RecordCommand) {
+                const QByteArray encoded = reader.readBytes(reader.readLE<quint16>());
+                if (reader.bad()) {
+                    break;
+                }
+                pending.insert(seq, encoded);
+            } else if (type == RecordDone && !reader.bad()) {
+                pending.remove(seq);
+            } else {
+                break;
+            }
+            m_lastSeq = qMax(m_lastSeq, seq);
+        }
+        if (reader.bad() || reader.offset() < data.length()) {
+            qWarning() << "BlobDB journal" << fileName << "ends in a partial record at" << reader.offset() << "of" << data.length();
+        }
+    }
+
+    QList<Entry> entries;
+    for (QMap<quint32, QByteArray>::const_iterator it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        Entry entry;
+        entry.seq = it.key();
+        entry.encoded = it.value();
+        entries.append(entry);
+    }
+    rewrite(entries);
+    return entries;
+}
+
+quint32 BlobDBJournal::append(const QByteArray &encoded)
+{
+    ++m_lastSeq;
+    if (!m_file.isOpen()) {
+        return m_lastSeq;
+    }
+    QByteArray record;
+    WatchDataWriter writer(&record);
+    writer.write<quint8>(RecordCommand);
+    writer.writeLE<quint32>(m_lastSeq);
+    writer.writeLE<quint16>(encoded.length());
+    record.append(encoded);
+    write(record);
+    return m_lastSeq;
+}
+
+quint32 BlobDBJournal::nextSeq()
+{
+    return ++m_lastSeq;
+}
+
+void BlobDBJournal::done(quint32 seq)
+{
+    if (!m_file.isOpen() || seq == 0) {
+        return;
+    }
+    QByteArray record;
+    WatchDataWriter writer(&record);
+    writer.write<quint8>(RecordDone);
+    writer.writeLE<quint32>(seq);
+    write(record);
+}
+
+void BlobDBJournal::rewrite(const QList<Entry> &pending)
+{
+    if (m_file.fileName().isEmpty()) {
+        return;
+    }
+    m_file.close();
+    m_records = 0;
+
+    QByteArray data;
+    WatchDataWriter writer(&data);
+    foreach (const Entry &entry, pending) {
+        writer.write<quint8>(RecordCommand);
+        writer.writeLE<quint32>(entry.seq);
+        writer.writeLE<quint16>(entry.encoded.length());
+        writer.writeBytes(entry.encoded.length(), entry.encoded);
+    }
+
+    // Swapped in whole, a crash leaves either the old log or the new one
+    QSaveFile file(m_file.fileName());
+    if (!file.open(QFile::WriteOnly) || file.write(data) != data.length() || !file.commit()) {
+        qWarning() << "Cannot rewrite BlobDB journal" << m_file.fileName() << file.errorString();
+    }
+    m_records = pending.count();
+
+    if (!m_file.open(QFile::WriteOnly | QFile::Append)) {
+        qWarning() << "Cannot open BlobDB journal" << m_file.fileName() << m_file.errorString();
+    }
+}
+
+int BlobDBJournal::records() const
+{
+    return m_records;
+}
+
+void BlobDBJournal::write(const QByteArray &record)
+{
+    // Handed to the kernel right away, so it survives the daemon going down
+    if (m_file.write(record) != record.length() || !m_file.flush()) {
+        qWarning() << "Cannot write to BlobDB journal" << m_file.fileName() << m_file.errorString();
+    }
+    m_records++;
+}
@@ -0,0 +1,55 @@
+#ifndef BLOBDBJOURNAL_H
+#define BLOBDBJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+/*
+ * Write-ahead log of the BlobDB commands the watch hasn't answered yet, so they survive the link
+ * and the daemon going away.
+ *
+ * The file is a sequence of records: a command (its encoded frame under a sequence number) when
+ * it is queued, and the sequence number again once it is done with. Loading keeps the commands
+ * that weren't done. A record cut short by a crash ends the log. rewrite() compacts it down to the
+ * given commands.
+ */
+class BlobDBJournal
+{
+public:
+    struct Entry {
+        quint32 seq;
+        QByteArray encoded;
+    };
+
+    BlobDBJournal();
+
+    // Returns the pending commands, oldest first
+    QList<Entry> open(const QString &fileName);
+
+    // Returns the sequence number of the command, handed out even if the journal couldn't be opened
+    quint32 append(const QByteArray &encoded);
+    // Returns a sequence number for a command that isn't logged, to keep it in order with the others
+    quint32 nextSeq();
+    void done(quint32 seq);
+    // Replaces the log with just these commands
+    void rewrite(const QList<Entry> &pending);
+
+    // Records written since the last rewrite, for deciding when to compact
+    int records() const;
+
+private:
+    enum RecordType {
+        RecordCommand = 1,
+        RecordDone = 2
+    };
+
+    void write(const QByteArray &record);
+
+    QFile m_file;
+    quint32 m_lastSeq = 0;
+    int m_records = 0;
+};
+
+#endif // BLOBDBJOURNAL_H
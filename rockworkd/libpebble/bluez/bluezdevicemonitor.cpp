@@ -0,0 +1,119 @@
+#include "bluezdevicemonitor.h"
+#include "dbus-shared.h"
+
+#include <QDebug>
+
+BluezDeviceMonitor::BluezDeviceMonitor(const QBluetoothAddress &address, QObject *parent):
+    QObject(parent),
+    m_address(address),
+    m_dbus(QDBusConnection::systemBus()),
+    m_bluezManager(new DBusObjectManagerInterface(BLUEZ_SERVICE, "/", m_dbus, this))
+{
+    qDBusRegisterMetaType<InterfaceList>();
+    qDBusRegisterMetaType<ManagedObjectList>();
+
+    if (!m_bluezManager->isValid()) {
+        qWarning() << "BlueZ object manager not available, can't follow" << m_address.toString();
+        return;
+    }
+
+    connect(m_bluezManager, SIGNAL(InterfacesAdded(const QDBusObjectPath&, InterfaceList)),
+            this, SLOT(slotInterfacesAdded(const QDBusObjectPath&, InterfaceList)));
+    connect(m_bluezManager, SIGNAL(InterfacesRemoved(const QDBusObjectPath&, const QStringList&)),
+            this, SLOT(slotInterfacesRemoved(const QDBusObjectPath&, const QStringList&)));
+
+    watchCall(m_bluezManager->GetManagedObjects(), [this](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<ManagedObjectList> reply = *call;
+        call->deleteLater();
+        if (reply.isError()) {
+            qWarning() << "Error listing BlueZ objects:" << reply.error().message();
+            return;
+        }
+        const ManagedObjectList objects = reply.value();
+        for (ManagedObjectList::const_iterator it = objects.constBegin(); it != objects.constEnd(); ++it) {
+            if (it.value().contains(BLUEZ_DEVICE_IFACE)) {
+                attach(it.key(), it.value().value(BLUEZ_DEVICE_IFACE));
+            }
+        }
+    });
+}
+
+bool BluezDeviceMonitor::isValid() const
+{
+    return m_properties != nullptr;
+}
+
+bool BluezDeviceMonitor::connected() const
+{
+    return m_connected;
+}
+
+bool BluezDeviceMonitor::servicesResolved() const
+{
+    return m_servicesResolved;
+}
+
+qint16 BluezDeviceMonitor::rssi() const
+{
+    return m_rssi;
+}
+
+void BluezDeviceMonitor::slotInterfacesAdded(const QDBusObjectPath &path, InterfaceList ifaces)
+{
+    if (ifaces.contains(BLUEZ_DEVICE_IFACE)) {
+        attach(path, ifaces.value(BLUEZ_DEVICE_IFACE));
+    }
+}
+
+void BluezDeviceMonitor::slotInterfacesRemoved(const QDBusObjectPath &path, const QStringList &ifaces)
+{
+    if (path.path() != m_path || !ifaces.contains(BLUEZ_DEVICE_IFACE)) {
+        return;
+    }
+    qDebug() << "BlueZ forgot" << m_address.toString();
+    delete m_properties;
+    m_properties = nullptr;
+    m_path.clear();
+    update(QVariantMap(), QStringList() << "Connected" << "ServicesResolved" << "RSSI");
+}
+
+void BluezDeviceMonitor::slotPropertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated)
+{
+    if (interface == BLUEZ_DEVICE_IFACE) {
+        update(changed, invalidated);
+    }
+}
+
+void BluezDeviceMonitor::attach(const QDBusObjectPath &path, const QVariantMap &properties)
+{
+    if (m_properties || QBluetoothAddress(properties.value("Address").toString()) != m_address) {
+        return;
+    }
+    qDebug() << "Following BlueZ device" << path.path() << "for" << m_address.toString();
+    m_path = path.path();
+    m_properties = new FreeDesktopProperties(BLUEZ_SERVICE, m_path, m_dbus, this);
+    connect(m_properties, &FreeDesktopProperties::PropertiesChanged, this, &BluezDeviceMonitor::slotPropertiesChanged);
+    update(properties, QStringList());
+}
+
+void BluezDeviceMonitor::update(const QVariantMap &changed, const QStringList &invalidated)
+{
+    if (changed.contains("Connected") || invalidated.contains("Connected")) {
+        const bool connected = changed.value("Connected", false).toBool();
+        if (connected != m_connected) {
+            m_connected = connected;
+            emit connectedChanged(m_connected);
+        }
+    }
+    if (changed.contains("ServicesResolved") || invalidated.contains("ServicesResolved")) {
+        const bool resolved = changed.value("ServicesResolved", false).toBool();
+        if (resolved != m_servicesResolved) {
+            m_servicesResolved = resolved;
+            emit servicesResolvedChanged(m_servicesResolved);
+        }
+    }
+    if (changed.contains("RSSI") || invalidated.contains("RSSI")) {
+        m_rssi = changed.value("RSSI", 0).toInt();
+        emit rssiChanged(m_rssi);
+    }
+}
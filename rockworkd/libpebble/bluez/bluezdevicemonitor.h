@@ -0,0 +1,52 @@
+#ifndef BLUEZDEVICEMONITOR_H
+#define BLUEZDEVICEMONITOR_H
+
+#include <QObject>
+#include <QBluetoothAddress>
+#include <QDBusConnection>
+
+#include "bluez_helper.h"
+#include "freedesktop_objectmanager.h"
+#include "freedesktop_properties.h"
+
+// Follows the org.bluez.Device1 properties of one device. The device doesn't need to be known to BlueZ
+// yet, it is picked up once it appears.
+class BluezDeviceMonitor: public QObject
+{
+    Q_OBJECT
+
+public:
+    BluezDeviceMonitor(const QBluetoothAddress &address, QObject *parent = 0);
+
+    bool isValid() const;
+    bool connected() const;
+    bool servicesResolved() const;
+    // Only known while the device is being seen in a discovery, 0 otherwise
+    qint16 rssi() const;
+
+signals:
+    void connectedChanged(bool connected);
+    void servicesResolvedChanged(bool resolved);
+    void rssiChanged(qint16 rssi);
+
+private slots:
+    void slotInterfacesAdded(const QDBusObjectPath &path, InterfaceList ifaces);
+    void slotInterfacesRemoved(const QDBusObjectPath &path, const QStringList &ifaces);
+    void slotPropertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated);
+
+private:
+    void attach(const QDBusObjectPath &path, const QVariantMap &properties);
+    void update(const QVariantMap &changed, const QStringList &invalidated);
+
+    QBluetoothAddress m_address;
+    QDBusConnection m_dbus;
+    DBusObjectManagerInterface *m_bluezManager;
+    FreeDesktopProperties *m_properties = nullptr;
+    QString m_path;
+
+    bool m_connected = false;
+    bool m_servicesResolved = false;
+    qint16 m_rssi = 0;
+};
+
+#endif // BLUEZDEVICEMONITOR_H
@@ -1,7 +1,11 @@
 #include "bundle.h"
+#include "stm32crc.h"
+#include "ziphelper.h"
 
 #include <QVariantMap>
+#include <QFile>
 #include <QFileInfo>
+#include <QScopedPointer>
 #include <QDebug>
 #include <QJsonParseError>
 
@@ -16,14 +20,46 @@ QString Bundle::path() const
     return m_path;
 }
 
+void Bundle::setArchive(const QString &archiveFilename)
+{
+    m_archive = archiveFilename;
+}
+
 QString Bundle::file(Bundle::FileType type, HardwarePlatform hardwarePlatform) const
+{
+    const QString entry = entryName(type, hardwarePlatform);
+    return entry.isEmpty() ? QString() : m_path + "/" + entry;
+}
+
+QIODevice *Bundle::open(Bundle::FileType type, HardwarePlatform hardwarePlatform, qint64 *size) const
+{
+    const QString entry = entryName(type, hardwarePlatform);
+    if (entry.isEmpty()) {
+        return nullptr;
+    }
+    if (!m_archive.isEmpty()) {
+        return ZipHelper::openEntry(m_archive, entry, size);
+    }
+    QFile *f = new QFile(m_path + "/" + entry);
+    if (!f->open(QFile::ReadOnly)) {
+        qWarning() << "Error opening" << f->fileName();
+        delete f;
+        return nullptr;
+    }
+    if (size) {
+        *size = f->size();
+    }
+    return f;
+}
+
+QString Bundle::entryName(Bundle::FileType type, HardwarePlatform hardwarePlatform) const
 {
     // Those two will always be in the top level dir. HardwarePlatform is irrelevant.
     switch (type) {
     case FileTypeAppInfo:
-        return m_path + "/appInfo.js";
+        return "appInfo.js";
     case FileTypeJsApp:
-        return m_path + "/pebble-js-app.js";
+        return "pebble-js-app.js";
     default:
         ;
     }
@@ -58,8 +94,8 @@ QString Bundle::file(Bundle::FileType type, HardwarePlatform hardwarePlatform) c
     QString subDir;
     foreach (const QString &dir, possibleDirs) {
         if (QFileInfo::exists(m_path + "/" + dir + "/manifest.json")) {
-            subDir = "/" + dir;
-            manifestFilename = m_path + subDir + "/manifest.json";
+            subDir = dir.isEmpty() ? QString() : dir + "/";
+            manifestFilename = m_path + "/" + subDir + "manifest.json";
             break;
         }
     }
@@ -70,7 +106,7 @@ QString Bundle::file(Bundle::FileType type, HardwarePlatform hardwarePlatform) c
 
     // We want the manifiest file. just return it without parsing it
     if (type == FileTypeManifest) {
-        return manifestFilename;
+        return subDir + "manifest.json";
     }
 
     QFile manifest(manifestFilename);
@@ -88,20 +124,20 @@ QString Bundle::file(Bundle::FileType type, HardwarePlatform hardwarePlatform) c
     QVariantMap manifestMap = jsonDoc.toVariant().toMap();
     switch (type) {
     case FileTypeApplication:
-        return m_path + subDir + "/" + manifestMap.value("application").toMap().value("name").toString();
+        return subDir + manifestMap.value("application").toMap().value("name").toString();
     case FileTypeResources:
         if (manifestMap.contains("resources")) {
-            return m_path + subDir + "/" + manifestMap.value("resources").toMap().value("name").toString();
+            return subDir + manifestMap.value("resources").toMap().value("name").toString();
         }
         break;
     case FileTypeWorker:
         if (manifestMap.contains("worker")) {
-            return m_path + subDir + "/" + manifestMap.value("worker").toMap().value("name").toString();
+            return subDir + manifestMap.value("worker").toMap().value("name").toString();
         }
         break;
     case FileTypeFirmware:
         if (manifestMap.contains("firmware")) {
-            return m_path + subDir + "/" + manifestMap.value("firmware").toMap().value("name").toString();
+            return subDir + manifestMap.value("firmware").toMap().value("name").toString();
         }
         break;
     default:
@@ -149,3 +185,26 @@ quint32 Bundle::crc(Bundle::FileType type, HardwarePlatform hardwarePlatform) co
     }
     return 0;
 }
+
+bool Bundle::verify(Bundle::FileType type, HardwarePlatform hardwarePlatform) const
+{
+    const QString entry = entryName(type, hardwarePlatform);
+    const quint32 expected = crc(type, hardwarePlatform);
+    quint32 actual = 0;
+    bool ok = false;
+    if (m_archive.isEmpty()) {
+        ok = !entry.isEmpty() && Stm32Crc::computeFile(m_path + "/" + entry, &actual);
+    } else {
+        QScopedPointer<QIODevice> device(open(type, hardwarePlatform));
+        ok = device && Stm32Crc::compute(device.data(), &actual);
+    }
+    if (!ok) {
+        qWarning() << "Cannot read" << entry << "to verify it";
+        return false;
+    }
+    if (actual != expected) {
+        qWarning() << entry << "has crc" << actual << "but the manifest says" << expected;
+        return false;
+    }
+    return true;
+}
@@ -3,6 +3,8 @@
 
 #include <QString>
 
+class QIODevice;
+
 #include "enums.h"
 
 class Bundle
@@ -21,12 +23,21 @@ public:
     Bundle(const QString &path = QString());
 
     QString path() const;
+    // Files are then read from the archive rather than from path, which only needs the manifest
+    void setArchive(const QString &archiveFilename);
 
     QString file(FileType type, HardwarePlatform hardwarePlatform = HardwarePlatformUnknown) const;
+    // Relative to the bundle's root, which is also its name in the archive
+    QString entryName(FileType type, HardwarePlatform hardwarePlatform = HardwarePlatformUnknown) const;
+    // Opened for reading, the caller owns it. Null if the bundle has no such file.
+    QIODevice *open(FileType type, HardwarePlatform hardwarePlatform = HardwarePlatformUnknown, qint64 *size = nullptr) const;
     quint32 crc(FileType type, HardwarePlatform hardwarePlatform = HardwarePlatformUnknown) const;
+    // Whether the file's content matches the crc in the manifest
+    bool verify(FileType type, HardwarePlatform hardwarePlatform = HardwarePlatformUnknown) const;
 
 private:
     QString m_path;
+    QString m_archive;
 
 };
 
@@ -4,6 +4,7 @@
 #include "watchconnection.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
+#include "tracing.h"
 
 #include <QUuid>
 #include <QDateTime>
@@ -15,32 +16,23 @@ DataLoggingEndpoint::DataLoggingEndpoint(Pebble *pebble, WatchConnection *connec
     m_pebble(pebble),
     m_connection(connection)
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointDataLogging, this, "handleMessage");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointDataLogging, this, &DataLoggingEndpoint::handleMessage);
     connect(m_connection, &WatchConnection::watchConnected, this, &DataLoggingEndpoint::requestSessionList);
 }
 
 void DataLoggingEndpoint::handleMessage(const QByteArray &data)
 {
-    qDebug() << "data logged" << data.toHex();
+    TRACE_SPAN1("datalogging", "handleMessage", "bytes", data.length());
     WatchDataReader reader(data);
     DataLoggingCommand command = (DataLoggingCommand)reader.read<quint8>();
     switch (command) {
     case DataLoggingDespoolOpenSession: {
         quint8 sessionId = reader.read<quint8>();
-        QUuid appUuid = reader.readUuid();
-        QDateTime timestamp = reader.readTimestamp();
-        quint32 logtag = reader.readLE<quint32>();
-        DataLoggingItemType item_type = (DataLoggingItemType)reader.read<quint8>();
-        quint16 item_size = reader.readLE<quint16>();
-        qDebug() << "Opening datalogging session:" << sessionId << "App:" << appUuid << "Timestamp:" << timestamp
-                 << "Logtag:" << logtag << "Item Type:" << item_type << "Item Size:" << item_size;
-
         DataLoggingSession session;
-        session.appUuid = appUuid;
-        session.timestamp = timestamp;
-        session.logtag = logtag;
-        session.itemType = item_type;
-        session.itemSize = item_size;
+        DataLoggingSession::Schema::read(reader, &session);
+        qDebug() << "Opening datalogging session:" << sessionId << "App:" << session.appUuid << "Timestamp:" << session.timestamp
+                 << "Logtag:" << session.logtag << "Item Type:" << session.itemType << "Item Size:" << session.itemSize;
+
         m_sessions.insert(sessionId, session);
         sendACK(sessionId);
         return;
@@ -49,19 +41,20 @@ void DataLoggingEndpoint::handleMessage(const QByteArray &data)
         quint8 sessionId = reader.read<quint8>();
         quint32 itemsLeft = reader.readLE<quint32>();
         quint32 crc = reader.readLE<quint32>();
-        qDebug() << "Despooling data: Session:" << sessionId << "Items left:" << itemsLeft << "CRC:" << crc;
+        TRACE_EVENT1("datalogging", "despool", "itemsLeft", itemsLeft);
+        Q_UNUSED(itemsLeft);
+        Q_UNUSED(crc);
 
         if (m_sessions.contains(sessionId)) {
             DataLoggingSession session = m_sessions[sessionId];
-            qDebug() << "found matching session entry:" << sessionId << "App:" << session.appUuid << "Logtag:" << session.logtag;
             int itemCount = 0;
             while (!reader.checkBad(session.itemSize)) {
+                // Leaves the handler through a signal, so this one has to be a copy
                 QByteArray item = reader.readBytes(session.itemSize);
-                qDebug() << "read item:" << item.toHex();
                 m_pebble->dataLoggingMessageReceived(session.appUuid.toString(), session.logtag, item);
                 itemCount++;
             }
-            qDebug() << "done reading" << itemCount << "items";
+            qDebug() << "Despooled" << itemCount << "items of session" << sessionId << "App:" << session.appUuid << "Logtag:" << session.logtag;
             sendACK(sessionId);
         } else {
             qDebug() << "no matching session found for id:" << sessionId << "requesting session list";
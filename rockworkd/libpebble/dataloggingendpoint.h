@@ -7,6 +7,8 @@
 #include <QUuid>
 #include <QDateTime>
 
+#include "watchpacketschema.h"
+
 class Pebble;
 class WatchConnection;
 
@@ -43,12 +45,21 @@ private slots:
     void requestSessionList();
 
 private:
+    // As sent with DataLoggingDespoolOpenSession, after the session id
     struct DataLoggingSession {
         QUuid appUuid;
         QDateTime timestamp;
-        quint32 logtag;
-        DataLoggingItemType itemType;
-        quint16 itemSize;
+        quint32 logtag = 0;
+        DataLoggingItemType itemType = ByteArray;
+        quint16 itemSize = 0;
+
+        typedef PacketSchema::Layout<DataLoggingSession,
+            PACKET_FIELD(DataLoggingSession, appUuid, PacketSchema::Uuid),
+            PACKET_FIELD(DataLoggingSession, timestamp, PacketSchema::Timestamp<PacketSchema::LittleEndian<quint32>>),
+            PACKET_FIELD(DataLoggingSession, logtag, PacketSchema::LittleEndian<quint32>),
+            PACKET_FIELD(DataLoggingSession, itemType, PacketSchema::BigEndian<quint8>),
+            PACKET_FIELD(DataLoggingSession, itemSize, PacketSchema::LittleEndian<quint16>)
+        > Schema;
     };
 
     Pebble *m_pebble;
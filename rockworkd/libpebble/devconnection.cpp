@@ -39,8 +39,6 @@ DevConnection::DevConnection(Pebble *pebble, WatchConnection *connection):
 {
     QObject::connect(connection, &WatchConnection::watchConnected, this, &DevConnection::onWatchConnected);
     QObject::connect(connection, &WatchConnection::watchDisconnected, this, &DevConnection::onWatchDisconnected);
-    QObject::connect(connection, &WatchConnection::rawIncomingMsg, this, &DevConnection::onRawIncomingMsg);
-    QObject::connect(connection, &WatchConnection::rawOutgoingMsg, this, &DevConnection::onRawOutgoingMsg);
     QObject::connect(this, &DevConnection::insertPin, m_pebble, &Pebble::insertPin);
     QObject::connect(this, &DevConnection::removePin, m_pebble, &Pebble::removePin);
     DevConnection::s_instance=this;
@@ -141,6 +139,7 @@ void DevConnection::disableConnection()
             sock->deleteLater();
         }
         m_clients.clear();
+        unsubscribeRawMsgs();
     }
 }
 void DevConnection::enableConnection(quint16 port)
@@ -180,6 +179,8 @@ void DevConnection::installBundle(QString file)
 void DevConnection::socketConnected()
 {
     QWebSocket *sock = m_qtwsServer->nextPendingConnection();
+    if (m_clients.isEmpty())
+        subscribeRawMsgs();
     m_clients.append(sock);
     qDebug() << "Accepted new connection from" << sock->peerAddress().toString();
     QObject::connect(sock,&QWebSocket::textMessageReceived,this,&DevConnection::textDataReceived);
@@ -190,6 +191,8 @@ void DevConnection::socketDisconnected()
 {
      QWebSocket *sock = qobject_cast<QWebSocket *>(sender());
      m_clients.removeAll(sock);
+     if (m_clients.isEmpty())
+         unsubscribeRawMsgs();
      sock->deleteLater();
      qDebug() << "Client disconnected:" << sock->peerAddress().toString();
 }
@@ -215,6 +218,17 @@ void DevConnection::rawDataReceived(QByteArray data)
          qWarning() << "DevPacket not understood:" << data;
      }
 }
+// Raw traffic is only copied out of WatchConnection while someone is listening
+void DevConnection::subscribeRawMsgs()
+{
+    m_rawIncomingConnection = QObject::connect(m_connection, &WatchConnection::rawIncomingMsg, this, &DevConnection::onRawIncomingMsg);
+    m_rawOutgoingConnection = QObject::connect(m_connection, &WatchConnection::rawOutgoingMsg, this, &DevConnection::onRawOutgoingMsg);
+}
+void DevConnection::unsubscribeRawMsgs()
+{
+    QObject::disconnect(m_rawIncomingConnection);
+    QObject::disconnect(m_rawOutgoingConnection);
+}
 void DevConnection::broadcast(const QByteArray &msg)
 {
     if(m_clients.length()>0) {
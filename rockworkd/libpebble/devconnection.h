@@ -50,9 +50,13 @@ private slots:
     void rawDataReceived(QByteArray data);
     void broadcast(const QByteArray &msg);
 private:
+    void subscribeRawMsgs();
+    void unsubscribeRawMsgs();
     QList<QWebSocket *> m_clients;
     Pebble *m_pebble;
     WatchConnection *m_connection;
+    QMetaObject::Connection m_rawIncomingConnection;
+    QMetaObject::Connection m_rawOutgoingConnection;
     QWebSocketServer *m_qtwsServer;
     quint16 m_port = 0;
     // kinda singleton
@@ -20,7 +20,8 @@ FirmwareDownloader::FirmwareDownloader(Pebble *pebble, WatchConnection *connecti
 {
     m_nam = new QNetworkAccessManager(this);
 
-    m_connection->registerEndpointHandler(WatchConnection::EndpointSystemMessage, this, "systemMessageReceived");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointSystemMessage, this, &FirmwareDownloader::systemMessageReceived);
+    connect(m_connection, &WatchConnection::watchConnected, this, &FirmwareDownloader::watchConnected);
 }
 
 bool FirmwareDownloader::updateAvailable() const
@@ -61,6 +62,7 @@ void FirmwareDownloader::performUpgrade()
     }
 
     m_upgradeInProgress = true;
+    m_bundlePath.clear();
     emit upgradingChanged();
 
     QNetworkRequest request(m_url);
@@ -104,7 +106,8 @@ void FirmwareDownloader::performUpgrade()
         f.write(data);
         f.close();
 
-        if (!ZipHelper::unpackArchive(f.fileName(), path)) {
+        // The binaries are uploaded straight from the archive, only what is read by name is extracted
+        if (!ZipHelper::unpackArchive(f.fileName(), path, QStringList() << "manifest.json" << "layouts.json.auto")) {
             qWarning() << "Error unpacking firmware archive";
             m_upgradeInProgress = false;
             emit upgradingChanged();
@@ -112,12 +115,20 @@ void FirmwareDownloader::performUpgrade()
         }
 
         Bundle firmware(path);
+        firmware.setArchive(f.fileName());
         if (firmware.file(Bundle::FileTypeFirmware).isEmpty() || firmware.file(Bundle::FileTypeResources).isEmpty()) {
             qWarning() << "Firmware bundle file missing binary or resources";
             m_upgradeInProgress = false;
             emit upgradingChanged();
             return;
         }
+        // Cheaper to find a corrupt bundle here than after the watch spent minutes receiving it
+        if (!firmware.verify(Bundle::FileTypeFirmware) || !firmware.verify(Bundle::FileTypeResources)) {
+            qWarning() << "Firmware bundle doesn't match its manifest";
+            m_upgradeInProgress = false;
+            emit upgradingChanged();
+            return;
+        }
 
         if(QFile::exists(path + "/layouts.json.auto")) {
             if(QFile::exists(m_pebble->storagePath() + "/layouts.json.auto"))
@@ -128,6 +139,7 @@ void FirmwareDownloader::performUpgrade()
 
         qDebug() << "** Starting firmware upgrade **";
         m_bundlePath = path;
+        m_archivePath = f.fileName();
         m_connection->systemMessage(WatchConnection::SystemMessageFirmwareStart);
 
     });
@@ -226,22 +238,36 @@ void FirmwareDownloader::systemMessageReceived(const QByteArray &data)
     if (!m_upgradeInProgress) {
         return;
     }
+    if (m_uploading) {
+        // Back in update mode after a reconnect, the upload that was cut off starts over
+        m_connection->uploadManager()->resume();
+        return;
+    }
 
     Bundle firmware(m_bundlePath);
+    firmware.setArchive(m_archivePath);
+    m_uploading = true;
 
+    // A file that can't be opened is uploaded as empty, which fails through the error callback
     qDebug() << "** Uploading firmware resources...";
-    m_connection->uploadManager()->uploadFirmwareResources(firmware.file(Bundle::FileTypeResources), firmware.crc(Bundle::FileTypeResources), [this, firmware]() {
+    qint64 resourcesSize = 0;
+    QIODevice *resources = firmware.open(Bundle::FileTypeResources, HardwarePlatformUnknown, &resourcesSize);
+    m_connection->uploadManager()->uploadFirmwareResources(firmware.entryName(Bundle::FileTypeResources), resources, resourcesSize, firmware.crc(Bundle::FileTypeResources), [this, firmware]() {
         qDebug() << "** Firmware resources uploaded. OK";
 
         qDebug() << "** Uploading firmware binary...";
-        m_connection->uploadManager()->uploadFirmwareBinary(false, firmware.file(Bundle::FileTypeFirmware), firmware.crc(Bundle::FileTypeFirmware), [this]() {
+        qint64 binarySize = 0;
+        QIODevice *binary = firmware.open(Bundle::FileTypeFirmware, HardwarePlatformUnknown, &binarySize);
+        m_connection->uploadManager()->uploadFirmwareBinary(false, firmware.entryName(Bundle::FileTypeFirmware), binary, binarySize, firmware.crc(Bundle::FileTypeFirmware), [this]() {
             qDebug() << "** Firmware binary uploaded. OK";
             m_connection->systemMessage(WatchConnection::SystemMessageFirmwareComplete);
+            m_uploading = false;
             m_upgradeInProgress = false;
             emit upgradingChanged();
         }, [this](int code) {
             qWarning() << "** ERROR uploading firmware binary" << code;
             m_connection->systemMessage(WatchConnection::SystemMessageFirmwareFail);
+            m_uploading = false;
             m_upgradeInProgress = false;
             emit upgradingChanged();
         });
@@ -249,8 +275,16 @@ void FirmwareDownloader::systemMessageReceived(const QByteArray &data)
     [this](int code) {
         qWarning() << "** ERROR uploading firmware resources" << code;
         m_connection->systemMessage(WatchConnection::SystemMessageFirmwareFail);
+        m_uploading = false;
         m_upgradeInProgress = false;
         emit upgradingChanged();
     });
 }
 
+void FirmwareDownloader::watchConnected()
+{
+    if (m_upgradeInProgress && !m_bundlePath.isEmpty()) {
+        qDebug() << "** Reconnected during firmware upgrade, restarting update mode";
+        m_connection->systemMessage(WatchConnection::SystemMessageFirmwareStart);
+    }
+}
@@ -32,6 +32,7 @@ signals:
 
 private slots:
     void systemMessageReceived(const QByteArray &data);
+    void watchConnected();
 
 private:
     QNetworkAccessManager *m_nam;
@@ -45,7 +46,10 @@ private:
     QByteArray m_hash;
 
     bool m_upgradeInProgress = false;
+    // The bundle's uploads are queued, possibly suspended by a lost link
+    bool m_uploading = false;
     QString m_bundlePath;
+    QString m_archivePath;
 };
 
 #endif // FIRWAREDOWNLOADER_H
@@ -77,10 +77,8 @@ void HealthParams::setGender(HealthParams::Gender gender)
     m_gender = gender;
 }
 
-QByteArray HealthParams::serialize() const
+void HealthParams::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray ret;
-    WatchDataWriter writer(&ret);
     writer.writeLE<quint16>(m_height * 10);
     writer.writeLE<quint16>(m_weight * 100);
     writer.write<quint8>(m_enabled ? 0x01 : 0x00);
@@ -88,6 +86,5 @@ QByteArray HealthParams::serialize() const
     writer.write<quint8>(m_sleepMore ? 0x01 : 0x00);
     writer.write<quint8>(m_age);
     writer.write<quint8>(m_gender);
-    return ret;
 }
 
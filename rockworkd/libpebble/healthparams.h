@@ -36,7 +36,8 @@ public:
     Gender gender() const;
     void setGender(Gender gender);
 
-    QByteArray serialize() const;
+    int serializedSize() const override { return 9; }
+    void writeTo(WatchDataWriter &writer) const override;
 
 private:
     bool m_enabled = false;
@@ -4,6 +4,7 @@
 
 #include "jskitmanager.h"
 #include "jskitpebble.h"
+#include "../tracing.h"
 
 JSKitManager::JSKitManager(Pebble *pebble, WatchConnection *connection, AppManager *apps, AppMsgManager *appmsg, QObject *parent) :
     QObject(parent),
@@ -186,6 +187,7 @@ bool JSKitManager::loadJsFile(const QString &filename)
 
     qCDebug(l) << "evaluating js file" << file.fileName();
 
+    TRACE_SPAN("js", "evaluate");
     QJSValue result = m_engine->evaluate(QString::fromUtf8(file.readAll()), file.fileName());
     if (result.isError()) {
         qCWarning(l) << "error while evaluating JS script:" << describeError(result);
@@ -6,6 +6,7 @@
 #include "jskitpebble.h"
 #include "jskitxmlhttprequest.h"
 #include "jskitwebsocket.h"
+#include "../tracing.h"
 static const char *token_salt = "0feeb7416d3c4546a19b04bccd8419b1";
 
 JSKitPebble::JSKitPebble(const AppInfo &info, JSKitManager *mgr, QObject *parent) :
@@ -357,6 +358,7 @@ QJSValue JSKitPebble::buildAckEventObject(uint transaction, const QString &messa
 void JSKitPebble::invokeCallbacks(const QString &type, const QJSValueList &args)
 {
     if (!m_listeners.contains(type)) return;
+    TRACE_SPAN("js", "invokeCallbacks");
     QList<QJSValue> &callbacks = m_listeners[type];
 
     for (QList<QJSValue>::iterator it = callbacks.begin(); it != callbacks.end(); ++it) {
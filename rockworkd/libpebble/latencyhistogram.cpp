@@ -0,0 +1,91 @@
+#include "latencyhistogram.h"
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram()
+{
+    std::fill(m_buckets, m_buckets + BucketCount, 0);
+    m_samples.reserve(WindowSize);
+}
+
+void LatencyHistogram::addSample(qint64 usecs)
+{
+    if (m_samples.count() < WindowSize) {
+        m_samples.append(usecs);
+    } else {
+        m_buckets[bucketFor(m_samples.at(m_next))]--;
+        m_samples[m_next] = usecs;
+    }
+    m_next = (m_next + 1) % WindowSize;
+    m_buckets[bucketFor(usecs)]++;
+
+    if (m_srtt < 0) {
+        m_srtt = usecs;
+        m_rttvar = usecs / 2;
+    } else {
+        m_rttvar = (3 * m_rttvar + qAbs(m_srtt - usecs)) / 4;
+        m_srtt = (7 * m_srtt + usecs) / 8;
+    }
+}
+
+int LatencyHistogram::count() const
+{
+    return m_samples.count();
+}
+
+int LatencyHistogram::minimum() const
+{
+    if (m_samples.isEmpty()) {
+        return -1;
+    }
+    return *std::min_element(m_samples.constBegin(), m_samples.constEnd()) / 1000;
+}
+
+int LatencyHistogram::maximum() const
+{
+    if (m_samples.isEmpty()) {
+        return -1;
+    }
+    return *std::max_element(m_samples.constBegin(), m_samples.constEnd()) / 1000;
+}
+
+int LatencyHistogram::percentile(int p) const
+{
+    if (m_samples.isEmpty()) {
+        return -1;
+    }
+    // At most WindowSize entries, sorting a copy is cheap enough
+    QVector<qint64> sorted = m_samples;
+    std::sort(sorted.begin(), sorted.end());
+    const int index = qBound(0, (qBound(0, p, 100) * sorted.count() + 99) / 100 - 1, sorted.count() - 1);
+    return sorted.at(index) / 1000;
+}
+
+int LatencyHistogram::smoothed() const
+{
+    return m_srtt < 0 ? -1 : m_srtt / 1000;
+}
+
+int LatencyHistogram::variation() const
+{
+    return m_srtt < 0 ? -1 : m_rttvar / 1000;
+}
+
+int LatencyHistogram::bucket(int index) const
+{
+    return m_buckets[index];
+}
+
+int LatencyHistogram::bucketLimit(int index)
+{
+    return index >= BucketCount - 1 ? -1 : 1 << index;
+}
+
+int LatencyHistogram::bucketFor(qint64 usecs)
+{
+    int index = 0;
+    for (qint64 msecs = usecs / 1000; msecs > 0 && index < BucketCount - 1; msecs >>= 1) {
+        index++;
+    }
+    return index;
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QVector>
+
+// Latencies of the last WindowSize events. Buckets are powers of two in milliseconds, bucket 0 holds
+// everything below 1 ms and the last one everything from bucketLimit(BucketCount - 2) (about 4 minutes) up.
+class LatencyHistogram
+{
+public:
+    enum {
+        WindowSize = 64,
+        BucketCount = 20
+    };
+
+    LatencyHistogram();
+
+    void addSample(qint64 usecs);
+
+    int count() const;
+    // All in milliseconds, -1 while there are no samples
+    int minimum() const;
+    int maximum() const;
+    int percentile(int p) const;
+    // Smoothed value and its variation, as RFC 6298 does for round trip times
+    int smoothed() const;
+    int variation() const;
+
+    int bucket(int index) const;
+    // Exclusive upper bound of a bucket in milliseconds, -1 for the last one
+    static int bucketLimit(int index);
+
+private:
+    static int bucketFor(qint64 usecs);
+
+    QVector<qint64> m_samples;
+    int m_next = 0;
+    int m_buckets[BucketCount];
+    qint64 m_srtt = -1;
+    qint64 m_rttvar = 0;
+};
+
+#endif // LATENCYHISTOGRAM_H
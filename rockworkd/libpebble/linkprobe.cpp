@@ -0,0 +1,163 @@
+#include "linkprobe.h"
+#include "watchconnection.h"
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+#include "watchpacketschema.h"
+
+#include <QDebug>
+#include <QTimer>
+
+static const int FIRST_PROBE_DELAY = 5000;
+static const int PROBE_INTERVAL = 60000;
+static const int PROBE_TIMEOUT = 10000;
+// Rounds a probe may be put off for traffic before it goes out anyway
+static const int MAX_SKIPPED = 3;
+
+namespace {
+struct PingPong {
+    enum Command {
+        CommandPing = 0,
+        CommandPong = 1
+    };
+
+    quint8 command = CommandPing;
+    quint32 cookie = 0;
+    quint8 idle = 0;
+
+    typedef PacketSchema::Layout<PingPong,
+        PACKET_FIELD(PingPong, command, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(PingPong, cookie, PacketSchema::BigEndian<quint32>)
+    > Header;
+    typedef PacketSchema::Layout<PingPong,
+        PACKET_FIELD(PingPong, command, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(PingPong, cookie, PacketSchema::BigEndian<quint32>),
+        PACKET_FIELD(PingPong, idle, PacketSchema::BigEndian<quint8>)
+    > Ping;
+};
+}
+
+LinkProbe::LinkProbe(WatchConnection *connection, QObject *parent):
+    QObject(parent),
+    m_connection(connection),
+    m_interval(new QTimer(this)),
+    m_firstProbe(new QTimer(this)),
+    m_deadline(new QTimer(this))
+{
+    m_connection->registerEndpointHandler(WatchConnection::EndpointWatchPing, this, &LinkProbe::handlePingMessage);
+    connect(m_connection, &WatchConnection::watchConnected, this, &LinkProbe::watchConnected);
+    connect(m_connection, &WatchConnection::watchDisconnected, this, &LinkProbe::watchDisconnected);
+
+    m_interval->setInterval(PROBE_INTERVAL);
+    connect(m_interval, &QTimer::timeout, this, &LinkProbe::periodicProbe);
+
+    m_firstProbe->setSingleShot(true);
+    m_firstProbe->setInterval(FIRST_PROBE_DELAY);
+    connect(m_firstProbe, &QTimer::timeout, this, &LinkProbe::periodicProbe);
+
+    m_deadline->setSingleShot(true);
+    m_deadline->setInterval(PROBE_TIMEOUT);
+    connect(m_deadline, &QTimer::timeout, this, &LinkProbe::probeTimedOut);
+}
+
+const LatencyHistogram &LinkProbe::histogram() const
+{
+    return m_histogram;
+}
+
+int LinkProbe::lost() const
+{
+    return m_lost;
+}
+
+int LinkProbe::retransmitTimeout() const
+{
+    if (m_histogram.count() == 0) {
+        return -1;
+    }
+    return m_histogram.smoothed() + 4 * m_histogram.variation();
+}
+
+int LinkProbe::timeout(int baseMsecs) const
+{
+    const int rto = retransmitTimeout();
+    if (rto < 0) {
+        return baseMsecs;
+    }
+    return qMin(baseMsecs + rto, 4 * baseMsecs);
+}
+
+void LinkProbe::probe()
+{
+    if (!m_connection->isConnected() || m_outstanding) {
+        return;
+    }
+
+    PingPong ping;
+    ping.cookie = qrand();
+    QByteArray msg(PingPong::Ping::FixedSize, Qt::Uninitialized);
+    WatchDataWriter writer(&msg, 0);
+    PingPong::Ping::write(writer, ping);
+
+    m_cookie = ping.cookie;
+    m_outstanding = true;
+    m_skipped = 0;
+    m_sent.start();
+    m_deadline->start();
+    m_connection->writeToPebble(WatchConnection::EndpointWatchPing, msg);
+}
+
+void LinkProbe::watchConnected()
+{
+    m_interval->start();
+    // Restarted, so quick reconnects don't stack up first probes
+    m_firstProbe->start();
+}
+
+void LinkProbe::watchDisconnected()
+{
+    m_interval->stop();
+    m_firstProbe->stop();
+    m_deadline->stop();
+    m_outstanding = false;
+}
+
+void LinkProbe::periodicProbe()
+{
+    bool busy = m_connection->bytesInFlight() > 0;
+    for (int i = 0; i < WatchConnection::PriorityCount && !busy; i++) {
+        busy = m_connection->queueDepth(WatchConnection::Priority(i)) > 0;
+    }
+    if (busy && m_skipped < MAX_SKIPPED) {
+        m_skipped++;
+        return;
+    }
+    probe();
+}
+
+void LinkProbe::probeTimedOut()
+{
+    qWarning() << "Link probe" << m_cookie << "went unanswered";
+    m_outstanding = false;
+    m_lost++;
+}
+
+void LinkProbe::handlePingMessage(const QByteArray &data)
+{
+    WatchDataReader reader(data);
+    PingPong pong;
+    if (!PingPong::Header::read(reader, &pong) || pong.command != PingPong::CommandPong) {
+        qWarning() << "Unexpected ping message" << data.toHex();
+        return;
+    }
+    if (!m_outstanding || pong.cookie != m_cookie) {
+        qDebug() << "Ignoring stale pong" << pong.cookie;
+        return;
+    }
+
+    const qint64 usecs = m_sent.nsecsElapsed() / 1000;
+    m_outstanding = false;
+    m_deadline->stop();
+    m_histogram.addSample(usecs);
+    qDebug() << "Link round trip" << usecs / 1000 << "ms, smoothed" << m_histogram.smoothed() << "ms";
+    emit rttMeasured(usecs / 1000);
+}
@@ -0,0 +1,57 @@
+#ifndef LINKPROBE_H
+#define LINKPROBE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+
+#include "latencyhistogram.h"
+
+class QTimer;
+class WatchConnection;
+
+// Measures the link with the watch through the ping endpoint. Probes once shortly after connecting
+// and then every ProbeInterval, skipping a round while the link is busy as that would measure our
+// own queues rather than the link.
+class LinkProbe : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LinkProbe(WatchConnection *connection, QObject *parent = 0);
+
+    const LatencyHistogram &histogram() const;
+    // Probes that went unanswered
+    int lost() const;
+
+    // RFC 6298 retransmission timeout in milliseconds, -1 until the first probe came back
+    int retransmitTimeout() const;
+    // A timeout that was picked for a fast link, stretched by the measured one. Never more than 4 * baseMsecs.
+    int timeout(int baseMsecs) const;
+
+public slots:
+    void probe();
+
+signals:
+    void rttMeasured(int msecs);
+
+private slots:
+    void watchConnected();
+    void watchDisconnected();
+    void periodicProbe();
+    void probeTimedOut();
+
+private:
+    void handlePingMessage(const QByteArray &data);
+
+    WatchConnection *m_connection;
+    QTimer *m_interval;
+    QTimer *m_firstProbe;
+    QTimer *m_deadline;
+    QElapsedTimer m_sent;
+    quint32 m_cookie = 0;
+    bool m_outstanding = false;
+    int m_skipped = 0;
+    int m_lost = 0;
+    LatencyHistogram m_histogram;
+};
+
+#endif // LINKPROBE_H
@@ -0,0 +1,174 @@
+#include "metricsregistry.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QTimer>
+
+MetricHistogram::MetricHistogram()
+{
+    for (int i = 0; i < BucketCount; i++) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+qint64 MetricHistogram::percentile(int p) const
+{
+    const qint64 total = count();
+    if (total == 0) {
+        return -1;
+    }
+    const qint64 rank = qMax<qint64>(1, (qBound(0, p, 100) * total + 99) / 100);
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount - 1; i++) {
+        seen += bucket(i);
+        if (seen >= rank) {
+            return bucketLimit(i);
+        }
+    }
+    return maximum();
+}
+
+MetricsRegistry::MetricsRegistry(QObject *parent):
+    QObject(parent),
+    m_dumpTimer(new QTimer(this))
+{
+    connect(m_dumpTimer, &QTimer::timeout, this, &MetricsRegistry::dump);
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    qDeleteAll(m_counters);
+    qDeleteAll(m_gauges);
+    qDeleteAll(m_histograms);
+}
+
+MetricCounter *MetricsRegistry::counter(const QString &name)
+{
+    QMutexLocker locker(&m_mutex);
+    MetricCounter *&metric = m_counters[name];
+    if (!metric) {
+        metric = new MetricCounter;
+    }
+    return metric;
+}
+
+MetricGauge *MetricsRegistry::gauge(const QString &name)
+{
+    QMutexLocker locker(&m_mutex);
+    MetricGauge *&metric = m_gauges[name];
+    if (!metric) {
+        metric = new MetricGauge;
+    }
+    return metric;
+}
+
+MetricHistogram *MetricsRegistry::histogram(const QString &name)
+{
+    QMutexLocker locker(&m_mutex);
+    MetricHistogram *&metric = m_histograms[name];
+    if (!metric) {
+        metric = new MetricHistogram;
+    }
+    return metric;
+}
+
+void MetricsRegistry::sampledGauge(const QString &name, QObject *context, const std::function<qint64()> &sample)
+{
+    QMutexLocker locker(&m_mutex);
+    SampledGauge gauge;
+    gauge.context = context;
+    gauge.sample = sample;
+    m_sampledGauges.insert(name, gauge);
+    connect(context, &QObject::destroyed, this, [this, name, context]() {
+        QMutexLocker locker(&m_mutex);
+        if (m_sampledGauges.value(name).context == context) {
+            m_sampledGauges.remove(name);
+        }
+    });
+}
+
+QVariantMap MetricsRegistry::snapshot() const
+{
+    QMutexLocker locker(&m_mutex);
+    QVariantMap map;
+    for (QMap<QString, MetricCounter*>::const_iterator it = m_counters.constBegin(); it != m_counters.constEnd(); ++it) {
+        map.insert(it.key(), it.value()->value());
+    }
+    for (QMap<QString, MetricGauge*>::const_iterator it = m_gauges.constBegin(); it != m_gauges.constEnd(); ++it) {
+        map.insert(it.key(), it.value()->value());
+    }
+    for (QMap<QString, SampledGauge>::const_iterator it = m_sampledGauges.constBegin(); it != m_sampledGauges.constEnd(); ++it) {
+        map.insert(it.key(), it.value().sample());
+    }
+    for (QMap<QString, MetricHistogram*>::const_iterator it = m_histograms.constBegin(); it != m_histograms.constEnd(); ++it) {
+        const MetricHistogram *histogram = it.value();
+        QVariantMap h;
+        h.insert("count", histogram->count());
+        h.insert("sum", histogram->sum());
+        h.insert("max", histogram->maximum());
+        h.insert("p50", histogram->percentile(50));
+        h.insert("p90", histogram->percentile(90));
+        h.insert("p99", histogram->percentile(99));
+        // Trailing empty buckets are left out
+        int used = MetricHistogram::BucketCount;
+        while (used > 0 && histogram->bucket(used - 1) == 0) {
+            used--;
+        }
+        QVariantList buckets;
+        for (int i = 0; i < used; i++) {
+            buckets << histogram->bucket(i);
+        }
+        h.insert("buckets", buckets);
+        map.insert(it.key(), h);
+    }
+    return map;
+}
+
+bool MetricsRegistry::startDump(const QString &fileName, int intervalSecs)
+{
+    if (intervalSecs <= 0) {
+        qWarning() << "Invalid metrics dump interval" << intervalSecs;
+        return false;
+    }
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Append)) {
+        qWarning() << "Cannot open metrics dump file" << fileName << file.errorString();
+        return false;
+    }
+    qDebug() << "Dumping metrics to" << fileName << "every" << intervalSecs << "s";
+    m_dumpFile = fileName;
+    m_dumpTimer->start(intervalSecs * 1000);
+    return true;
+}
+
+void MetricsRegistry::stopDump()
+{
+    if (m_dumpTimer->isActive()) {
+        dump();
+        m_dumpTimer->stop();
+    }
+    m_dumpFile.clear();
+}
+
+bool MetricsRegistry::isDumping() const
+{
+    return m_dumpTimer->isActive();
+}
+
+void MetricsRegistry::dump()
+{
+    QVariantMap record;
+    record.insert("time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    record.insert("metrics", snapshot());
+
+    QFile file(m_dumpFile);
+    if (!file.open(QFile::WriteOnly | QFile::Append)) {
+        qWarning() << "Cannot write metrics dump" << m_dumpFile << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument::fromVariant(record).toJson(QJsonDocument::Compact));
+    file.write("\n");
+}
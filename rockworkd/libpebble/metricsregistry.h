@@ -0,0 +1,130 @@
+#ifndef METRICSREGISTRY_H
+#define METRICSREGISTRY_H
+
+#include <atomic>
+#include <functional>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+class QTimer;
+
+// Monotonic event count
+class MetricCounter
+{
+public:
+    void add(qint64 n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value{0};
+};
+
+// Current level of something, e.g. a queue depth
+class MetricGauge
+{
+public:
+    void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(qint64 n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value{0};
+};
+
+// Distribution of values in power of two buckets: bucket 0 counts values below 1, bucket i
+// values in [2^(i-1), 2^i). Unit is up to the caller, latencies are recorded in microseconds.
+class MetricHistogram
+{
+public:
+    enum { BucketCount = 40 };
+
+    MetricHistogram();
+
+    void record(qint64 value)
+    {
+        m_buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        qint64 max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    qint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    qint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    qint64 maximum() const { return m_max.load(std::memory_order_relaxed); }
+    qint64 bucket(int index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+    // Upper bound of the bucket the p-th percentile falls in, -1 without samples
+    qint64 percentile(int p) const;
+
+    static qint64 bucketLimit(int index) { return index == BucketCount - 1 ? -1 : Q_INT64_C(1) << index; }
+
+private:
+    static int bucketFor(qint64 value)
+    {
+        int index = 0;
+        while (value > 0 && index < BucketCount - 1) {
+            value >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+    std::atomic<qint64> m_buckets[BucketCount];
+    std::atomic<qint64> m_count{0};
+    std::atomic<qint64> m_sum{0};
+    std::atomic<qint64> m_max{0};
+};
+
+/*
+ * Named counters, gauges and histograms of one watch connection.
+ *
+ * Look a metric up once, when setting up, and keep the pointer: it stays valid for the lifetime of the
+ * registry and recording through it is a relaxed atomic add, safe from any thread. Only registration
+ * and snapshots take the lock.
+ */
+class MetricsRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsRegistry(QObject *parent = 0);
+    ~MetricsRegistry();
+
+    // Returns the existing metric if the name is taken by one of the same kind
+    MetricCounter *counter(const QString &name);
+    MetricGauge *gauge(const QString &name);
+    MetricHistogram *histogram(const QString &name);
+    // A gauge read by calling sample() whenever a snapshot is taken. Dropped along with context.
+    void sampledGauge(const QString &name, QObject *context, const std::function<qint64()> &sample);
+
+    // Name -> value for counters and gauges, name -> map of count, sum, max, percentiles and buckets for histograms
+    QVariantMap snapshot() const;
+
+    // Writes snapshots as JSON lines to fileName every intervalSecs seconds until stopDump()
+    bool startDump(const QString &fileName, int intervalSecs);
+    void stopDump();
+    bool isDumping() const;
+
+private slots:
+    void dump();
+
+private:
+    struct SampledGauge {
+        QObject *context;
+        std::function<qint64()> sample;
+    };
+
+    mutable QMutex m_mutex;
+    QMap<QString, MetricCounter*> m_counters;
+    QMap<QString, MetricGauge*> m_gauges;
+    QMap<QString, MetricHistogram*> m_histograms;
+    QMap<QString, SampledGauge> m_sampledGauges;
+
+    QTimer *m_dumpTimer;
+    QString m_dumpFile;
+};
+
+#endif // METRICSREGISTRY_H
@@ -12,7 +12,7 @@ MusicEndpoint::MusicEndpoint(Pebble *pebble, WatchConnection *connection):
     m_pebble(pebble),
     m_watchConnection(connection)
 {
-    m_watchConnection->registerEndpointHandler(WatchConnection::EndpointMusicControl, this, "handleMessage");
+    m_watchConnection->registerEndpointHandler(WatchConnection::EndpointMusicControl, this, &MusicEndpoint::handleMessage);
 }
 
 void MusicEndpoint::setMusicMetadata(const MusicMetaData &metaData)
@@ -46,10 +46,19 @@ void MusicEndpoint::writeMetadata()
 }
 
 void MusicEndpoint::writePlayState(const MusicPlayState &playState) {
+    // Position ticks can wait for the link to wake up, anything the user changed can't
+    const bool positionOnly = playState.state == m_lastPlayState.state && playState.playRate == m_lastPlayState.playRate
+            && playState.shuffle == m_lastPlayState.shuffle && playState.repeat == m_lastPlayState.repeat;
+    sendPlayState(playState, positionOnly);
+}
+
+void MusicEndpoint::sendPlayState(const MusicPlayState &playState, bool deferrable)
+{
     qDebug() << "Writing playstate. Position: " << playState.trackPosition;
     if (!m_watchConnection->isConnected()) {
         return;
     }
+    m_lastPlayState = playState;
     QByteArray res;
     WatchDataWriter writer(&res);
     res.append(MusicControlUpdatePlayStateInfo); // MusicControlUpdatePlayStateInfo
@@ -59,7 +68,12 @@ void MusicEndpoint::writePlayState(const MusicPlayState &playState) {
     res.append(playState.shuffle);
     res.append(playState.repeat);
 
-    m_watchConnection->writeToPebble(WatchConnection::EndpointMusicControl, res);
+    if (deferrable) {
+        // Only the latest position is worth sending
+        m_watchConnection->deferToPebble(WatchConnection::EndpointMusicControl, res, MusicControlUpdatePlayStateInfo);
+    } else {
+        m_watchConnection->writeToPebble(WatchConnection::EndpointMusicControl, res);
+    }
 }
 
 void MusicEndpoint::handleMessage(const QByteArray &data)
@@ -90,7 +104,7 @@ void MusicEndpoint::handleMessage(const QByteArray &data)
         break;
     case MusicControlGetCurrentTrack: // MusicControlGetCurrentTrack
         writeMetadata();
-        writePlayState(getMusicPlayState());
+        sendPlayState(getMusicPlayState(), false);
         return;
     default:
         qWarning() << "Unhandled music control button pressed:" << data.toHex();
@@ -27,6 +27,7 @@ signals:
 
 private:
     void writeMetadata();
+    void sendPlayState(const MusicPlayState &playState, bool deferrable);
     MusicPlayState getMusicPlayState();
 
 private:
@@ -34,6 +35,7 @@ private:
     WatchConnection *m_watchConnection;
 
     MusicMetaData m_metaData;
+    MusicPlayState m_lastPlayState;
 };
 
 #endif // MUSICENDPOINT_H
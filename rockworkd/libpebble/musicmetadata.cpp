@@ -13,7 +13,11 @@ MusicMetaData::MusicMetaData(const QString &artist, const QString &album, const
 
 }
 
-MusicPlayState::MusicPlayState()
+MusicPlayState::MusicPlayState():
+    state(StateUnknown),
+    trackPosition(0),
+    shuffle(ShuffleUnknown),
+    repeat(RepeatUnknown)
 {
 
 }
@@ -27,15 +27,21 @@ public:
         m_subject(subject)
     {}
 
-    QByteArray serialize() const override
+    int serializedSize() const override
     {
-        QByteArray ret;
-        ret.append((quint8)m_source);
-        ret.append(packString(m_sender));
-        ret.append(packString(m_body));
-        ret.append(packString(QString::number(m_timestamp.toMSecsSinceEpoch())));
-        ret.append(packString(m_subject));
-        return ret;
+        return 1 + WatchDataWriter::packedStringSize(m_sender)
+                + WatchDataWriter::packedStringSize(m_body)
+                + WatchDataWriter::packedStringSize(QString::number(m_timestamp.toMSecsSinceEpoch()))
+                + WatchDataWriter::packedStringSize(m_subject);
+    }
+
+    void writeTo(WatchDataWriter &writer) const override
+    {
+        writer.write<quint8>(m_source);
+        writer.writePackedString(m_sender);
+        writer.writePackedString(m_body);
+        writer.writePackedString(QString::number(m_timestamp.toMSecsSinceEpoch()));
+        writer.writePackedString(m_subject);
     }
 
 private:
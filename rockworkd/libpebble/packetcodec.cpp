@@ -0,0 +1,189 @@
+#include "packetcodec.h"
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+#include "watchpacketschema.h"
+#include "appmsgmanager.h"
+#include "blobdb.h"
+
+QByteArray PacketCodec::buildData(const QStringList &data)
+{
+    int size = 0;
+    for (const QString &d : data) {
+        size += WatchDataWriter::packedStringSize(d);
+    }
+    QByteArray res(size, Qt::Uninitialized);
+    WatchDataWriter writer(&res, 0);
+    for (const QString &d : data) {
+        writer.writePackedString(d);
+    }
+    return res;
+}
+
+QByteArray PacketCodec::buildMessageData(uint lead, const QStringList &data)
+{
+    int size = 1;
+    for (const QString &d : data) {
+        size += WatchDataWriter::packedStringSize(d);
+    }
+    QByteArray res(size, Qt::Uninitialized);
+    WatchDataWriter writer(&res, 0);
+    writer.write<quint8>(lead & 0xFF);
+    for (const QString &d : data) {
+        writer.writePackedString(d);
+    }
+    return res;
+}
+
+bool PacketCodec::unpackAppLaunchMessage(const QByteArray &msg, QUuid *uuid)
+{
+    WatchDataReader reader(msg);
+    quint8 action = reader.read<quint8>();
+    Q_UNUSED(action);
+
+    *uuid = reader.readUuid();
+
+    if (reader.bad()) {
+        return false;
+    }
+
+    return true;
+}
+
+bool PacketCodec::unpackPushMessage(const QByteArray &msg, quint8 *transaction, QUuid *uuid, WatchDictView *dict)
+{
+    WatchDataReader reader(msg);
+    quint8 code = reader.read<quint8>();
+    Q_UNUSED(code);
+    Q_ASSERT(code == AppMsgManager::AppMessagePush);
+
+    *transaction = reader.read<quint8>();
+    *uuid = reader.readUuid();
+    *dict = reader.readDictView();
+
+    if (reader.bad()) {
+        return false;
+    }
+
+    return true;
+}
+
+QByteArray PacketCodec::buildPushMessage(quint8 transaction, const QUuid &uuid, const WatchConnection::Dict &dict)
+{
+    QByteArray ba(1 + 1 + 16 + WatchDataWriter::dictSize(dict), Qt::Uninitialized);
+    WatchDataWriter writer(&ba, 0);
+    writer.write<quint8>(AppMsgManager::AppMessagePush);
+    writer.write<quint8>(transaction);
+    writer.writeUuid(uuid);
+    writer.writeDict(dict);
+
+    return ba;
+}
+
+QByteArray PacketCodec::buildLaunchMessage(quint8 messageType, const QUuid &uuid)
+{
+    QByteArray ba;
+    WatchDataWriter writer(&ba);
+    writer.write<quint8>(messageType);
+    if (!uuid.isNull()) {
+        writer.writeUuid(uuid);
+    }
+
+    return ba;
+}
+
+QByteArray PacketCodec::buildAckMessage(quint8 transaction)
+{
+    QByteArray ba(2, Qt::Uninitialized);
+    ba[0] = AppMsgManager::AppMessageAck;
+    ba[1] = transaction;
+    return ba;
+}
+
+QByteArray PacketCodec::buildNackMessage(quint8 transaction)
+{
+    QByteArray ba(2, Qt::Uninitialized);
+    ba[0] = AppMsgManager::AppMessageNack;
+    ba[1] = transaction;
+    return ba;
+}
+
+namespace {
+// The fields of a BlobDB command as they go on the wire
+struct BlobCommandFields {
+    quint8 command = 0;
+    quint16 token = 0;
+    quint8 database = 0;
+    QByteArray key;
+    QByteArray value;
+    const PebblePacket *valuePacket = nullptr;
+
+    typedef PacketSchema::Layout<BlobCommandFields,
+        PACKET_FIELD(BlobCommandFields, command, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(BlobCommandFields, token, PacketSchema::LittleEndian<quint16>),
+        PACKET_FIELD(BlobCommandFields, database, PacketSchema::BigEndian<quint8>)
+    > Header;
+    typedef PacketSchema::Layout<BlobCommandFields,
+        PACKET_FIELD(BlobCommandFields, key, PacketSchema::Bytes<PacketSchema::BigEndian<quint8>>)
+    > Key;
+    typedef PacketSchema::Layout<BlobCommandFields,
+        PACKET_FIELD(BlobCommandFields, value, PacketSchema::Bytes<PacketSchema::LittleEndian<quint16>>)
+    > Value;
+    typedef PacketSchema::Layout<BlobCommandFields,
+        PACKET_FIELD(BlobCommandFields, valuePacket, PacketSchema::Packet<PacketSchema::LittleEndian<quint16>>)
+    > ValuePacket;
+};
+}
+
+QByteArray PacketCodec::buildBlobCommand(quint8 command, quint16 token, quint8 database, const QByteArray &key,
+                                         const QByteArray &value, const PebblePacket *valuePacket)
+{
+    BlobCommandFields fields;
+    fields.command = command;
+    fields.token = token;
+    fields.database = database;
+    fields.key = key;
+    fields.value = value;
+    fields.valuePacket = valuePacket;
+
+    const bool hasKey = command == BlobDB::OperationInsert || command == BlobDB::OperationDelete;
+    const bool hasValue = command == BlobDB::OperationInsert;
+    int size = BlobCommandFields::Header::FixedSize;
+    if (hasKey) {
+        size += BlobCommandFields::Key::size(fields);
+    }
+    if (hasValue) {
+        size += valuePacket ? BlobCommandFields::ValuePacket::size(fields) : BlobCommandFields::Value::size(fields);
+    }
+
+    QByteArray ret(size, Qt::Uninitialized);
+    WatchDataWriter writer(&ret, 0);
+    BlobCommandFields::Header::write(writer, fields);
+    if (hasKey) {
+        BlobCommandFields::Key::write(writer, fields);
+    }
+    if (hasValue) {
+        if (valuePacket) {
+            BlobCommandFields::ValuePacket::write(writer, fields);
+        } else {
+            BlobCommandFields::Value::write(writer, fields);
+        }
+    }
+    return ret;
+}
+
+bool PacketCodec::readBlobCommand(const QByteArray &encoded, quint8 *command, quint16 *token, quint8 *database, QByteArray *key)
+{
+    BlobCommandFields fields;
+    WatchDataReader reader(encoded);
+    if (!BlobCommandFields::Header::read(reader, &fields)) {
+        return false;
+    }
+    if (fields.command != BlobDB::OperationClear && !BlobCommandFields::Key::read(reader, &fields)) {
+        return false;
+    }
+    *command = fields.command;
+    *token = fields.token;
+    *database = fields.database;
+    *key = fields.key;
+    return true;
+}
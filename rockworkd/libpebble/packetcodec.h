@@ -0,0 +1,39 @@
+#ifndef PACKETCODEC_H
+#define PACKETCODEC_H
+
+#include "watchconnection.h"
+
+#include <QByteArray>
+#include <QStringList>
+#include <QUuid>
+
+class WatchDictView;
+
+/*
+ * Encoders and decoders of payloads that don't need a live connection. The endpoint classes call
+ * them, and they link on their own, so bench/codecbench can time them without the rest of the daemon.
+ */
+namespace PacketCodec
+{
+    // Strings with a length byte in front of each, as the phone call and music endpoints send them
+    QByteArray buildData(const QStringList &data);
+    // The same behind a lead byte
+    QByteArray buildMessageData(uint lead, const QStringList &data);
+
+    // AppMessage and launcher payloads, codes from AppMsgManager::AppMessage
+    bool unpackAppLaunchMessage(const QByteArray &msg, QUuid *uuid);
+    bool unpackPushMessage(const QByteArray &msg, quint8 *transaction, QUuid *uuid, WatchDictView *dict);
+    QByteArray buildPushMessage(quint8 transaction, const QUuid &uuid, const WatchConnection::Dict &dict);
+    QByteArray buildLaunchMessage(quint8 messageType, const QUuid &uuid);
+    QByteArray buildAckMessage(quint8 transaction);
+    QByteArray buildNackMessage(quint8 transaction);
+
+    // A BlobDB command: its header, then the key for inserts and deletes and the value for inserts.
+    // The value is encoded from valuePacket if given, so it doesn't need an intermediate copy.
+    QByteArray buildBlobCommand(quint8 command, quint16 token, quint8 database, const QByteArray &key,
+                                const QByteArray &value = QByteArray(), const PebblePacket *valuePacket = nullptr);
+    // Reads the header and key back from an encoded command
+    bool readBlobCommand(const QByteArray &encoded, quint8 *command, quint16 *token, quint8 *database, QByteArray *key);
+}
+
+#endif // PACKETCODEC_H
@@ -1,5 +1,6 @@
 #include "pebble.h"
 #include "watchconnection.h"
+#include "uploadmanager.h"
 #include "notificationendpoint.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
@@ -13,6 +14,11 @@
 #include "screenshotendpoint.h"
 #include "firmwaredownloader.h"
 #include "watchlogendpoint.h"
+#include "watchcapture.h"
+#include "watchcapturereplay.h"
+#include "linkprobe.h"
+#include "metricsregistry.h"
+#include "tracing.h"
 #include "core.h"
 #include "platforminterface.h"
 #include "ziphelper.h"
@@ -43,9 +49,9 @@ Pebble::Pebble(const QBluetoothAddress &address, QObject *parent):
     QObject::connect(m_connection, &WatchConnection::watchDisconnected, this, &Pebble::onPebbleDisconnected);
     QObject::connect(Core::instance()->platform(), &PlatformInterface::timeChanged, this, &Pebble::syncTime);
 
-    m_connection->registerEndpointHandler(WatchConnection::EndpointVersion, this, "pebbleVersionReceived");
-    m_connection->registerEndpointHandler(WatchConnection::EndpointPhoneVersion, this, "phoneVersionAsked");
-    m_connection->registerEndpointHandler(WatchConnection::EndpointFactorySettings, this, "factorySettingsReceived");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointVersion, this, &Pebble::pebbleVersionReceived);
+    m_connection->registerEndpointHandler(WatchConnection::EndpointPhoneVersion, this, &Pebble::phoneVersionAsked);
+    m_connection->registerEndpointHandler(WatchConnection::EndpointFactorySettings, this, &Pebble::factorySettingsReceived);
 
     m_dataLogEndpoint = new DataLoggingEndpoint(this, m_connection);
 
@@ -98,6 +104,13 @@ Pebble::Pebble(const QBluetoothAddress &address, QObject *parent):
     m_logEndpoint = new WatchLogEndpoint(this, m_connection);
     QObject::connect(m_logEndpoint, &WatchLogEndpoint::logsFetched, this, &Pebble::logsDumped);
 
+    m_captureWriter = new WatchCaptureWriter(m_connection, this);
+    m_captureReplay = new WatchCaptureReplay(m_connection, this);
+    QObject::connect(m_captureReplay, &WatchCaptureReplay::finished, [this]() {
+        const WatchCaptureReplay::Stats &stats = m_captureReplay->stats();
+        emit captureReplayFinished(stats.frames, stats.handlerTime, stats.wallTime);
+    });
+
     QSettings watchInfo(m_storagePath + "/watchinfo.conf", QSettings::IniFormat);
     m_model = (Model)watchInfo.value("watchModel", (int)ModelUnknown).toInt();
 
@@ -120,6 +133,15 @@ Pebble::Pebble(const QBluetoothAddress &address, QObject *parent):
     m_calendarSyncEnabled = settings.value("calendarSyncEnabled", true).toBool();
     settings.endGroup();
 
+    settings.beginGroup("connection");
+    if (settings.contains("deferWindow")) {
+        m_connection->setDeferWindow(settings.value("deferWindow").toInt());
+    }
+    if (settings.contains("blobDBWindow")) {
+        m_blobDB->setWindow(settings.value("blobDBWindow").toInt());
+    }
+    settings.endGroup();
+
     settings.beginGroup("profileWhen");
     m_profileWhenConnected = settings.value("connected", "").toString();
     m_profileWhenDisconnected = settings.value("disconnected", "").toString();
@@ -163,6 +185,22 @@ QBluetoothLocalDevice::Pairing Pebble::pairingStatus() const
     return dev.pairingStatus(m_address);
 }
 
+QString Pebble::transport() const
+{
+    return m_transport;
+}
+
+void Pebble::setTransport(const QString &transport)
+{
+    WatchTransport *watchTransport = WatchTransport::create(transport, m_address);
+    if (!watchTransport) {
+        qWarning() << "Keeping transport" << m_transport << "for" << m_address.toString();
+        return;
+    }
+    m_transport = transport;
+    m_connection->setTransport(watchTransport);
+}
+
 bool Pebble::connected() const
 {
     return m_connection->isConnected() && !m_serialNumber.isEmpty();
@@ -170,7 +208,7 @@ bool Pebble::connected() const
 
 void Pebble::connect()
 {
-    qDebug() << "Connecting to Pebble:" << m_name << m_address.toString();
+    qDebug() << "Connecting to Pebble:" << m_name << m_address.toString() << "via" << m_transport;
     m_connection->connectPebble(m_address);
 }
 
@@ -343,11 +381,129 @@ bool Pebble::imperialUnits() const
     return m_imperialUnits;
 }
 
+void Pebble::setDeferWindow(int msecs)
+{
+    m_connection->setDeferWindow(msecs);
+
+    QSettings settings(m_storagePath + "/appsettings.conf", QSettings::IniFormat);
+    settings.beginGroup("connection");
+    settings.setValue("deferWindow", m_connection->deferWindow());
+    settings.endGroup();
+}
+
+int Pebble::deferWindow() const
+{
+    return m_connection->deferWindow();
+}
+
+void Pebble::setBlobDBWindow(int commands)
+{
+    m_blobDB->setWindow(commands);
+
+    QSettings settings(m_storagePath + "/appsettings.conf", QSettings::IniFormat);
+    settings.beginGroup("connection");
+    settings.setValue("blobDBWindow", m_blobDB->window());
+    settings.endGroup();
+}
+
+int Pebble::blobDBWindow() const
+{
+    return m_blobDB->window();
+}
+
 void Pebble::dumpLogs(const QString &fileName) const
 {
     m_logEndpoint->fetchLogs(fileName);
 }
 
+bool Pebble::startCapture(const QString &fileName)
+{
+    return m_captureWriter->start(fileName);
+}
+
+void Pebble::stopCapture()
+{
+    m_captureWriter->stop();
+}
+
+bool Pebble::replayCapture(const QString &fileName, bool realTime)
+{
+    return m_captureReplay->start(fileName, realTime ? WatchCaptureReplay::SpeedOriginal : WatchCaptureReplay::SpeedAsFastAsPossible);
+}
+
+static QVariantMap histogramToMap(const LatencyHistogram &histogram)
+{
+    QVariantMap map;
+    map.insert("samples", histogram.count());
+    map.insert("min", histogram.minimum());
+    map.insert("max", histogram.maximum());
+    map.insert("p50", histogram.percentile(50));
+    map.insert("p90", histogram.percentile(90));
+    map.insert("p99", histogram.percentile(99));
+    map.insert("smoothed", histogram.smoothed());
+    map.insert("variation", histogram.variation());
+    QVariantList buckets;
+    QVariantList limits;
+    for (int i = 0; i < LatencyHistogram::BucketCount; i++) {
+        buckets << histogram.bucket(i);
+        limits << LatencyHistogram::bucketLimit(i);
+    }
+    map.insert("buckets", buckets);
+    map.insert("bucketLimits", limits);
+    return map;
+}
+
+QVariantMap Pebble::linkLatency() const
+{
+    const LinkProbe *probe = m_connection->linkProbe();
+    QVariantMap map = histogramToMap(probe->histogram());
+    map.insert("lost", probe->lost());
+    map.insert("retransmitTimeout", probe->retransmitTimeout());
+    return map;
+}
+
+void Pebble::probeLink()
+{
+    m_connection->linkProbe()->probe();
+}
+
+QVariantMap Pebble::connectionStats() const
+{
+    const WatchIoWorker::ReconnectStats stats = m_connection->reconnectStats();
+    QVariantMap map;
+    map.insert("timeToReconnect", histogramToMap(stats.timeToReconnect));
+    map.insert("timeToFirstPacket", histogramToMap(stats.timeToFirstPacket));
+    map.insert("attempts", stats.attempts);
+    map.insert("nearbyReconnects", stats.nearbyReconnects);
+    map.insert("backoffReconnects", stats.backoffReconnects);
+    return map;
+}
+
+QVariantMap Pebble::metrics() const
+{
+    return m_connection->metrics()->snapshot();
+}
+
+bool Pebble::startMetricsDump(const QString &fileName, int intervalSecs)
+{
+    return m_connection->metrics()->startDump(fileName, intervalSecs);
+}
+
+void Pebble::stopMetricsDump()
+{
+    m_connection->metrics()->stopDump();
+}
+
+bool Pebble::startTrace()
+{
+    return Trace::start();
+}
+
+bool Pebble::stopTrace(const QString &fileName)
+{
+    return Trace::stop(fileName);
+}
+
 QString Pebble::storagePath() const
 {
     return m_storagePath;
@@ -773,6 +929,7 @@ void Pebble::pebbleVersionReceived(const QByteArray &data)
     // only 8 bits are used atm anyways.
     m_capabilities = QFlag(wd.readLE<quint32>());
     qDebug() << "Capabilities" << QString::number(m_capabilities, 16);
+    m_connection->uploadManager()->setLargeChunks(m_capabilities.testFlag(Capability8kAppMessages));
     qDebug() << "Capabilities" << wd.readLE<quint32>();
     m_isUnfaithful = wd.read<quint8>();
     qDebug() << "Is Unfaithful" << m_isUnfaithful;
@@ -923,8 +1080,10 @@ void Pebble::syncApps()
 void Pebble::syncTime()
 {
     TimeMessage msg(TimeMessage::TimeOperationSetUTC);
-    qDebug() << "Syncing Time" << QDateTime::currentDateTime() << msg.serialize().toHex();
-    m_connection->writeToPebble(WatchConnection::EndpointTime, msg.serialize());
+    const QByteArray data = msg.serialize();
+    qDebug() << "Syncing Time" << QDateTime::currentDateTime() << data.toHex();
+    // Sent on connect and whenever the clock changes, a couple of seconds late don't matter
+    m_connection->deferToPebble(WatchConnection::EndpointTime, data, TimeMessage::TimeOperationSetUTC);
 }
 
 void Pebble::slotUpdateAvailableChanged()
@@ -955,10 +1114,25 @@ TimeMessage::TimeMessage(TimeMessage::TimeOperation operation) :
 {
 
 }
-QByteArray TimeMessage::serialize() const
+QString TimeMessage::timeZoneName()
+{
+    return QDateTime::currentDateTime().timeZone().displayName(QTimeZone::StandardTime);
+}
+
+int TimeMessage::serializedSize() const
+{
+    switch (m_operation) {
+    case TimeOperationSetLocaltime:
+        return 1 + 4;
+    case TimeOperationSetUTC:
+        return 1 + 4 + 2 + WatchDataWriter::pascalStringSize(timeZoneName());
+    default:
+        return 1;
+    }
+}
+
+void TimeMessage::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray ret;
-    WatchDataWriter writer(&ret);
     writer.write<quint8>(m_operation);
     switch (m_operation) {
     case TimeOperationSetLocaltime:
@@ -967,10 +1141,9 @@ QByteArray TimeMessage::serialize() const
     case TimeOperationSetUTC:
         writer.write<quint32>(QDateTime::currentDateTime().toMSecsSinceEpoch() / 1000);
         writer.write<qint16>(QDateTime::currentDateTime().offsetFromUtc() / 60);
-        writer.writePascalString(QDateTime::currentDateTime().timeZone().displayName(QTimeZone::StandardTime));
+        writer.writePascalString(timeZoneName());
         break;
     default:
         ;
     }
-    return ret;
 }
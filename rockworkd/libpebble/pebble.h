@@ -25,6 +25,8 @@ class AppDownloader;
 class ScreenshotEndpoint;
 class FirmwareDownloader;
 class WatchLogEndpoint;
+class WatchCaptureWriter;
+class WatchCaptureReplay;
 class DataLoggingEndpoint;
 class DevConnection;
 class TimelineManager;
@@ -52,6 +54,10 @@ public:
 
     QBluetoothLocalDevice::Pairing pairingStatus() const;
 
+    // See WatchTransport::create() for the format, defaults to RFCOMM
+    QString transport() const;
+    void setTransport(const QString &transport);
+
     bool connected() const;
     void connect();
     BlobDB *blobdb() const;
@@ -128,11 +134,33 @@ public slots:
     void setImperialUnits(bool imperial);
     bool imperialUnits() const;
 
+    // How long traffic that can wait is held back to be sent in one burst, in milliseconds
+    void setDeferWindow(int msecs);
+    int deferWindow() const;
+
+    // BlobDB commands sent ahead before waiting for the watch to answer
+    void setBlobDBWindow(int commands);
+    int blobDBWindow() const;
+
     void setProfileWhen(const bool connected, const QString &profile);
     QString profileWhen(bool connected) const;
 
     void dumpLogs(const QString &fileName) const;
 
+    bool startCapture(const QString &fileName);
+    void stopCapture();
+    bool replayCapture(const QString &fileName, bool realTime);
+
+    // Round trip times measured on the ping endpoint, in milliseconds
+    QVariantMap linkLatency() const;
+    void probeLink();
+    QVariantMap connectionStats() const;
+    QVariantMap metrics() const;
+    bool startMetricsDump(const QString &fileName, int intervalSecs);
+    void stopMetricsDump();
+    bool startTrace();
+    bool stopTrace(const QString &fileName);
+
 private slots:
     void onPebbleConnected();
     void onPebbleDisconnected();
@@ -163,6 +191,7 @@ signals:
     void updateAvailableChanged();
     void upgradingFirmwareChanged();
     void logsDumped(bool success);
+    void captureReplayFinished(quint64 frames, qint64 handlerNsecs, qint64 wallNsecs);
 
     void calendarSyncEnabledChanged();
     void imperialUnitsChanged();
@@ -176,6 +205,7 @@ private:
     void setHardwareRevision(HardwareRevision hardwareRevision);
 
     QBluetoothAddress m_address;
+    QString m_transport = "rfcomm";
     QString m_name;
     QDateTime m_softwareBuildTime;
     QString m_softwareVersion;
@@ -202,6 +232,8 @@ private:
     ScreenshotEndpoint *m_screenshotEndpoint;
     FirmwareDownloader *m_firmwareDownloader;
     WatchLogEndpoint *m_logEndpoint;
+    WatchCaptureWriter *m_captureWriter;
+    WatchCaptureReplay *m_captureReplay;
     DataLoggingEndpoint *m_dataLogEndpoint;
 
     QString m_storagePath;
@@ -254,9 +286,12 @@ public:
     };
     TimeMessage(TimeOperation operation);
 
-    QByteArray serialize() const override;
+    int serializedSize() const override;
+    void writeTo(WatchDataWriter &writer) const override;
 
 private:
+    static QString timeZoneName();
+
     TimeOperation m_operation = TimeOperationGetRequest;
 };
 
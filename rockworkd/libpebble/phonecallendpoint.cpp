@@ -9,7 +9,7 @@ PhoneCallEndpoint::PhoneCallEndpoint(Pebble *pebble, WatchConnection *connection
     m_pebble(pebble),
     m_connection(connection)
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointPhoneControl, this, "handlePhoneEvent");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointPhoneControl, this, &PhoneCallEndpoint::handlePhoneEvent);
 }
 
 void PhoneCallEndpoint::incomingCall(uint cookie, const QString &number, const QString &name)
@@ -0,0 +1,121 @@
+#include "rfcommtransport.h"
+#include "bluez/bluezdevicemonitor.h"
+
+#include <QDebug>
+
+// RSSI updates arrive about once a second during discovery, don't restart a connect attempt for each
+static const int NEARBY_THROTTLE = 2000;
+
+RfcommTransport::RfcommTransport(const QBluetoothAddress &address, QObject *parent):
+    WatchTransport(parent),
+    m_address(address)
+{
+    m_localDevice = new QBluetoothLocalDevice(this);
+    connect(m_localDevice, &QBluetoothLocalDevice::hostModeStateChanged, this, &RfcommTransport::hostModeStateChanged);
+
+    m_deviceMonitor = new BluezDeviceMonitor(m_address, this);
+    connect(m_deviceMonitor, &BluezDeviceMonitor::connectedChanged, this, &RfcommTransport::deviceConnectedChanged);
+    connect(m_deviceMonitor, &BluezDeviceMonitor::servicesResolvedChanged, this, &RfcommTransport::deviceServicesResolvedChanged);
+    connect(m_deviceMonitor, &BluezDeviceMonitor::rssiChanged, this, &RfcommTransport::deviceRssiChanged);
+}
+
+QString RfcommTransport::name() const
+{
+    return "rfcomm:" + m_address.toString();
+}
+
+WatchTransport::Availability RfcommTransport::availability() const
+{
+    if (m_localDevice->hostMode() == QBluetoothLocalDevice::HostPoweredOff) {
+        qDebug() << "Bluetooth powered off.";
+        return AvailabilityUnavailable;
+    }
+    if (m_localDevice->pairingStatus(m_address) == QBluetoothLocalDevice::Unpaired) {
+        qDebug() << "Pebble" << m_address.toString() << "is not paired.";
+        return AvailabilityNotYet;
+    }
+    return AvailabilityReady;
+}
+
+void RfcommTransport::connectToWatch()
+{
+    if (m_socket) {
+        // We might be called from within one of its signals
+        m_socket->disconnect(this);
+        m_socket->deleteLater();
+    }
+
+    m_socket = new QBluetoothSocket(QBluetoothServiceInfo::RfcommProtocol, this);
+    connect(m_socket, &QBluetoothSocket::connected, this, &WatchTransport::connected);
+    connect(m_socket, &QBluetoothSocket::disconnected, this, &WatchTransport::disconnected);
+    connect(m_socket, &QBluetoothSocket::readyRead, this, &WatchTransport::readyRead);
+    connect(m_socket, &QBluetoothSocket::bytesWritten, this, &WatchTransport::bytesWritten);
+    connect(m_socket, SIGNAL(error(QBluetoothSocket::SocketError)), this, SLOT(socketError(QBluetoothSocket::SocketError)));
+
+    // FIXME: Assuming port 1 (with Pebble)
+    m_socket->connectToService(m_address, 1);
+}
+
+void RfcommTransport::close()
+{
+    if (m_socket) {
+        m_socket->close();
+    }
+}
+
+bool RfcommTransport::isConnected() const
+{
+    return m_socket && m_socket->state() == QBluetoothSocket::ConnectedState;
+}
+
+QIODevice *RfcommTransport::device() const
+{
+    return m_socket;
+}
+
+void RfcommTransport::hostModeStateChanged(QBluetoothLocalDevice::HostMode state)
+{
+    qDebug() << "Bluetooth host changed state:" << state;
+    emit availabilityChanged();
+}
+
+void RfcommTransport::socketError(QBluetoothSocket::SocketError error)
+{
+    // We seem to get UnknownError anyways all the time
+    emit WatchTransport::error(m_socket->errorString() + " (" + QString::number(error) + ")");
+}
+
+void RfcommTransport::deviceConnectedChanged(bool connected)
+{
+    if (connected) {
+        deviceSeen();
+    } else if (isConnected()) {
+        // BlueZ noticed the baseband link is gone, the socket may take a lot longer to find out
+        qDebug() << "BlueZ reports" << m_address.toString() << "disconnected, closing socket";
+        m_socket->close();
+    }
+}
+
+void RfcommTransport::deviceServicesResolvedChanged(bool resolved)
+{
+    if (resolved) {
+        deviceSeen();
+    }
+}
+
+void RfcommTransport::deviceRssiChanged(qint16 rssi)
+{
+    // 0 means the device dropped out of discovery
+    if (rssi != 0) {
+        deviceSeen();
+    }
+}
+
+void RfcommTransport::deviceSeen()
+{
+    if (isConnected() || (m_lastNearby.isValid() && m_lastNearby.elapsed() < NEARBY_THROTTLE)) {
+        return;
+    }
+    m_lastNearby.start();
+    emit peerNearby();
+}
@@ -0,0 +1,44 @@
+#ifndef RFCOMMTRANSPORT_H
+#define RFCOMMTRANSPORT_H
+
+#include "watchtransport.h"
+
+#include <QBluetoothAddress>
+#include <QBluetoothLocalDevice>
+#include <QBluetoothSocket>
+#include <QElapsedTimer>
+
+class BluezDeviceMonitor;
+
+class RfcommTransport : public WatchTransport
+{
+    Q_OBJECT
+public:
+    explicit RfcommTransport(const QBluetoothAddress &address, QObject *parent = 0);
+
+    QString name() const override;
+    Availability availability() const override;
+
+    void connectToWatch() override;
+    void close() override;
+    bool isConnected() const override;
+    QIODevice *device() const override;
+
+private slots:
+    void hostModeStateChanged(QBluetoothLocalDevice::HostMode state);
+    void socketError(QBluetoothSocket::SocketError error);
+    void deviceConnectedChanged(bool connected);
+    void deviceServicesResolvedChanged(bool resolved);
+    void deviceRssiChanged(qint16 rssi);
+
+private:
+    void deviceSeen();
+
+    QBluetoothAddress m_address;
+    QBluetoothLocalDevice *m_localDevice;
+    QBluetoothSocket *m_socket = nullptr;
+    BluezDeviceMonitor *m_deviceMonitor;
+    QElapsedTimer m_lastNearby;
+};
+
+#endif // RFCOMMTRANSPORT_H
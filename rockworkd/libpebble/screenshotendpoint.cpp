@@ -2,6 +2,7 @@
 
 #include "watchdatawriter.h"
 #include "watchdatareader.h"
+#include "watchpacketschema.h"
 #include "pebble.h"
 
 #include <QImage>
@@ -13,7 +14,7 @@ ScreenshotEndpoint::ScreenshotEndpoint(Pebble *pebble, WatchConnection *connecti
     m_pebble(pebble),
     m_connection(connection)
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointScreenshot, this, "handleScreenshotData");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointScreenshot, this, &ScreenshotEndpoint::handleScreenshotData);
 }
 
 void ScreenshotEndpoint::requestScreenshot()
@@ -57,22 +58,44 @@ QStringList ScreenshotEndpoint::screenshots() const
     return ret;
 }
 
+namespace {
+// Precedes the first chunk of image data
+struct ScreenshotHeader {
+    quint8 responseCode = 0;
+    quint32 version = 0;
+    quint32 width = 0;
+    quint32 height = 0;
+
+    typedef PacketSchema::Layout<ScreenshotHeader,
+        PACKET_FIELD(ScreenshotHeader, responseCode, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(ScreenshotHeader, version, PacketSchema::BigEndian<quint32>),
+        PACKET_FIELD(ScreenshotHeader, width, PacketSchema::BigEndian<quint32>),
+        PACKET_FIELD(ScreenshotHeader, height, PacketSchema::BigEndian<quint32>)
+    > Schema;
+};
+}
+
 void ScreenshotEndpoint::handleScreenshotData(const QByteArray &data)
 {
     WatchDataReader reader(data);
     int offset = 0;
 
     if (m_waitingForMore == 0) {
-
-        ResponseCode responseCode = (ResponseCode)reader.read<quint8>();
-        if (responseCode != ResponseCodeOK) {
+        // Error replies carry nothing but the code, so it is checked before the rest of the header
+        WatchDataReader codeReader(data);
+        ResponseCode responseCode = (ResponseCode)codeReader.read<quint8>();
+        if (codeReader.bad() || responseCode != ResponseCodeOK) {
             qWarning() << "Error taking screenshot:" << responseCode;
             return;
         }
-        m_version = reader.read<quint32>();
-
-        m_width = reader.read<quint32>();
-        m_height = reader.read<quint32>();
+        ScreenshotHeader header;
+        if (!ScreenshotHeader::Schema::read(reader, &header)) {
+            qWarning() << "Screenshot header cut short:" << data.length() << "bytes";
+            return;
+        }
+        m_version = header.version;
+        m_width = header.width;
+        m_height = header.height;
 
         switch (m_version) {
         case 1:
@@ -86,11 +109,11 @@ void ScreenshotEndpoint::handleScreenshotData(const QByteArray &data)
             m_waitingForMore = m_width * m_height; // might work :)
         }
 
-        offset = 13;
+        offset = ScreenshotHeader::Schema::FixedSize;
         m_accumulatedData.clear();
     }
 
-    QByteArray tmp = reader.readBytes(data.length() - offset);
+    QByteArray tmp = reader.readView(data.length() - offset);
     m_waitingForMore -= tmp.length();
     m_accumulatedData.append(tmp);
 
@@ -137,11 +160,7 @@ void ScreenshotEndpoint::handleScreenshotData(const QByteArray &data)
 }
 
 
-QByteArray ScreenshotRequestPackage::serialize() const
+void ScreenshotRequestPackage::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray data;
-    WatchDataWriter writer(&data);
-
     writer.write<quint8>(m_command);
-    return data;
 }
@@ -9,7 +9,8 @@ class Pebble;
 class ScreenshotRequestPackage: public PebblePacket
 {
 public:
-    QByteArray serialize() const override;
+    int serializedSize() const override { return 1; }
+    void writeTo(WatchDataWriter &writer) const override;
 private:
     quint8 m_command = 0x00;
 };
@@ -0,0 +1,89 @@
+#include "socketpairtransport.h"
+
+#include <QDebug>
+#include <QMetaMethod>
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SocketPairTransport::SocketPairTransport(QObject *parent):
+    WatchTransport(parent)
+{
+}
+
+QString SocketPairTransport::name() const
+{
+    return "socketpair";
+}
+
+void SocketPairTransport::connectToWatch()
+{
+    closeSocket();
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        qWarning() << "Cannot create socketpair:" << strerror(errno);
+        emit error("socketpair() failed");
+        return;
+    }
+
+    // Once wrapped, closing the descriptor is up to the QLocalSocket
+    m_socket = new QLocalSocket(this);
+    if (!m_socket->setSocketDescriptor(fds[0])) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        qWarning() << "Cannot wrap socketpair:" << m_socket->errorString();
+        closeSocket();
+        emit error("Cannot wrap socketpair");
+        return;
+    }
+
+    connect(m_socket, &QLocalSocket::disconnected, this, &WatchTransport::disconnected);
+    connect(m_socket, &QLocalSocket::readyRead, this, &WatchTransport::readyRead);
+    connect(m_socket, &QLocalSocket::bytesWritten, this, &WatchTransport::bytesWritten);
+    connect(m_socket, SIGNAL(error(QLocalSocket::LocalSocketError)), this, SLOT(socketError(QLocalSocket::LocalSocketError)));
+
+    if (isSignalConnected(QMetaMethod::fromSignal(&SocketPairTransport::peerConnected))) {
+        emit peerConnected(fds[1]);
+    } else {
+        qWarning() << "Nobody is listening on the other end of the socketpair";
+        ::close(fds[1]);
+    }
+
+    // The pair is connected right away, report it from the event loop like a real socket would
+    QMetaObject::invokeMethod(this, "connected", Qt::QueuedConnection);
+}
+
+void SocketPairTransport::close()
+{
+    if (m_socket) {
+        m_socket->close();
+    }
+}
+
+bool SocketPairTransport::isConnected() const
+{
+    return m_socket && m_socket->state() == QLocalSocket::ConnectedState;
+}
+
+QIODevice *SocketPairTransport::device() const
+{
+    return m_socket;
+}
+
+void SocketPairTransport::socketError(QLocalSocket::LocalSocketError error)
+{
+    emit WatchTransport::error(m_socket->errorString() + " (" + QString::number(error) + ")");
+}
+
+void SocketPairTransport::closeSocket()
+{
+    if (m_socket) {
+        // We might be called from within one of its signals
+        m_socket->disconnect(this);
+        m_socket->deleteLater();
+        m_socket = nullptr;
+    }
+}
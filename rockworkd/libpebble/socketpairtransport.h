@@ -0,0 +1,38 @@
+#ifndef SOCKETPAIRTRANSPORT_H
+#define SOCKETPAIRTRANSPORT_H
+
+#include "watchtransport.h"
+
+#include <QLocalSocket>
+
+/*
+ * In-process transport over a socketpair(). The other end's descriptor is handed out through
+ * peerConnected(), whoever plays the watch (a simulator, a benchmark) takes ownership of it and
+ * reads and writes the framed stream there, on whatever thread it likes.
+ */
+class SocketPairTransport : public WatchTransport
+{
+    Q_OBJECT
+public:
+    explicit SocketPairTransport(QObject *parent = 0);
+
+    QString name() const override;
+
+    void connectToWatch() override;
+    void close() override;
+    bool isConnected() const override;
+    QIODevice *device() const override;
+
+signals:
+    void peerConnected(int descriptor);
+
+private slots:
+    void socketError(QLocalSocket::LocalSocketError error);
+
+private:
+    void closeSocket();
+
+    QLocalSocket *m_socket = nullptr;
+};
+
+#endif // SOCKETPAIRTRANSPORT_H
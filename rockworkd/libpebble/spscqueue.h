@@ -0,0 +1,86 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+/*
+ * Unbounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * Consumed nodes are handed back to the producer and reused, so once the queue has grown to
+ * its working size pushing doesn't allocate anymore. Only push() may be called from the
+ * producer and only pop() and isEmpty() from the consumer.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue() {
+        Node *node = new Node;
+        m_tail.store(node, std::memory_order_relaxed);
+        m_head = m_first = m_tailCopy = node;
+    }
+    ~SpscQueue() {
+        Node *node = m_first;
+        while (node) {
+            Node *next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    void push(T value) {
+        Node *node = allocNode();
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->value = std::move(value);
+        m_head->next.store(node, std::memory_order_release);
+        m_head = node;
+    }
+
+    bool pop(T *value) {
+        Node *tail = m_tail.load(std::memory_order_relaxed);
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        *value = std::move(next->value);
+        next->value = T();
+        // next becomes the new dummy, tail may now be reused by the producer
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return !m_tail.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value;
+    };
+
+    Node *allocNode() {
+        // Nodes from m_first up to (excluding) the consumer's tail have been consumed
+        if (m_first == m_tailCopy) {
+            m_tailCopy = m_tail.load(std::memory_order_acquire);
+        }
+        if (m_first != m_tailCopy) {
+            Node *node = m_first;
+            m_first = node->next.load(std::memory_order_relaxed);
+            return node;
+        }
+        return new Node;
+    }
+
+    // Consumer side
+    alignas(64) std::atomic<Node *> m_tail;
+    // Producer side
+    alignas(64) Node *m_head;
+    Node *m_first;
+    Node *m_tailCopy;
+};
+
+#endif // SPSCQUEUE_H
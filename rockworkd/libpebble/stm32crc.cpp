@@ -0,0 +1,153 @@
+#include "stm32crc.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+static const quint32 POLYNOMIAL = 0x04C11DB7;
+static const quint32 INITIAL = 0xFFFFFFFF;
+static const int READ_SIZE = 64 * 1024;
+
+namespace {
+// Slice-by-8: table[k][b] is the CRC register after feeding byte b followed by k zero bytes, so eight
+// bytes are folded in with eight lookups instead of 64 shifts.
+struct Tables {
+    quint32 table[8][256];
+
+    Tables() {
+        for (quint32 b = 0; b < 256; b++) {
+            quint32 crc = b << 24;
+            for (int i = 0; i < 8; i++) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ POLYNOMIAL : crc << 1;
+            }
+            table[0][b] = crc;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int b = 0; b < 256; b++) {
+                const quint32 prev = table[k - 1][b];
+                table[k][b] = (prev << 8) ^ table[0][prev >> 24];
+            }
+        }
+    }
+};
+
+const Tables &tables()
+{
+    static const Tables t;
+    return t;
+}
+
+// Feeding a word is feeding its bytes most significant first, the usual byte order for an unreflected
+// CRC. Words are little-endian in memory, so that is the in-memory order reversed.
+inline quint32 foldWord(const quint32 (&t)[8][256], quint32 crc, quint32 word, int slice)
+{
+    const quint32 x = crc ^ word;
+    return t[slice + 3][x >> 24] ^ t[slice + 2][(x >> 16) & 0xff] ^ t[slice + 1][(x >> 8) & 0xff] ^ t[slice][x & 0xff];
+}
+
+quint32 processWords(quint32 crc, const uchar *data, int words)
+{
+    const quint32 (&t)[8][256] = tables().table;
+    for (; words >= 2; words -= 2, data += 8) {
+        crc = foldWord(t, crc, qFromLittleEndian<quint32>(data), 4) ^ foldWord(t, 0, qFromLittleEndian<quint32>(data + 4), 0);
+    }
+    if (words) {
+        crc = foldWord(t, crc, qFromLittleEndian<quint32>(data), 0);
+    }
+    return crc;
+}
+}
+
+Stm32Crc::Stm32Crc():
+    m_crc(INITIAL)
+{
+}
+
+void Stm32Crc::reset()
+{
+    m_crc = INITIAL;
+    m_pendingLength = 0;
+    m_length = 0;
+}
+
+void Stm32Crc::update(const char *data, int length)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    m_length += length;
+
+    if (m_pendingLength) {
+        const int n = qMin(4 - m_pendingLength, length);
+        memcpy(m_pending + m_pendingLength, p, n);
+        m_pendingLength += n;
+        p += n;
+        length -= n;
+        if (m_pendingLength < 4) {
+            return;
+        }
+        m_crc = processWords(m_crc, m_pending, 1);
+        m_pendingLength = 0;
+    }
+
+    const int words = length / 4;
+    m_crc = processWords(m_crc, p, words);
+    m_pendingLength = length % 4;
+    memcpy(m_pending, p + words * 4, m_pendingLength);
+}
+
+quint32 Stm32Crc::value() const
+{
+    return m_pendingLength ? processTail(m_crc, m_pending, m_pendingLength) : m_crc;
+}
+
+quint32 Stm32Crc::processTail(quint32 crc, const uchar *tail, int length)
+{
+    quint32 word = 0;
+    for (int i = 0; i < length; i++) {
+        word = (word << 8) | tail[i];
+    }
+    uchar bytes[4];
+    qToLittleEndian<quint32>(word, bytes);
+    return processWords(crc, bytes, 1);
+}
+
+quint32 Stm32Crc::compute(const QByteArray &data)
+{
+    Stm32Crc crc;
+    crc.update(data);
+    return crc.value();
+}
+
+bool Stm32Crc::compute(QIODevice *device, quint32 *crc)
+{
+    Stm32Crc engine;
+    QByteArray buffer(READ_SIZE, Qt::Uninitialized);
+    forever {
+        const qint64 n = device->read(buffer.data(), buffer.size());
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        engine.update(buffer.constData(), n);
+    }
+    *crc = engine.value();
+    return true;
+}
+
+bool Stm32Crc::computeFile(const QString &fileName, quint32 *crc)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    if (file.size() > 0) {
+        if (const uchar *map = file.map(0, file.size())) {
+            Stm32Crc engine;
+            engine.update(reinterpret_cast<const char *>(map), file.size());
+            *crc = engine.value();
+            return true;
+        }
+    }
+    return compute(&file, crc);
+}
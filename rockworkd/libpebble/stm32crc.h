@@ -0,0 +1,41 @@
+#ifndef STM32CRC_H
+#define STM32CRC_H
+
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+
+// The CRC the watch checks uploads against, as the STM32 CRC unit computes it: CRC-32 with polynomial
+// 0x04C11DB7, no reflection, fed 32-bit little-endian words. A trailing partial word is read big-endian
+// and zero extended, which is what the firmware does with it.
+//
+// Data can be fed in pieces of any length, the result only depends on the concatenation.
+class Stm32Crc
+{
+public:
+    Stm32Crc();
+
+    void reset();
+    void update(const char *data, int length);
+    void update(const QByteArray &data) { update(data.constData(), data.length()); }
+
+    // The CRC of everything fed so far, feeding can go on afterwards
+    quint32 value() const;
+    qint64 length() const { return m_length; }
+
+    static quint32 compute(const QByteArray &data);
+    // Reads the device from its current position to the end. Returns false on a read error.
+    static bool compute(QIODevice *device, quint32 *crc);
+    static bool computeFile(const QString &fileName, quint32 *crc);
+
+private:
+    static quint32 processTail(quint32 crc, const uchar *tail, int length);
+
+    quint32 m_crc;
+    uchar m_pending[4];
+    int m_pendingLength = 0;
+    qint64 m_length = 0;
+};
+
+#endif // STM32CRC_H
@@ -0,0 +1,61 @@
+#include "tcptransport.h"
+
+#include <QDebug>
+
+TcpTransport::TcpTransport(const QString &host, quint16 port, QObject *parent):
+    WatchTransport(parent),
+    m_host(host),
+    m_port(port)
+{
+}
+
+QString TcpTransport::name() const
+{
+    return QString("tcp:%1:%2").arg(m_host).arg(m_port);
+}
+
+void TcpTransport::connectToWatch()
+{
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->deleteLater();
+    }
+
+    m_socket = new QTcpSocket(this);
+    connect(m_socket, &QTcpSocket::connected, this, &TcpTransport::socketConnected);
+    connect(m_socket, &QTcpSocket::disconnected, this, &WatchTransport::disconnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &WatchTransport::readyRead);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &WatchTransport::bytesWritten);
+    connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError(QAbstractSocket::SocketError)));
+
+    m_socket->connectToHost(m_host, m_port);
+}
+
+void TcpTransport::close()
+{
+    if (m_socket) {
+        m_socket->close();
+    }
+}
+
+bool TcpTransport::isConnected() const
+{
+    return m_socket && m_socket->state() == QAbstractSocket::ConnectedState;
+}
+
+QIODevice *TcpTransport::device() const
+{
+    return m_socket;
+}
+
+void TcpTransport::socketConnected()
+{
+    // Frames are written as header and payload, don't let Nagle hold back the payload
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    emit connected();
+}
+
+void TcpTransport::socketError(QAbstractSocket::SocketError error)
+{
+    emit WatchTransport::error(m_socket->errorString() + " (" + QString::number(error) + ")");
+}
@@ -0,0 +1,32 @@
+#ifndef TCPTRANSPORT_H
+#define TCPTRANSPORT_H
+
+#include "watchtransport.h"
+
+#include <QTcpSocket>
+
+// Plain framed stream over TCP, for the emulator and local stand-ins of a watch
+class TcpTransport : public WatchTransport
+{
+    Q_OBJECT
+public:
+    TcpTransport(const QString &host, quint16 port, QObject *parent = 0);
+
+    QString name() const override;
+
+    void connectToWatch() override;
+    void close() override;
+    bool isConnected() const override;
+    QIODevice *device() const override;
+
+private slots:
+    void socketConnected();
+    void socketError(QAbstractSocket::SocketError error);
+
+private:
+    QString m_host;
+    quint16 m_port;
+    QTcpSocket *m_socket = nullptr;
+};
+
+#endif // TCPTRANSPORT_H
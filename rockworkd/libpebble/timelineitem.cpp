@@ -56,36 +56,6 @@ QList<TimelineAction> TimelineItem::actions() const
     return m_actions;
 }
 
-QByteArray TimelineItem::serialize() const
-{
-    QByteArray ret;
-    ret.append(m_itemId.toRfc4122());
-    ret.append(m_parentId.toRfc4122());
-    int ts = m_timestamp.toMSecsSinceEpoch() / 1000;
-    ret.append(ts & 0xFF); ret.append((ts >> 8) & 0xFF); ret.append((ts >> 16) & 0xFF); ret.append((ts >> 24) & 0xFF);
-    ret.append(m_duration & 0xFF); ret.append(((m_duration >> 8) & 0xFF));
-    ret.append((quint8)m_type);
-    ret.append(m_flags & 0xFF); ret.append(((m_flags >> 8) & 0xFF));
-    ret.append(m_layout);
-
-    QByteArray serializedAttributes;
-    foreach (const TimelineAttribute &attribute, m_attributes) {
-        serializedAttributes.append(attribute.serialize());
-    }
-
-    QByteArray serializedActions;
-    foreach (const TimelineAction &action, m_actions) {
-        serializedActions.append(action.serialize());
-    }
-    quint16 dataLength = serializedAttributes.length() + serializedActions.length();
-    ret.append(dataLength & 0xFF); ret.append(((dataLength >> 8) & 0xFF));
-    ret.append(m_attributes.count());
-    ret.append(m_actions.count());
-    ret.append(serializedAttributes);
-    ret.append(serializedActions);
-    return ret;
-}
-
 TimelineAction::TimelineAction(quint8 actionId, TimelineAction::Type type, const QList<TimelineAttribute> &attributes):
     PebblePacket(),
     m_actionId(actionId),
@@ -157,12 +127,3 @@ void TimelineAttribute::setContent(quint8 data)
     m_content.append(data);
 }
 
-QByteArray TimelineAttribute::serialize() const
-{
-    QByteArray ret;
-    ret.append((quint8)m_type);
-    ret.append(m_content.length() & 0xFF); ret.append(((m_content.length() >> 8) & 0xFF)); // length
-    ret.append(m_content);
-    return ret;
-}
-
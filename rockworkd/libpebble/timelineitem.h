@@ -5,6 +5,7 @@
 #include <QDateTime>
 
 #include "watchconnection.h"
+#include "watchpacketschema.h"
 
 
 class TimelineAttribute
@@ -44,11 +45,17 @@ public:
     void setContent(le32 *data);
     void setContent(le16 *data);
 
-    QByteArray serialize() const;
+    int serializedSize() const { return Schema::size(*this); }
+    void writeTo(WatchDataWriter &writer) const { Schema::write(writer, *this); }
     quint8 type() { return m_type;}
 private:
     quint8 m_type;
     QByteArray m_content;
+
+    typedef PacketSchema::Layout<TimelineAttribute,
+        PACKET_FIELD(TimelineAttribute, m_type, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(TimelineAttribute, m_content, PacketSchema::Bytes<PacketSchema::LittleEndian<quint16>>)
+    > Schema;
 };
 
 class TimelineAction: public PebblePacket
@@ -69,21 +76,20 @@ public:
     TimelineAction(quint8 actionId, Type type, const QList<TimelineAttribute> &attributes = QList<TimelineAttribute>());
     void appendAttribute(const TimelineAttribute &attribute);
 
-    QByteArray serialize() const override {
-        QByteArray ret;
-        ret.append(m_actionId);
-        ret.append((quint8)m_type);
-        ret.append(m_attributes.count());
-        foreach (const TimelineAttribute &attr, m_attributes) {
-            ret.append(attr.serialize());
-        }
-        return ret;
-    }
+    int serializedSize() const override { return Schema::size(*this); }
+    void writeTo(WatchDataWriter &writer) const override { Schema::write(writer, *this); }
 
 private:
     quint8 m_actionId;
     Type m_type;
     QList<TimelineAttribute> m_attributes;
+
+    typedef PacketSchema::Layout<TimelineAction,
+        PACKET_FIELD(TimelineAction, m_actionId, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(TimelineAction, m_type, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(TimelineAction, m_attributes, PacketSchema::Count<PacketSchema::BigEndian<quint8>>),
+        PACKET_FIELD(TimelineAction, m_attributes, PacketSchema::Elements)
+    > Schema;
 };
 
 class TimelineItem: public PebblePacket
@@ -126,9 +132,12 @@ public:
     QList<TimelineAttribute> attributes() const;
     QList<TimelineAction> actions() const;
 
-    QByteArray serialize() const override;
+    int serializedSize() const override { return Schema::size(*this); }
+    void writeTo(WatchDataWriter &writer) const override { Schema::write(writer, *this); }
 
 private:
+    int dataLength() const { return Payload::size(*this); }
+
     QUuid m_itemId;
     QUuid m_parentId;
     QDateTime m_timestamp;
@@ -138,6 +147,25 @@ private:
     quint8 m_layout = 0x01;
     QList<TimelineAttribute> m_attributes;
     QList<TimelineAction> m_actions;
+
+    typedef PacketSchema::Layout<TimelineItem,
+        PACKET_FIELD(TimelineItem, m_attributes, PacketSchema::Elements),
+        PACKET_FIELD(TimelineItem, m_actions, PacketSchema::Elements)
+    > Payload;
+    typedef PacketSchema::Layout<TimelineItem,
+        PACKET_FIELD(TimelineItem, m_itemId, PacketSchema::Uuid),
+        PACKET_FIELD(TimelineItem, m_parentId, PacketSchema::Uuid),
+        PACKET_FIELD(TimelineItem, m_timestamp, PacketSchema::Timestamp<PacketSchema::LittleEndian<qint32>>),
+        PACKET_FIELD(TimelineItem, m_duration, PacketSchema::LittleEndian<quint16>),
+        PACKET_FIELD(TimelineItem, m_type, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(TimelineItem, m_flags, PacketSchema::LittleEndian<quint16>),
+        PACKET_FIELD(TimelineItem, m_layout, PacketSchema::BigEndian<quint8>),
+        PACKET_DERIVED(TimelineItem, int, dataLength, PacketSchema::LittleEndian<quint16>),
+        PACKET_FIELD(TimelineItem, m_attributes, PacketSchema::Count<PacketSchema::BigEndian<quint8>>),
+        PACKET_FIELD(TimelineItem, m_actions, PacketSchema::Count<PacketSchema::BigEndian<quint8>>),
+        PACKET_FIELD(TimelineItem, m_attributes, PacketSchema::Elements),
+        PACKET_FIELD(TimelineItem, m_actions, PacketSchema::Elements)
+    > Schema;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(TimelineItem::Flags)
@@ -4,10 +4,13 @@
 
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
+#include "metricsregistry.h"
+#include "tracing.h"
 
 #include <QColor>
 #include <QNetworkAccessManager>
 #include <QDir>
+#include <QElapsedTimer>
 
 #include <libintl.h>
 
@@ -153,6 +156,7 @@ void TimelinePin::remove() const
 void TimelinePin::erase() const
 {
     if(m_sent) return;
+    m_manager->cancel(*this); // drop whatever is still queued for the watch
     QFile::remove(m_manager->m_timelineStoragePath + "/" + m_uuid.toString().mid(1,36));
     m_manager->removePin(m_uuid);
 }
@@ -336,8 +340,17 @@ TimelineManager::TimelineManager(Pebble *pebble, WatchConnection *connection):
     m_pebble(pebble),
     m_connection(connection)
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointActionHandler, this, "actionHandler");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointActionHandler, this, &TimelineManager::actionHandler);
     connect(m_pebble->blobdb(), &BlobDB::blobCommandResult, this, &TimelineManager::blobdbAckHandler);
+    MetricsRegistry *metrics = m_connection->metrics();
+    m_metric_inserts = metrics->counter("timeline.inserts");
+    m_metric_removes = metrics->counter("timeline.removes");
+    m_metric_rejects = metrics->counter("timeline.rejects");
+    m_metric_actions = metrics->counter("timeline.actions");
+    m_metric_maintenance = metrics->histogram("timeline.maintenanceUsecs");
+    metrics->sampledGauge("timeline.pins", this, [this]() {
+        return qint64(m_pin_idx_guid.count());
+    });
     m_timelineStoragePath = pebble->storagePath() + "timeline";
     // Load firmware layout map
     if(!QFile::exists(m_timelineStoragePath+"/../layouts.json.auto"))
@@ -699,10 +712,11 @@ void TimelineManager::actionHandler(const QByteArray &actionReply)
     quint8 att_num = reader.read<quint8>();
     QJsonObject param;
     qDebug() << "Action invoked" << actionId << actionType << notificationId << att_num;
+    m_metric_actions->add();
     for(int i=0;i<att_num;i++) {
         quint8 type = reader.read<quint8>();
         quint16 len = reader.readLE<quint16>();
-        QByteArray buf = reader.readBytes(len);
+        QByteArray buf = reader.readView(len);
         qDebug() << "Attribute type" << type << "length" << len << buf;
         param=deserializeAttribute(type,buf,param);
     }
@@ -741,13 +755,18 @@ void TimelineManager::actionHandler(const QByteArray &actionReply)
         emit removeNotification(notificationId);
     }
 
-    QByteArray reply;
-    reply.append(0x11); // Length of id & status code
-    reply.append(notificationId.toRfc4122());
-    reply.append(status);
-    reply.append(attributes.count());
+    int size = 1 + 16 + 1 + 1;
     foreach (const TimelineAttribute &attrib, attributes) {
-        reply.append(attrib.serialize());
+        size += attrib.serializedSize();
+    }
+    QByteArray reply(size, Qt::Uninitialized);
+    WatchDataWriter writer(&reply, 0);
+    writer.write<quint8>(0x11); // Length of id & status code
+    writer.writeUuid(notificationId);
+    writer.write<quint8>(status);
+    writer.write<quint8>(attributes.count());
+    foreach (const TimelineAttribute &attrib, attributes) {
+        attrib.writeTo(writer);
     }
     m_connection->writeToPebble(WatchConnection::EndpointActionHandler, reply);
 }
@@ -829,14 +848,17 @@ void TimelineManager::doMaintenance()
     time_t window_start = QDateTime::currentDateTimeUtc().addDays(m_past_days).toTime_t();
     // Notification fadeout - we don't want notifications older than an hour.
     time_t event_horizon = QDateTime::currentDateTimeUtc().addSecs(m_event_fadeout).toTime_t();
+    TRACE_SPAN1("timeline", "maintenance", "pins", m_pin_idx_guid.count());
+    QElapsedTimer elapsed;
+    elapsed.start();
     // Delayed removal - to keep iterator consistent
     QList<const TimelinePin*> cleanup;
+    m_inMaintenance = true;
     qDebug() << "Executing maintenance cycle" << window_start << event_horizon << window_end;
     // Traverse items from most recent to oldest
     QMap<time_t,QList<QUuid>>::iterator it=m_pin_idx_time.end();
     if(!m_pin_idx_time.empty()) do {
         it--;
-        qDebug() << "Iterating timestamp" << it.key() << "with" << it.value().count() << "items";
         if(it.value().isEmpty()) {
             m_mtx_pinStorage.lock();
             m_pin_idx_time.erase(it);
@@ -859,7 +881,7 @@ void TimelineManager::doMaintenance()
                             cleanup.append(pin);
                             emit removeNotification(guid);
                         } else {
-                            qDebug() << "Resending unsent pin" << guid;
+                            TRACE_EVENT("timeline", "resend");
                             pin->send();
                         }
                     } if(pin->deleted() && pin->type()==TimelineItem::TypeNotification) {
@@ -888,21 +910,29 @@ void TimelineManager::doMaintenance()
             }
         }
     } while(it!=m_pin_idx_time.begin());
+    m_inMaintenance = false;
     qDebug() << "Cleaning up" << cleanup.size() << "discarded pins";
     foreach(const TimelinePin*pin,cleanup)
         pin->erase();
+    m_metric_maintenance->record(elapsed.nsecsElapsed() / 1000);
 }
 
 // Don't call these directly, pin will call it when needed
 void TimelineManager::insert(const TimelinePin &pin)
 {
     qDebug() << "inserting TimelinePin into blobdb:" << pin.blobId() << pin.guid().toString();
-    m_pebble->blobdb()->insert(pin.blobId(), pin.toItem());
+    m_metric_inserts->add();
+    m_pebble->blobdb()->insert(pin.blobId(), pin.toItem(), m_inMaintenance);
 }
 void TimelineManager::remove(const TimelinePin &pin)
 {
     qDebug() << "removing TimelinePin from blobdb:" << pin.blobId() << pin.guid().toString();
-    m_pebble->blobdb()->remove(pin.blobId(), pin.guid());
+    m_metric_removes->add();
+    m_pebble->blobdb()->remove(pin.blobId(), pin.guid(), m_inMaintenance);
+}
+void TimelineManager::cancel(const TimelinePin &pin)
+{
+    m_pebble->blobdb()->cancel(pin.blobId(), pin.guid());
 }
 
 void TimelineManager::clearTimeline(const QUuid &parent)
@@ -929,6 +959,12 @@ void TimelineManager::blobdbAckHandler(BlobDB::BlobDBId db, BlobDB::Operation cm
         qDebug() << "Result for non-existing pin" << uuid << db << cmd << ack;
         return;
     }
+    if(ack == BlobDB::StatusTimeout) {
+        // The watch never answered, so nothing changed. Leave it to the next maintenance cycle.
+        qDebug() << "No answer for" << ((cmd==BlobDB::OperationInsert)?"insert":"delete") << "of" << pin->guid();
+        pin->setPending(false);
+        return;
+    }
     qDebug() << ((ack==BlobDB::StatusSuccess)?"ACK":"NACK") << "for" << ((cmd==BlobDB::OperationInsert)?"insert":"delete") << "of" << pin->guid();
     if(cmd == BlobDB::OperationInsert) {
         switch(ack) {
@@ -940,6 +976,7 @@ void TimelineManager::blobdbAckHandler(BlobDB::BlobDBId db, BlobDB::Operation cm
             break;
         default:
             pin->setRejected(true);
+            m_metric_rejects->add();
         }
         pin->flush();
     } else if (cmd == BlobDB::OperationDelete) {
@@ -966,7 +1003,8 @@ void TimelineManager::blobdbAckHandler(BlobDB::BlobDBId db, BlobDB::Operation cm
 void TimelineManager::insertTimelinePin(const QJsonObject &json)
 {
     QJsonObject obj(json);
-    qDebug() << "Incoming pin:" << QJsonDocument(obj).toJson();
+    TRACE_SPAN("timeline", "insertTimelinePin");
+    qDebug() << "Incoming pin:" << obj.value("guid").toString();
     TimelinePin pin(obj,this);
     if(pin.type() == TimelineItem::TypeNotification) {
         // No persistence checks for volatile (system) notification. Nevertheless do some sanity checks
@@ -12,6 +12,9 @@
 #include <QJsonArray>
 #include <QJsonObject>
 
+class MetricCounter;
+class MetricHistogram;
+
 // layouts.json attribute representation
 struct Attr {
     quint8 id;
@@ -57,6 +60,7 @@ public:
     bool deleted() const { return m_deleted;}
     void setDeleted(bool b) {m_deleted=b;m_pending=false;m_sent=!b;m_rejected=!b;}
     bool pending() const {return m_pending;}
+    void setPending(bool b) {m_pending=b;}
 
     // nested objects ops
     typedef QList<const TimelinePin*> PtrList;
@@ -130,6 +134,7 @@ private slots:
 private:
     void insert(const class TimelinePin &pin);
     void remove(const class TimelinePin &pin);
+    void cancel(const class TimelinePin &pin);
     void addPin(const class TimelinePin &pin);
     quint32 pinCount(const QUuid *parent = 0);
     TimelinePin * getPin(const QUuid &guid);
@@ -148,6 +153,8 @@ private:
     // All should be updated in atomic syncronized transaction to prevent retention/sync timer race condition
     QMutex m_mtx_pinStorage;
     QTimer *m_tmr_maintenance;
+    // Resends from the maintenance cycle can wait for the link to be woken up anyway
+    bool m_inMaintenance = false;
     //QTimer m_tmr_websync;
 
     // Timeline window knobs. Pebble doesn't show future further than 48hrs ahead.
@@ -169,6 +176,12 @@ private:
 
     Pebble *m_pebble;
     WatchConnection *m_connection;
+
+    MetricCounter *m_metric_inserts;
+    MetricCounter *m_metric_removes;
+    MetricCounter *m_metric_rejects;
+    MetricCounter *m_metric_actions;
+    MetricHistogram *m_metric_maintenance;
 };
 
 #endif // TIMELINEMANAGER_H
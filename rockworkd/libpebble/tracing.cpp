@@ -0,0 +1,228 @@
+#include "tracing.h"
+
+#include <chrono>
+#include <QByteArray>
+#include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+
+namespace Trace {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+
+// Per thread, at 64 bytes an event 4 MiB for a thread that traces
+static const int RING_SIZE = 1 << 16;
+
+// Written only by its own thread. The writer bumps head after filling a slot, the exporter copies
+// the slots and then rereads head to find out which of them were overwritten meanwhile.
+struct Ring {
+    Event events[RING_SIZE];
+    std::atomic<quint64> head{0};
+    QByteArray threadName;
+    int tid = 0;
+};
+
+QMutex g_ringsMutex;
+QVector<Ring*> g_rings;
+std::atomic<qint64> g_startTime{0};
+thread_local Ring *t_ring = nullptr;
+
+Ring *threadRing()
+{
+    if (!t_ring) {
+        // Never freed, the events of a thread outlive it until exported
+        Ring *ring = new Ring;
+        QThread *thread = QThread::currentThread();
+        ring->threadName = thread && !thread->objectName().isEmpty() ? thread->objectName().toUtf8() : QByteArray();
+        QMutexLocker locker(&g_ringsMutex);
+        ring->tid = g_rings.count() + 1;
+        if (ring->threadName.isEmpty()) {
+            ring->threadName = ring->tid == 1 ? "main" : "thread " + QByteArray::number(ring->tid);
+        }
+        g_rings.append(ring);
+        t_ring = ring;
+    }
+    return t_ring;
+}
+
+void appendString(QByteArray *out, const char *s)
+{
+    out->append('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            out->append('\\');
+        }
+        if (uchar(*s) >= 0x20) {
+            out->append(*s);
+        }
+    }
+    out->append('"');
+}
+
+void appendMicros(QByteArray *out, qint64 nsecs)
+{
+    out->append(QByteArray::number(nsecs / 1000));
+    out->append('.');
+    out->append(QByteArray::number(nsecs % 1000).rightJustified(3, '0'));
+}
+
+void appendEvent(QByteArray *out, const Event &event, int tid, qint64 origin)
+{
+    out->append("{\"ph\":\"");
+    out->append(event.phase);
+    out->append("\",\"cat\":");
+    appendString(out, event.category);
+    out->append(",\"name\":");
+    appendString(out, event.name);
+    out->append(",\"pid\":1,\"tid\":");
+    out->append(QByteArray::number(tid));
+    out->append(",\"ts\":");
+    appendMicros(out, event.timestamp - origin);
+    switch (event.phase) {
+    case PhaseComplete:
+        out->append(",\"dur\":");
+        appendMicros(out, event.duration);
+        break;
+    case PhaseInstant:
+        out->append(",\"s\":\"t\"");
+        break;
+    case PhaseAsyncBegin:
+    case PhaseAsyncEnd:
+        out->append(",\"id\":\"0x");
+        out->append(QByteArray::number(event.id, 16));
+        out->append('"');
+        break;
+    }
+    if (event.argName) {
+        out->append(",\"args\":{");
+        appendString(out, event.argName);
+        out->append(':');
+        out->append(QByteArray::number(event.arg));
+        out->append('}');
+    }
+    out->append('}');
+}
+
+}
+
+qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(Phase phase, const char *category, const char *name, qint64 timestamp, qint64 duration,
+            const char *argName, qint64 arg, quint64 id)
+{
+    Ring *ring = threadRing();
+    const quint64 head = ring->head.load(std::memory_order_relaxed);
+    Event &event = ring->events[head % RING_SIZE];
+    event.category = category;
+    event.name = name;
+    event.argName = argName;
+    event.timestamp = timestamp;
+    event.duration = duration;
+    event.arg = arg;
+    event.id = id;
+    event.phase = phase;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool isCompiledIn()
+{
+#ifdef ENABLE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool start()
+{
+    if (!isCompiledIn()) {
+        qWarning() << "Built without tracing, rebuild with CONFIG+=tracing";
+        return false;
+    }
+    g_startTime.store(now());
+    g_enabled.store(true);
+    qDebug() << "Tracing started";
+    return true;
+}
+
+bool stop(const QString &fileName)
+{
+    if (!isCompiledIn()) {
+        return false;
+    }
+    g_enabled.store(false);
+
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Cannot write trace to" << fileName << file.errorString();
+        return false;
+    }
+
+    const qint64 origin = g_startTime.load();
+    QVector<Ring*> rings;
+    {
+        QMutexLocker locker(&g_ringsMutex);
+        rings = g_rings;
+    }
+
+    QByteArray out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    quint64 events = 0;
+    quint64 dropped = 0;
+    QVector<Event> copy;
+    copy.reserve(RING_SIZE);
+    foreach (Ring *ring, rings) {
+        // Thread metadata first, every following entry is preceded by its separator
+        if (ring != rings.first()) {
+            out.append(",\n");
+        }
+        out.append("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":");
+        out.append(QByteArray::number(ring->tid));
+        out.append(",\"args\":{\"name\":");
+        appendString(&out, ring->threadName.constData());
+        out.append("}}");
+
+        // Threads may still be finishing spans they started before tracing was stopped
+        const quint64 head = ring->head.load(std::memory_order_acquire);
+        const quint64 first = head > quint64(RING_SIZE) ? head - RING_SIZE : 0;
+        copy.clear();
+        for (quint64 i = first; i < head; i++) {
+            copy.append(ring->events[i % RING_SIZE]);
+        }
+        const quint64 newHead = ring->head.load(std::memory_order_acquire);
+        // Slot i is overwritten by write i + RING_SIZE, which fills it before moving head past it
+        const quint64 valid = newHead >= quint64(RING_SIZE) ? newHead - RING_SIZE + 1 : 0;
+        for (quint64 i = first; i < head; i++) {
+            if (i < valid) {
+                continue;
+            }
+            const Event &event = copy.at(i - first);
+            if (event.timestamp < origin) {
+                continue;
+            }
+            out.append(",\n");
+            appendEvent(&out, event, ring->tid, origin);
+            events++;
+        }
+        dropped += valid;
+
+        if (out.size() > 1 << 20) {
+            file.write(out);
+            out.clear();
+        }
+    }
+    out.append("\n]}\n");
+    file.write(out);
+
+    qDebug() << "Wrote" << events << "trace events to" << fileName << "(" << dropped << "older ones were overwritten)";
+    return true;
+}
+
+}
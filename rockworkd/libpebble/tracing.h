@@ -0,0 +1,111 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <QtGlobal>
+
+class QString;
+
+/*
+ * Structured tracing into per-thread rings, exported as Chrome trace-event JSON (chrome://tracing,
+ * Perfetto).
+ *
+ * Compiled in with CONFIG+=tracing (ENABLE_TRACING), otherwise the TRACE_* macros expand to nothing
+ * and don't evaluate their arguments. When compiled in, a macro costs a relaxed load and a branch
+ * while tracing is stopped. While started, an event is a clock read and a store into the calling
+ * thread's ring. Names, categories and argument names must be string literals: only the pointers
+ * are stored and nothing is formatted until the trace is written out.
+ *
+ *     TRACE_SPAN("blobdb", "sendNext");                // from here to the end of the scope
+ *     TRACE_EVENT1("bt", "write", "bytes", length);    // a point in time with one numeric argument
+ *     TRACE_ASYNC_BEGIN("blobdb", "command", token);   // spans that start and end in different calls
+ *     TRACE_COUNTER("upload", "remaining", remaining);
+ */
+namespace Trace {
+
+enum Phase {
+    PhaseComplete = 'X',
+    PhaseInstant = 'i',
+    PhaseCounter = 'C',
+    PhaseAsyncBegin = 'b',
+    PhaseAsyncEnd = 'e'
+};
+
+struct Event {
+    const char *category;
+    const char *name;
+    const char *argName; // nullptr without an argument
+    qint64 timestamp;    // nanoseconds, monotonic
+    qint64 duration;     // nanoseconds, complete events only
+    qint64 arg;
+    quint64 id;          // async events only
+    char phase;
+};
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+qint64 now();
+void record(Phase phase, const char *category, const char *name, qint64 timestamp, qint64 duration = 0,
+            const char *argName = nullptr, qint64 arg = 0, quint64 id = 0);
+
+// Events older than the last start() are left out of the export. Both return false when built without tracing.
+bool start();
+bool stop(const QString &fileName);
+bool isCompiledIn();
+
+// Records a complete event covering its lifetime, if tracing was on when it was created
+class Span
+{
+public:
+    Span(const char *category, const char *name, const char *argName = nullptr, qint64 arg = 0):
+        m_category(enabled() ? category : nullptr), m_name(name), m_argName(argName), m_arg(arg),
+        m_start(m_category ? now() : 0) {}
+    ~Span()
+    {
+        if (m_category) {
+            record(PhaseComplete, m_category, m_name, m_start, now() - m_start, m_argName, m_arg);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(Span)
+
+    const char *m_category;
+    const char *m_name;
+    const char *m_argName;
+    qint64 m_arg;
+    qint64 m_start;
+};
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef ENABLE_TRACING
+#define TRACE_SPAN(category, name) \
+    Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(category, name)
+#define TRACE_SPAN1(category, name, argName, arg) \
+    Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(category, name, argName, arg)
+#define TRACE_EVENT(category, name) \
+    do { if (Trace::enabled()) Trace::record(Trace::PhaseInstant, category, name, Trace::now()); } while (0)
+#define TRACE_EVENT1(category, name, argName, arg) \
+    do { if (Trace::enabled()) Trace::record(Trace::PhaseInstant, category, name, Trace::now(), 0, argName, arg); } while (0)
+#define TRACE_COUNTER(category, name, value) \
+    do { if (Trace::enabled()) Trace::record(Trace::PhaseCounter, category, name, Trace::now(), 0, name, value); } while (0)
+#define TRACE_ASYNC_BEGIN(category, name, id) \
+    do { if (Trace::enabled()) Trace::record(Trace::PhaseAsyncBegin, category, name, Trace::now(), 0, nullptr, 0, id); } while (0)
+#define TRACE_ASYNC_END(category, name, id) \
+    do { if (Trace::enabled()) Trace::record(Trace::PhaseAsyncEnd, category, name, Trace::now(), 0, nullptr, 0, id); } while (0)
+#else
+#define TRACE_SPAN(category, name) do {} while (0)
+#define TRACE_SPAN1(category, name, argName, arg) do {} while (0)
+#define TRACE_EVENT(category, name) do {} while (0)
+#define TRACE_EVENT1(category, name, argName, arg) do {} while (0)
+#define TRACE_COUNTER(category, name, value) do {} while (0)
+#define TRACE_ASYNC_BEGIN(category, name, id) do {} while (0)
+#define TRACE_ASYNC_END(category, name, id) do {} while (0)
+#endif
+
+#endif // TRACING_H
@@ -1,56 +1,142 @@
 #include "uploadmanager.h"
+#include "linkprobe.h"
+#include "metricsregistry.h"
+#include "tracing.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
 
+#include <QTimer>
+#include <cstring>
+
+// Works with every firmware
 static const int CHUNK_SIZE = 2000;
+// Leaves room for the frame and PutBytes headers within 8k
+static const int LARGE_CHUNK_SIZE = 8000;
+static const int CHUNK_HEADER_SIZE = 1 + 4 + 4;
+// Lets the version exchange go first after a reconnect
+static const int RESUME_DELAY = 1000;
+// A link that keeps dropping won't get the upload through
+static const int MAX_RESUMES = 5;
+// For the watch to confirm an abort, stretched by the measured round trip
+static const int ABORT_TIMEOUT = 2000;
 
 UploadManager::UploadManager(WatchConnection *connection, QObject *parent) :
     QObject(parent), m_connection(connection),
-    _lastUploadId(0), _state(StateNotStarted)
+    _lastUploadId(0), _state(StateNotStarted),
+    m_abortTimer(new QTimer(this))
 {
-    m_connection->registerEndpointHandler(WatchConnection::EndpointPutBytes, this, "handlePutBytesMessage");
+    m_abortTimer->setSingleShot(true);
+    connect(m_abortTimer, &QTimer::timeout, this, &UploadManager::finishPreemption);
+
+    m_connection->registerEndpointHandler(WatchConnection::EndpointPutBytes, this, &UploadManager::handlePutBytesMessage);
+    connect(m_connection, &WatchConnection::watchConnected, this, &UploadManager::watchConnected);
+    connect(m_connection, &WatchConnection::watchDisconnected, this, &UploadManager::watchDisconnected);
+
+    MetricsRegistry *metrics = m_connection->metrics();
+    m_started = metrics->counter("upload.started");
+    m_succeeded = metrics->counter("upload.succeeded");
+    m_failed = metrics->counter("upload.failed");
+    m_bytesSent = metrics->counter("upload.bytesSent");
+    m_replyTime = metrics->histogram("upload.replyUsecs");
+    m_throughput = metrics->histogram("upload.bytesPerSec");
+    m_chunkSize = metrics->gauge("upload.chunkSize");
+    m_resumed = metrics->counter("upload.resumed");
+    m_crcMismatches = metrics->counter("upload.crcMismatches");
+    m_merged = metrics->counter("upload.merged");
+    m_preempted = metrics->counter("upload.preempted");
+    m_queueWait = metrics->histogram("upload.queueWaitUsecs");
+    metrics->sampledGauge("upload.linkBytesPerSec", this, [this]() {
+        return m_linkBytesPerSec;
+    });
+    metrics->sampledGauge("upload.queued", this, [this]() {
+        return qint64(_pending.size());
+    });
 }
 
 uint UploadManager::upload(WatchConnection::UploadType type, int index, quint32 appInstallId, const QString &filename, int size, quint32 crc,
                            SuccessCallback successCallback, ErrorCallback errorCallback, ProgressCallback progressCallback)
 {
-    qDebug() << "Should enqueue uplodad:" << filename;
-    PendingUpload upload;
-    upload.id = ++_lastUploadId;
-    upload.type = type;
-    upload.index = index;
-    upload.filename = filename;
-    upload.appInstallId = appInstallId;
     QFile *f = new QFile(filename);
     if (!f->open(QFile::ReadOnly)) {
         qWarning() << "Error opening file" << filename << "for reading. Cannot upload file";
+        delete f;
         if (errorCallback) {
             errorCallback(-1);
         }
+        return -1;
     }
-    upload.device = f;
-    if (size < 0) {
-        upload.size = f->size();
-    } else {
-        upload.size = size;
+    return upload(type, index, appInstallId, filename, f, size < 0 ? f->size() : size, crc, successCallback, errorCallback, progressCallback);
+}
+
+uint UploadManager::upload(WatchConnection::UploadType type, int index, quint32 appInstallId, const QString &filename, QIODevice *device, int size, quint32 crc,
+                           SuccessCallback successCallback, ErrorCallback errorCallback, ProgressCallback progressCallback)
+{
+    qDebug() << "Should enqueue uplodad:" << filename;
+    PendingUpload upload;
+    upload.id = ++_lastUploadId;
+    upload.type = type;
+    upload.priority = priorityFor(type);
+    upload.index = index;
+    upload.filename = filename;
+    upload.appInstallId = appInstallId;
+    upload.device = device;
+    upload.size = size;
+    QFile *f = qobject_cast<QFile *>(device);
+    if (f && upload.size > 0 && upload.size <= f->size()) {
+        // Chunks are then copied straight from the page cache, unmapped again when the file is deleted
+        upload.map = f->map(0, upload.size);
     }
     upload.remaining = upload.size;
     upload.crc = crc;
-    upload.successCallback = successCallback;
-    upload.errorCallback = errorCallback;
-    upload.progressCallback = progressCallback;
+    if (successCallback) {
+        upload.successCallbacks.append(successCallback);
+    }
+    if (errorCallback) {
+        upload.errorCallbacks.append(errorCallback);
+    }
+    if (progressCallback) {
+        upload.progressCallbacks.append(progressCallback);
+    }
 
     if (upload.remaining <= 0) {
         qWarning() << "upload is empty";
+        delete device;
         if (errorCallback) {
             errorCallback(-1);
-            return -1;
         }
+        return -1;
     }
 
-    _pending.enqueue(upload);
+    for (int i = 0; i < _pending.size(); i++) {
+        PendingUpload &existing = _pending[i];
+        // One that is finishing has already called back
+        if (!isSameUpload(existing, upload) || (i == 0 && _state == StateComplete)) {
+            continue;
+        }
+        qDebug() << "upload of" << filename << "is already queued as" << existing.id << ", merging";
+        m_merged->add();
+        delete device;
+        existing.successCallbacks.append(upload.successCallbacks);
+        existing.errorCallbacks.append(upload.errorCallbacks);
+        existing.progressCallbacks.append(upload.progressCallbacks);
+        if (upload.priority < existing.priority) {
+            existing.priority = upload.priority;
+            if (i > 0 || _state == StateNotStarted) {
+                PendingUpload moved = _pending.takeAt(i);
+                _pending.insert(insertPosition(moved.priority, false), moved);
+            }
+        }
+        return existing.id;
+    }
+
+    if (_pending.empty()) {
+        m_suspended = false;
+    }
+    upload.queued.start();
+    _pending.insert(insertPosition(upload.priority, false), upload);
 
-    if (_pending.size() == 1) {
+    // A running upload that is in the way gets preempted at its next chunk
+    if (_state == StateNotStarted) {
         startNextUpload();
     }
 
@@ -82,11 +168,207 @@ uint UploadManager::uploadFirmwareResources(const QString &filename, quint32 crc
     return upload(WatchConnection::UploadTypeSystemResources, 0, 0, filename, -1, crc, successCallback, errorCallback, progressCallback);
 }
 
+uint UploadManager::uploadFirmwareBinary(bool recovery, const QString &name, QIODevice *device, int size, quint32 crc, SuccessCallback successCallback, ErrorCallback errorCallback, ProgressCallback progressCallback)
+{
+    return upload(recovery ? WatchConnection::UploadTypeRecovery: WatchConnection::UploadTypeFirmware, 0, 0, name, device, size, crc, successCallback, errorCallback, progressCallback);
+}
+
+uint UploadManager::uploadFirmwareResources(const QString &name, QIODevice *device, int size, quint32 crc, SuccessCallback successCallback, ErrorCallback errorCallback, ProgressCallback progressCallback)
+{
+    return upload(WatchConnection::UploadTypeSystemResources, 0, 0, name, device, size, crc, successCallback, errorCallback, progressCallback);
+}
+
 uint UploadManager::uploadAppWorker(quint32 appInstallId, const QString &filename, quint32 crc, UploadManager::SuccessCallback successCallback, UploadManager::ErrorCallback errorCallback, UploadManager::ProgressCallback progressCallback)
 {
     return upload(WatchConnection::UploadTypeWorker, -1, appInstallId, filename, -1, crc, successCallback, errorCallback, progressCallback);
 }
 
+UploadManager::Priority UploadManager::priorityFor(WatchConnection::UploadType type)
+{
+    switch (type) {
+    case WatchConnection::UploadTypeBinary:
+    case WatchConnection::UploadTypeResources:
+    case WatchConnection::UploadTypeWorker:
+        return PriorityInteractive;
+    case WatchConnection::UploadTypeFirmware:
+    case WatchConnection::UploadTypeRecovery:
+    case WatchConnection::UploadTypeSystemResources:
+        return PriorityBackground;
+    default:
+        return PriorityNormal;
+    }
+}
+
+void UploadManager::setLargeChunks(bool enabled)
+{
+    m_largeChunks = enabled;
+}
+
+bool UploadManager::isSuspended() const
+{
+    return m_suspended;
+}
+
+void UploadManager::resume()
+{
+    if (!m_suspended || !m_connection->isConnected()) {
+        return;
+    }
+    m_suspended = false;
+    if (!_pending.empty() && _state == StateNotStarted) {
+        qDebug() << "resuming upload" << _pending.head().id << "from the start, attempt" << _pending.head().resumes;
+        m_resumed->add();
+        startNextUpload();
+    }
+}
+
+void UploadManager::watchConnected()
+{
+    if (m_suspended) {
+        QTimer::singleShot(RESUME_DELAY, this, SLOT(resumeAfterReconnect()));
+    }
+}
+
+void UploadManager::resumeAfterReconnect()
+{
+    if (_pending.empty()) {
+        m_suspended = false;
+        return;
+    }
+    switch (_pending.head().type) {
+    case WatchConnection::UploadTypeFirmware:
+    case WatchConnection::UploadTypeRecovery:
+    case WatchConnection::UploadTypeSystemResources:
+        // FirmwareDownloader calls resume() once the watch is back in update mode
+        break;
+    default:
+        resume();
+    }
+}
+
+void UploadManager::watchDisconnected()
+{
+    // Measured on this link, the next one starts from CHUNK_SIZE until it has been measured itself
+    m_linkBytesPerSec = 0;
+    if (_state == StateAborting) {
+        // The abort went with the link, the preempted upload goes behind the interactive one all the same
+        finishPreemption();
+    }
+    if (!_pending.empty()) {
+        suspend();
+    }
+}
+
+void UploadManager::suspend()
+{
+    PendingUpload &upload = _pending.head();
+    m_suspended = true;
+    if (_state == StateNotStarted) {
+        return;
+    }
+
+    // The watch forgets the token with the link, PutBytes can't continue a transfer. What the watch
+    // committed stays, which is every earlier part of an install, this part has to start over.
+    qWarning() << "link lost during upload" << upload.id << "with" << upload.remaining << "of" << upload.size << "bytes left";
+    TRACE_ASYNC_END("upload", "upload", upload.id);
+    _state = StateNotStarted;
+    _token = 0;
+    m_chunkInFlight = 0;
+    m_requestSent.invalidate();
+    rewind(upload);
+
+    if (++upload.resumes > MAX_RESUMES) {
+        qWarning() << "giving up on upload" << upload.id << "after" << MAX_RESUMES << "reconnects";
+        cancel(upload.id, -1);
+    }
+}
+
+void UploadManager::rewind(PendingUpload &upload)
+{
+    upload.remaining = upload.size;
+    upload.nextChunk.clear();
+    upload.nextChunkLength = 0;
+    if (!upload.map) {
+        // Zip entries and other sequential devices can only start over by being opened again
+        if (!upload.device->reset()) {
+            upload.device->close();
+            upload.device->open(QIODevice::ReadOnly);
+        }
+        upload.localCrc.reset();
+    }
+}
+
+int UploadManager::insertPosition(Priority priority, bool ahead) const
+{
+    // Once the head went out to the watch only preemption moves it
+    int i = _state == StateNotStarted ? 0 : 1;
+    for (; i < _pending.size(); i++) {
+        const Priority other = _pending.at(i).priority;
+        if (ahead ? other >= priority : other > priority) {
+            break;
+        }
+    }
+    return i;
+}
+
+bool UploadManager::isSameUpload(const PendingUpload &a, const PendingUpload &b)
+{
+    return a.type == b.type && a.index == b.index && a.appInstallId == b.appInstallId
+            && a.filename == b.filename && a.size == b.size && a.crc == b.crc;
+}
+
+void UploadManager::preempt(PendingUpload &upload)
+{
+    qDebug() << "upload" << upload.id << "makes way for" << _pending.at(1).id << "with"
+             << upload.remaining << "of" << upload.size << "bytes left";
+
+    QByteArray msg;
+    WatchDataWriter writer(&msg);
+    writer.write<quint8>(PutBytesCommandAbort);
+    writer.write<quint32>(_token);
+
+    TRACE_ASYNC_END("upload", "upload", upload.id);
+    m_preempted->add();
+    m_preemptedId = upload.id;
+    _state = StateAborting;
+    m_abortTimer->start(m_connection->linkProbe()->timeout(ABORT_TIMEOUT));
+    sendRequest(msg);
+}
+
+void UploadManager::finishPreemption()
+{
+    if (_state != StateAborting) {
+        return;
+    }
+    m_abortTimer->stop();
+    m_requestSent.invalidate();
+    _state = StateNotStarted;
+    _token = 0;
+
+    // Goes back ahead of uploads of its own priority, it was there first. Gone if it was cancelled meanwhile.
+    for (int i = 0; i < _pending.size(); i++) {
+        if (_pending.at(i).id == m_preemptedId) {
+            PendingUpload upload = _pending.takeAt(i);
+            rewind(upload);
+            _pending.insert(insertPosition(upload.priority, true), upload);
+            break;
+        }
+    }
+    m_preemptedId = 0;
+
+    if (!_pending.empty()) {
+        startNextUpload();
+    }
+}
+
+void UploadManager::reportProgress(PendingUpload &upload, qreal progress)
+{
+    upload.progress = qMax(upload.progress, progress);
+    for (const ProgressCallback &callback : upload.progressCallbacks) {
+        callback(upload.progress);
+    }
+}
+
 void UploadManager::cancel(uint id, int code)
 {
     if (_pending.empty()) {
@@ -98,6 +380,16 @@ void UploadManager::cancel(uint id, int code)
         PendingUpload upload = _pending.dequeue();
         qDebug() << "aborting current upload" << id << "(code:" << code << ")";
 
+        if (_state == StateAborting) {
+            // Already aborted, finishPreemption() moves on to the next one
+            m_failed->add();
+            for (const ErrorCallback &callback : upload.errorCallbacks) {
+                callback(code);
+            }
+            upload.device->deleteLater();
+            return;
+        }
+
         if (_state != StateNotStarted && _state != StateWaitForToken && _state != StateComplete) {
             QByteArray msg;
             WatchDataWriter writer(&msg);
@@ -111,24 +403,27 @@ void UploadManager::cancel(uint id, int code)
 
         _state = StateNotStarted;
         _token = 0;
+        m_failed->add();
+        TRACE_ASYNC_END("upload", "upload", id);
 
-        if (upload.errorCallback) {
-            upload.errorCallback(code);
+        for (const ErrorCallback &callback : upload.errorCallbacks) {
+            callback(code);
         }
         upload.device->deleteLater();
 
-        if (!_pending.empty()) {
+        // An error callback may have queued an upload, which started it
+        if (!_pending.empty() && _state == StateNotStarted) {
             startNextUpload();
         }
     } else {
         for (int i = 1; i < _pending.size(); ++i) {
             if (_pending[i].id == id) {
                 qDebug() << "cancelling upload" << id << "(code:" << code << ")";
-                if (_pending[i].errorCallback) {
-                    _pending[i].errorCallback(code);
+                PendingUpload upload = _pending.takeAt(i);
+                for (const ErrorCallback &callback : upload.errorCallbacks) {
+                    callback(code);
                 }
-                _pending.at(i).device->deleteLater();
-                _pending.removeAt(i);
+                upload.device->deleteLater();
                 return;
             }
         }
@@ -141,7 +436,30 @@ void UploadManager::startNextUpload()
     Q_ASSERT(!_pending.empty());
     Q_ASSERT(_state == StateNotStarted);
 
+    if (!m_connection->isConnected()) {
+        m_suspended = true;
+    }
+    if (m_suspended) {
+        // Started by resume() once the watch is back
+        return;
+    }
+
     PendingUpload &upload = _pending.head();
+    if (upload.map && !upload.verified) {
+        upload.localCrc.update(reinterpret_cast<const char *>(upload.map), upload.size);
+        if (!checkCrc(upload, upload.localCrc.value())) {
+            cancel(upload.id, -1);
+            return;
+        }
+    }
+
+    if (!upload.started) {
+        upload.started = true;
+        const qint64 waitUsecs = upload.queued.nsecsElapsed() / 1000;
+        m_queueWait->record(waitUsecs);
+        qDebug() << "upload" << upload.id << "waited" << waitUsecs / 1000 << "ms in the queue";
+    }
+
     QByteArray msg;
     WatchDataWriter writer(&msg);
     writer.write<quint8>(PutBytesCommandInit);
@@ -164,40 +482,90 @@ void UploadManager::startNextUpload()
                          << ", crc:" << upload.crc
                          << ", filename:" << upload.filename;
 
-    qDebug() << msg.toHex();
-
+    TRACE_ASYNC_BEGIN("upload", "upload", upload.id);
+    upload.elapsed.start();
     _state = StateWaitForToken;
-    m_connection->writeToPebble(WatchConnection::EndpointPutBytes, msg);
+    m_started->add();
+    sendRequest(msg);
 }
 
-bool UploadManager::uploadNextChunk(PendingUpload &upload)
+int UploadManager::chunkSize() const
 {
-    QByteArray chunk = upload.device->read(qMin<int>(upload.remaining, CHUNK_SIZE));
+    if (!m_largeChunks || m_linkBytesPerSec <= 0) {
+        return CHUNK_SIZE;
+    }
+    // Each chunk waits a round trip for its ack. Sized to the bandwidth-delay product, the link spends
+    // at least as long moving data as it does waiting.
+    const int rtt = m_connection->linkProbe()->histogram().smoothed();
+    if (rtt < 0) {
+        return CHUNK_SIZE;
+    }
+    return qBound<qint64>(CHUNK_SIZE, m_linkBytesPerSec * rtt / 1000, LARGE_CHUNK_SIZE);
+}
+
+bool UploadManager::prepareChunk(PendingUpload &upload)
+{
+    const int length = qMin(upload.remaining, chunkSize());
+    upload.nextChunk.resize(CHUNK_HEADER_SIZE + length);
+    WatchDataWriter writer(&upload.nextChunk, 0);
+    writer.write<quint8>(PutBytesCommandSend);
+    writer.write<quint32>(_token);
+    writer.write<quint32>(length);
 
-    if (upload.remaining < CHUNK_SIZE && chunk.size() < upload.remaining) {
-        // Short read!
+    char *payload = upload.nextChunk.data() + CHUNK_HEADER_SIZE;
+    if (upload.map) {
+        memcpy(payload, upload.map + (upload.size - upload.remaining), length);
+    } else if (upload.device->read(payload, length) != length) {
         qWarning() << "short read during upload" << upload.id;
+        upload.nextChunk.clear();
         return false;
+    } else if (!upload.verified) {
+        upload.localCrc.update(payload, length);
+        if (length == upload.remaining && !checkCrc(upload, upload.localCrc.value())) {
+            upload.nextChunk.clear();
+            return false;
+        }
     }
+    upload.nextChunkLength = length;
+    m_chunkSize->set(length);
+    return true;
+}
 
-    Q_ASSERT(!chunk.isEmpty());
-    Q_ASSERT(_state = StateInProgress);
-
-    QByteArray msg;
-    WatchDataWriter writer(&msg);
-    writer.write<quint8>(PutBytesCommandSend);
-    writer.write<quint32>(_token);
-    writer.write<quint32>(chunk.size());
-    msg.append(chunk);
+bool UploadManager::checkCrc(PendingUpload &upload, quint32 crc)
+{
+    upload.verified = true;
+    if (upload.crc == 0) {
+        qDebug() << "upload" << upload.id << "has no expected crc, using" << crc;
+        upload.crc = crc;
+    } else if (upload.crc != crc) {
+        qWarning() << "upload" << upload.id << "of" << upload.filename << "has crc" << crc << "but" << upload.crc << "was expected";
+        m_crcMismatches->add();
+        return false;
+    }
+    return true;
+}
 
-    qDebug() << "sending a chunk of" << chunk.size() << "bytes";
+bool UploadManager::uploadNextChunk(PendingUpload &upload)
+{
+    Q_ASSERT(_state == StateInProgress);
 
-    m_connection->writeToPebble(WatchConnection::EndpointPutBytes, msg);
+    if (upload.nextChunk.isEmpty() && !prepareChunk(upload)) {
+        return false;
+    }
 
-    upload.remaining -= chunk.size();
+    sendRequest(upload.nextChunk);
+    m_chunkInFlight = upload.nextChunkLength;
+    m_bytesSent->add(upload.nextChunkLength);
 
-    qDebug() << "remaining" << upload.remaining << "/" << upload.size << "bytes";
+    upload.remaining -= upload.nextChunkLength;
+    upload.nextChunk.clear();
+    upload.nextChunkLength = 0;
+    TRACE_COUNTER("upload", "remaining", upload.remaining);
 
+    // Read ahead while the chunk is on its way, a failure shows up again when it's due
+    if (upload.remaining > 0) {
+        prepareChunk(upload);
+    }
     return true;
 }
 
@@ -214,7 +582,7 @@ bool UploadManager::commit(PendingUpload &upload)
 
     qDebug() << "commiting upload" << upload.id;
 
-    m_connection->writeToPebble(WatchConnection::EndpointPutBytes, msg);
+    sendRequest(msg);
 
     return true;
 }
@@ -230,11 +598,31 @@ bool UploadManager::complete(PendingUpload &upload)
 
     qDebug() << "completing upload" << upload.id;
 
-    m_connection->writeToPebble(WatchConnection::EndpointPutBytes, msg);
+    sendRequest(msg);
 
     return true;
 }
 
+void UploadManager::sendRequest(const QByteArray &msg)
+{
+    m_requestSent.start();
+    m_chunkInFlight = 0;
+    m_connection->writeToPebble(WatchConnection::EndpointPutBytes, msg);
+}
+
+void UploadManager::updateLinkRate(int chunkLength, qint64 replyUsecs)
+{
+    // The reply time is a round trip plus the time the chunk took, the latter is what's left after the
+    // probed round trip. Never credited with more than 3/4 of it so a high round trip can't inflate the rate.
+    const int rtt = m_connection->linkProbe()->histogram().smoothed();
+    const qint64 transferUsecs = qMax(replyUsecs - qMax(rtt, 0) * 1000, replyUsecs / 4);
+    if (transferUsecs <= 0) {
+        return;
+    }
+    const qint64 rate = qint64(chunkLength) * 1000000 / transferUsecs;
+    m_linkBytesPerSec = m_linkBytesPerSec <= 0 ? rate : (7 * m_linkBytesPerSec + rate) / 8;
+}
+
 void UploadManager::handlePutBytesMessage(const QByteArray &data)
 {
     if (_pending.empty()) {
@@ -242,7 +630,22 @@ void UploadManager::handlePutBytesMessage(const QByteArray &data)
         return;
     }
     Q_ASSERT(!_pending.empty());
+    if (_state == StateAborting) {
+        // Whatever the watch says to the abort, the token is gone
+        qDebug() << "abort of upload" << m_preemptedId << "answered";
+        finishPreemption();
+        return;
+    }
     PendingUpload &upload = _pending.head();
+    if (m_requestSent.isValid()) {
+        const qint64 replyUsecs = m_requestSent.nsecsElapsed() / 1000;
+        m_replyTime->record(replyUsecs);
+        m_requestSent.invalidate();
+        if (m_chunkInFlight > 0) {
+            updateLinkRate(m_chunkInFlight, replyUsecs);
+            m_chunkInFlight = 0;
+        }
+    }
 
     WatchDataReader reader(data);
     int status = reader.read<quint8>();
@@ -280,12 +683,14 @@ void UploadManager::handlePutBytesMessage(const QByteArray &data)
 
         /* fallthrough */
     case StateInProgress:
-        qDebug() << "moving to the next chunk";
-        if (upload.progressCallback) {
-            // Report that the previous chunk has been succesfully uploaded
-            upload.progressCallback(1.0 - (qreal(upload.remaining) / upload.size));
-        }
+        // Report that the previous chunk has been succesfully uploaded
+        reportProgress(upload, 1.0 - (qreal(upload.remaining) / upload.size));
         if (upload.remaining > 0) {
+            if (upload.priority != PriorityInteractive && _pending.size() > 1
+                    && _pending.at(1).priority == PriorityInteractive) {
+                preempt(upload);
+                return;
+            }
             if (!uploadNextChunk(upload)) {
                 cancel(upload.id, -1);
                 return;
@@ -301,10 +706,8 @@ void UploadManager::handlePutBytesMessage(const QByteArray &data)
         break;
     case StateCommit:
         qDebug() << "commited succesfully";
-        if (upload.progressCallback) {
-            // Report that all chunks have been succesfully uploaded
-            upload.progressCallback(1.0);
-        }
+        // Report that all chunks have been succesfully uploaded
+        reportProgress(upload, 1.0);
         _state = StateComplete;
         if (!complete(upload)) {
             cancel(upload.id, -1);
@@ -313,8 +716,17 @@ void UploadManager::handlePutBytesMessage(const QByteArray &data)
         break;
     case StateComplete:
         qDebug() << "upload" << upload.id << "succesful, invoking callback";
-        if (upload.successCallback) {
-            upload.successCallback();
+        m_succeeded->add();
+        if (upload.elapsed.elapsed() > 0) {
+            const qint64 bytesPerSec = qint64(upload.size) * 1000 / upload.elapsed.elapsed();
+            m_throughput->record(bytesPerSec);
+            qDebug() << "upload" << upload.id << "moved" << upload.size << "bytes in" << upload.elapsed.elapsed() << "ms," << bytesPerSec << "bytes/s";
+        }
+        TRACE_ASYNC_END("upload", "upload", upload.id);
+        // A callback may queue the next upload, which can't be merged into this one any more
+        const QList<SuccessCallback> callbacks = upload.successCallbacks;
+        for (const SuccessCallback &callback : callbacks) {
+            callback();
         }
         upload.device->deleteLater();
         _pending.dequeue();
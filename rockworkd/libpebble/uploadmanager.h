@@ -2,9 +2,16 @@
 #define UPLOADMANAGER_H
 
 #include <functional>
+#include <QElapsedTimer>
 #include <QQueue>
+#include "stm32crc.h"
 #include "watchconnection.h"
 
+class MetricCounter;
+class MetricGauge;
+class MetricHistogram;
+class QTimer;
+
 class UploadManager : public QObject
 {
     Q_OBJECT
@@ -12,12 +19,27 @@ class UploadManager : public QObject
 public:
     explicit UploadManager(WatchConnection *watch, QObject *parent = 0);
 
+    // Follows from the upload type: app parts are fetched while the user waits on them, files are
+    // pushed on our own account and firmware takes long enough that a few seconds more don't matter
+    enum Priority {
+        PriorityInteractive,
+        PriorityNormal,
+        PriorityBackground
+    };
+    static Priority priorityFor(WatchConnection::UploadType type);
+
     typedef std::function<void()> SuccessCallback;
     typedef std::function<void(int)> ErrorCallback;
     typedef std::function<void(qreal)> ProgressCallback;
 
+    // Uploads are queued by priority. Asking for one that is already queued, same target and same
+    // contents, adds the callbacks to it and returns its id.
     uint upload(WatchConnection::UploadType type, int index, quint32 appInstallId, const QString &filename, int size = -1, quint32 crc = 0,
                 SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
+    // Uploads size bytes read from device, which must be open for reading. Takes ownership of it.
+    // Sequential devices such as zip entries work, they are read as the upload goes.
+    uint upload(WatchConnection::UploadType type, int index, quint32 appInstallId, const QString &filename, QIODevice *device, int size, quint32 crc = 0,
+                SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
 
     uint uploadAppBinary(quint32 appInstallId, const QString &filename, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
     uint uploadAppResources(quint32 appInstallId, const QString &filename, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
@@ -25,11 +47,21 @@ public:
 
     uint uploadFirmwareBinary(bool recovery, const QString &filename, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
     uint uploadFirmwareResources(const QString &filename, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
+    uint uploadFirmwareBinary(bool recovery, const QString &name, QIODevice *device, int size, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
+    uint uploadFirmwareResources(const QString &name, QIODevice *device, int size, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
 
     uint uploadFile(const QString &filename, quint32 crc, SuccessCallback successCallback = SuccessCallback(), ErrorCallback errorCallback = ErrorCallback(), ProgressCallback progressCallback = ProgressCallback());
 
     void cancel(uint id, int code = 0);
 
+    // Uploads are suspended when the link drops and start over once it is back. Firmware uploads wait for
+    // resume(), the watch has to be put into update mode again first.
+    bool isSuspended() const;
+    void resume();
+
+    // Whether the watch takes frames of up to 8k, from its Capability8kAppMessages
+    void setLargeChunks(bool enabled);
+
 signals:
 
 private:
@@ -38,7 +70,9 @@ private:
         StateWaitForToken,
         StateInProgress,
         StateCommit,
-        StateComplete
+        StateComplete,
+        // The head was aborted to let an interactive upload go first, waiting for the watch to confirm
+        StateAborting
     };
 
     struct PendingUpload {
@@ -49,13 +83,31 @@ private:
         QString filename;
         quint32 appInstallId;
         QIODevice *device;
+        // The whole file if it could be mapped, device isn't read then
+        const uchar *map = nullptr;
+        Priority priority;
         int size;
         int remaining;
         quint32 crc;
-
-        SuccessCallback successCallback;
-        ErrorCallback errorCallback;
-        ProgressCallback progressCallback;
+        // The next PutBytesCommandSend, read and encoded while the watch acks the previous one
+        QByteArray nextChunk;
+        int nextChunkLength = 0;
+        QElapsedTimer elapsed;
+        // Highest progress reported, kept when the upload starts over so callers don't see it go back
+        qreal progress = 0;
+        int resumes = 0;
+        // Checked against crc before any of the file goes out if it is mapped, else as it is read and
+        // before the last chunk is sent. A crc of 0 is taken to be unknown and filled in.
+        Stm32Crc localCrc;
+        bool verified = false;
+        // Since the upload was queued, for the wait until it is first sent
+        QElapsedTimer queued;
+        bool started = false;
+
+        // One of each per caller, requests for the same upload are merged
+        QList<SuccessCallback> successCallbacks;
+        QList<ErrorCallback> errorCallbacks;
+        QList<ProgressCallback> progressCallbacks;
     };
 
     enum PutBytesCommand {
@@ -67,12 +119,30 @@ private:
     };
 
     void startNextUpload();
+    void suspend();
+    // Puts the upload back to its first byte, the watch can't pick up an interrupted transfer
+    void rewind(PendingUpload &upload);
+    // Where an upload of priority goes in the queue, ahead of others of the same priority or behind them
+    int insertPosition(Priority priority, bool ahead) const;
+    static bool isSameUpload(const PendingUpload &a, const PendingUpload &b);
+    void preempt(PendingUpload &upload);
+    void reportProgress(PendingUpload &upload, qreal progress);
+    int chunkSize() const;
+    bool prepareChunk(PendingUpload &upload);
     bool uploadNextChunk(PendingUpload &upload);
+    bool checkCrc(PendingUpload &upload, quint32 crc);
     bool commit(PendingUpload &upload);
     bool complete(PendingUpload &upload);
+    // Sends a message the watch answers, timing the answer
+    void sendRequest(const QByteArray &msg);
+    void updateLinkRate(int chunkLength, qint64 replyUsecs);
 
 private slots:
     void handlePutBytesMessage(const QByteArray &msg);
+    void watchConnected();
+    void watchDisconnected();
+    void resumeAfterReconnect();
+    void finishPreemption();
 
 private:
     WatchConnection *m_connection;
@@ -80,6 +150,29 @@ private:
     uint _lastUploadId;
     State _state;
     quint32 _token;
+    // The upload aborted for an interactive one, requeued once the watch confirmed the abort
+    uint m_preemptedId = 0;
+    QTimer *m_abortTimer;
+    bool m_largeChunks = false;
+    bool m_suspended = false;
+    // Payload of the chunk waiting for its ack, 0 if the outstanding request isn't a chunk
+    int m_chunkInFlight = 0;
+    // Smoothed rate at which the link moves chunk payload, not counting the round trip
+    qint64 m_linkBytesPerSec = 0;
+
+    QElapsedTimer m_requestSent;
+    MetricCounter *m_started;
+    MetricCounter *m_succeeded;
+    MetricCounter *m_failed;
+    MetricCounter *m_bytesSent;
+    MetricHistogram *m_replyTime;
+    MetricHistogram *m_throughput;
+    MetricCounter *m_resumed;
+    MetricCounter *m_crcMismatches;
+    MetricCounter *m_merged;
+    MetricCounter *m_preempted;
+    MetricHistogram *m_queueWait;
+    MetricGauge *m_chunkSize;
 };
 
 #endif // UPLOADMANAGER_H
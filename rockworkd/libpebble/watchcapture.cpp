@@ -0,0 +1,193 @@
+#include "watchcapture.h"
+#include "watchconnection.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QtEndian>
+
+// Written out once this much has been collected, or by the flush timer
+static const int FLUSH_SIZE = 64 * 1024;
+static const int FLUSH_INTERVAL = 1000;
+// Raw writes may carry several frames, anything beyond this is a corrupt record
+static const quint64 MAX_RECORD_LENGTH = 16 * 1024 * 1024;
+
+WatchCaptureWriter::WatchCaptureWriter(WatchConnection *connection, QObject *parent):
+    QObject(parent),
+    m_connection(connection)
+{
+    m_flushTimer.setInterval(FLUSH_INTERVAL);
+    connect(&m_flushTimer, &QTimer::timeout, this, &WatchCaptureWriter::flush);
+}
+
+WatchCaptureWriter::~WatchCaptureWriter()
+{
+    stop();
+}
+
+bool WatchCaptureWriter::start(const QString &fileName)
+{
+    stop();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Cannot open capture file" << fileName << m_file.errorString();
+        return false;
+    }
+
+    uchar startTime[8];
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), startTime);
+    m_buffer.reserve(FLUSH_SIZE + WatchFrameBuffer::MaxFrameLength + 32);
+    m_buffer.append(WatchCapture::Magic, WatchCapture::MagicLength);
+    m_buffer.append(WatchCapture::Version);
+    m_buffer.append(reinterpret_cast<const char *>(startTime), sizeof(startTime));
+    m_clock.start();
+    m_lastTimestamp = 0;
+    m_records = 0;
+
+    // Only connected while recording, the connection skips building raw messages nobody listens to
+    m_incomingConnection = connect(m_connection, &WatchConnection::rawIncomingMsg, this, &WatchCaptureWriter::incoming);
+    m_outgoingConnection = connect(m_connection, &WatchConnection::rawOutgoingMsg, this, &WatchCaptureWriter::outgoing);
+    m_flushTimer.start();
+    qDebug() << "Recording capture to" << fileName;
+    return true;
+}
+
+void WatchCaptureWriter::stop()
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    disconnect(m_incomingConnection);
+    disconnect(m_outgoingConnection);
+    m_flushTimer.stop();
+    flush();
+    m_file.close();
+    qDebug() << "Capture" << m_file.fileName() << "done," << m_records << "records";
+}
+
+bool WatchCaptureWriter::isRecording() const
+{
+    return m_file.isOpen();
+}
+
+void WatchCaptureWriter::incoming(QByteArray &frame)
+{
+    append(WatchCapture::DirectionIncoming, frame);
+}
+
+void WatchCaptureWriter::outgoing(QByteArray &frame)
+{
+    append(WatchCapture::DirectionOutgoing, frame);
+}
+
+void WatchCaptureWriter::append(WatchCapture::Direction direction, const QByteArray &frame)
+{
+    const quint64 timestamp = m_clock.nsecsElapsed() / 1000;
+    m_buffer.append(static_cast<char>(direction));
+    appendVarint(timestamp - m_lastTimestamp);
+    appendVarint(frame.length());
+    m_buffer.append(frame);
+    m_lastTimestamp = timestamp;
+    m_records++;
+
+    if (m_buffer.length() >= FLUSH_SIZE) {
+        flush();
+    }
+}
+
+void WatchCaptureWriter::appendVarint(quint64 value)
+{
+    while (value >= 0x80) {
+        m_buffer.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    m_buffer.append(static_cast<char>(value));
+}
+
+void WatchCaptureWriter::flush()
+{
+    if (m_buffer.isEmpty() || !m_file.isOpen()) {
+        return;
+    }
+    if (m_file.write(m_buffer) != m_buffer.length()) {
+        qWarning() << "Error writing capture file" << m_file.fileName() << m_file.errorString();
+    }
+    m_file.flush();
+    // Keeps the capacity, the next records don't allocate
+    m_buffer.resize(0);
+}
+
+bool WatchCaptureReader::open(const QString &fileName)
+{
+    close();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QFile::ReadOnly)) {
+        qWarning() << "Cannot open capture file" << fileName << m_file.errorString();
+        return false;
+    }
+
+    QByteArray header = m_file.read(WatchCapture::MagicLength + 1 + 8);
+    if (header.length() != WatchCapture::MagicLength + 1 + 8 || !header.startsWith(WatchCapture::Magic)) {
+        qWarning() << fileName << "is not a capture file";
+        m_file.close();
+        return false;
+    }
+    if (static_cast<quint8>(header.at(WatchCapture::MagicLength)) != WatchCapture::Version) {
+        qWarning() << "Unsupported capture version" << static_cast<quint8>(header.at(WatchCapture::MagicLength));
+        m_file.close();
+        return false;
+    }
+    m_startTime = qFromLittleEndian<qint64>(reinterpret_cast<const uchar *>(header.constData()) + WatchCapture::MagicLength + 1);
+    m_timestamp = 0;
+    return true;
+}
+
+void WatchCaptureReader::close()
+{
+    m_file.close();
+}
+
+QDateTime WatchCaptureReader::startTime() const
+{
+    return QDateTime::fromMSecsSinceEpoch(m_startTime);
+}
+
+bool WatchCaptureReader::readRecord(WatchCapture::Record *record)
+{
+    char direction;
+    quint64 delta;
+    quint64 length;
+    if (!m_file.getChar(&direction)) {
+        return false;
+    }
+    if (!readVarint(&delta) || !readVarint(&length) || length > MAX_RECORD_LENGTH) {
+        qWarning() << "Corrupt capture record in" << m_file.fileName() << "at" << m_file.pos();
+        return false;
+    }
+
+    record->direction = static_cast<WatchCapture::Direction>(direction);
+    record->frame = m_file.read(length);
+    if (record->frame.length() != static_cast<int>(length)) {
+        qWarning() << "Truncated capture record in" << m_file.fileName();
+        return false;
+    }
+    m_timestamp += delta;
+    record->timestamp = m_timestamp;
+    return true;
+}
+
+bool WatchCaptureReader::readVarint(quint64 *value)
+{
+    *value = 0;
+    char c;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (!m_file.getChar(&c)) {
+            return false;
+        }
+        *value |= static_cast<quint64>(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
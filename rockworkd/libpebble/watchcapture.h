@@ -0,0 +1,92 @@
+#ifndef WATCHCAPTURE_H
+#define WATCHCAPTURE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTimer>
+
+class WatchConnection;
+
+/*
+ * Capture file format, all integers little endian:
+ *
+ * File:   magic "RWCAP" (5 bytes), version (1 byte), start time (8 bytes, ms since epoch)
+ * Record: direction (1 byte, see Direction)
+ *         delta (varint, microseconds since the previous record)
+ *         length (varint)
+ *         frame (length bytes, header included)
+ *
+ * Varints are LEB128: 7 bits per byte, least significant group first, high bit set on all but the last.
+ */
+namespace WatchCapture {
+    enum Direction {
+        DirectionIncoming = 0, // Watch to phone
+        DirectionOutgoing = 1  // Phone to watch
+    };
+
+    struct Record {
+        Direction direction = DirectionIncoming;
+        quint64 timestamp = 0; // microseconds since the start of the capture
+        QByteArray frame;
+    };
+
+    static const char Magic[] = "RWCAP";
+    static const int MagicLength = 5;
+    static const quint8 Version = 1;
+}
+
+// Records everything going over a WatchConnection while started. Records are collected in memory
+// and written out in large chunks, so recording costs about an append per frame.
+class WatchCaptureWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WatchCaptureWriter(WatchConnection *connection, QObject *parent = 0);
+    ~WatchCaptureWriter();
+
+    bool start(const QString &fileName);
+    void stop();
+    bool isRecording() const;
+
+private slots:
+    void incoming(QByteArray &frame);
+    void outgoing(QByteArray &frame);
+    void flush();
+
+private:
+    void append(WatchCapture::Direction direction, const QByteArray &frame);
+    void appendVarint(quint64 value);
+
+    WatchConnection *m_connection;
+    QMetaObject::Connection m_incomingConnection;
+    QMetaObject::Connection m_outgoingConnection;
+    QFile m_file;
+    QByteArray m_buffer;
+    QElapsedTimer m_clock;
+    quint64 m_lastTimestamp = 0;
+    quint64 m_records = 0;
+    QTimer m_flushTimer;
+};
+
+class WatchCaptureReader
+{
+public:
+    bool open(const QString &fileName);
+    void close();
+
+    QDateTime startTime() const;
+    // Returns false at the end of the file or on a truncated record
+    bool readRecord(WatchCapture::Record *record);
+
+private:
+    bool readVarint(quint64 *value);
+
+    QFile m_file;
+    qint64 m_startTime = 0;
+    quint64 m_timestamp = 0;
+};
+
+#endif // WATCHCAPTURE_H
@@ -0,0 +1,132 @@
+#include "watchcapturereplay.h"
+#include "watchconnection.h"
+#include "watchframebuffer.h"
+
+#include <QDebug>
+#include <QtEndian>
+
+// Frames delivered per event loop iteration when replaying as fast as possible.
+// Returning to the loop in between lets queued work triggered by the handlers run.
+static const int REPLAY_BATCH = 64;
+
+WatchCaptureReplay::WatchCaptureReplay(WatchConnection *connection, QObject *parent):
+    QObject(parent),
+    m_connection(connection)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &WatchCaptureReplay::replayNext);
+    // The handlers would answer the watch that just came in
+    connect(m_connection, &WatchConnection::watchConnected, this, &WatchCaptureReplay::stop);
+}
+
+bool WatchCaptureReplay::start(const QString &fileName, Speed speed)
+{
+    stop();
+    if (m_connection->isConnected()) {
+        qWarning() << "Not replaying" << fileName << "while a watch is connected";
+        return false;
+    }
+    if (!m_reader.open(fileName)) {
+        return false;
+    }
+    qDebug() << "Replaying capture" << fileName << "recorded" << m_reader.startTime().toString(Qt::ISODate);
+
+    m_speed = speed;
+    m_stats = Stats();
+    m_running = true;
+    m_connection->setReplaying(true);
+    m_havePending = readNextIncoming();
+    m_firstTimestamp = m_pending.timestamp;
+    m_clock.start();
+    m_timer.start(0);
+    return true;
+}
+
+void WatchCaptureReplay::stop()
+{
+    if (m_running) {
+        finish();
+    }
+}
+
+bool WatchCaptureReplay::isRunning() const
+{
+    return m_running;
+}
+
+const WatchCaptureReplay::Stats &WatchCaptureReplay::stats() const
+{
+    return m_stats;
+}
+
+void WatchCaptureReplay::replayNext()
+{
+    if (m_speed == SpeedAsFastAsPossible) {
+        for (int i = 0; i < REPLAY_BATCH && m_havePending && m_running; i++) {
+            deliver();
+        }
+    } else {
+        while (m_havePending && m_running) {
+            const qint64 due = (m_pending.timestamp - m_firstTimestamp) / 1000;
+            const qint64 now = m_clock.elapsed();
+            if (due > now) {
+                m_timer.start(due - now);
+                return;
+            }
+            deliver();
+        }
+    }
+
+    if (!m_running) {
+        return;
+    }
+    if (!m_havePending) {
+        finish();
+        return;
+    }
+    m_timer.start(0);
+}
+
+bool WatchCaptureReplay::readNextIncoming()
+{
+    while (m_reader.readRecord(&m_pending)) {
+        if (m_pending.direction != WatchCapture::DirectionIncoming) {
+            continue;
+        }
+        // The version reply would pass the captured watch off as ours, its identity ending up in
+        // watchinfo.conf and an app sync started for it
+        if (m_pending.frame.length() >= WatchFrameBuffer::HeaderLength
+                && qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(m_pending.frame.constData()) + 2) == WatchConnection::EndpointVersion) {
+            m_stats.skipped++;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+void WatchCaptureReplay::deliver()
+{
+    QElapsedTimer handlerClock;
+    handlerClock.start();
+    m_connection->injectIncomingFrame(m_pending.frame);
+    m_stats.handlerTime += handlerClock.nsecsElapsed();
+    m_stats.frames++;
+    m_stats.bytes += m_pending.frame.length();
+
+    m_havePending = readNextIncoming();
+}
+
+void WatchCaptureReplay::finish()
+{
+    m_timer.stop();
+    m_reader.close();
+    m_running = false;
+    m_connection->setReplaying(false);
+    m_havePending = false;
+    m_stats.wallTime = m_clock.nsecsElapsed();
+
+    qDebug() << "Replayed" << m_stats.frames << "frames, skipped" << m_stats.skipped << "version replies," << m_stats.bytes << "bytes in" << m_stats.wallTime / 1000000 << "ms,"
+             << (m_stats.frames ? m_stats.handlerTime / m_stats.frames : 0) << "ns per frame in handlers";
+    emit finished();
+}
@@ -0,0 +1,62 @@
+#ifndef WATCHCAPTUREREPLAY_H
+#define WATCHCAPTUREREPLAY_H
+
+#include "watchcapture.h"
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+class WatchConnection;
+
+// Feeds the incoming frames of a capture to a WatchConnection's endpoint handlers.
+// Outgoing records are skipped, the handlers produce their own replies. Replays only run while no
+// watch is connected, the replies would go to it. The connection discards them quietly meanwhile.
+class WatchCaptureReplay : public QObject
+{
+    Q_OBJECT
+public:
+    enum Speed {
+        SpeedOriginal,       // Keep the recorded gaps between frames
+        SpeedAsFastAsPossible
+    };
+
+    struct Stats {
+        quint64 frames = 0;
+        quint64 bytes = 0;
+        quint64 skipped = 0; // version replies, not replayed
+        qint64 handlerTime = 0; // nanoseconds spent in endpoint handlers
+        qint64 wallTime = 0;    // nanoseconds from start to finish
+    };
+
+    explicit WatchCaptureReplay(WatchConnection *connection, QObject *parent = 0);
+
+    bool start(const QString &fileName, Speed speed);
+    void stop();
+    bool isRunning() const;
+    const Stats &stats() const;
+
+signals:
+    void finished();
+
+private slots:
+    void replayNext();
+
+private:
+    bool readNextIncoming();
+    void deliver();
+    void finish();
+
+    WatchConnection *m_connection;
+    WatchCaptureReader m_reader;
+    Speed m_speed = SpeedOriginal;
+    bool m_running = false;
+    bool m_havePending = false;
+    WatchCapture::Record m_pending;
+    quint64 m_firstTimestamp = 0;
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+    Stats m_stats;
+};
+
+#endif // WATCHCAPTUREREPLAY_H
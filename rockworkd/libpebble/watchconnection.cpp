@@ -1,124 +1,322 @@
 #include "watchconnection.h"
+#include "packetcodec.h"
 #include "watchdatareader.h"
 #include "watchdatawriter.h"
 #include "uploadmanager.h"
+#include "linkprobe.h"
+#include "metricsregistry.h"
+#include "tracing.h"
 
 #include <QDBusConnection>
 #include <QDBusReply>
 #include <QDebug>
 #include <QBluetoothAddress>
-#include <QBluetoothLocalDevice>
-#include <QBluetoothSocket>
 #include <QtEndian>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QMetaMethod>
+
+static const int DEFAULT_DEFER_WINDOW = 2000;
+// Held frames are written early rather than let a busy producer pile them up
+static const int MAX_DEFERRED = 32;
+// How long the link is taken to stay awake after the watch was last heard from. Deferring a write
+// in that time would only put it off to another wakeup.
+static const int LINK_AWAKE_MSECS = 250;
 
 WatchConnection::WatchConnection(QObject *parent) :
     QObject(parent),
-    m_socket(nullptr)
+    m_deferTimer(new QTimer(this))
 {
-    m_reconnectTimer.setSingleShot(true);
-    QObject::connect(&m_reconnectTimer, &QTimer::timeout, this, &WatchConnection::reconnect);
-
-    m_localDevice = new QBluetoothLocalDevice(this);
-    connect(m_localDevice, &QBluetoothLocalDevice::hostModeStateChanged, this, &WatchConnection::hostModeStateChanged);
+    qRegisterMetaType<WatchTransport*>("WatchTransport*");
+
+    m_metrics = new MetricsRegistry(this);
+    m_unhandledFrames = m_metrics->counter("connection.unhandledFrames");
+    m_droppedFrames = m_metrics->counter("connection.droppedFrames");
+    m_deferredFrames = m_metrics->counter("coalesce.deferredFrames");
+    m_supersededFrames = m_metrics->counter("coalesce.supersededFrames");
+    m_deferredBatches = m_metrics->counter("coalesce.batches");
+    m_earlyFlushes = m_metrics->counter("coalesce.earlyFlushes");
+    m_wakeupsSaved = m_metrics->counter("coalesce.wakeupsSaved");
+
+    m_deferTimer->setSingleShot(true);
+    m_deferTimer->setInterval(DEFAULT_DEFER_WINDOW);
+    connect(m_deferTimer, &QTimer::timeout, this, &WatchConnection::deferWindowExpired);
+
+    // The worker and everything it creates live on the I/O thread, see WatchIoWorker
+    m_worker = new WatchIoWorker(PriorityCount);
+    m_worker->moveToThread(&m_ioThread);
+    connect(&m_ioThread, &QThread::finished, m_worker, &QObject::deleteLater);
+    connect(m_worker, &WatchIoWorker::connected, this, &WatchConnection::pebbleConnected);
+    connect(m_worker, &WatchIoWorker::disconnected, this, &WatchConnection::pebbleDisconnected);
+    connect(m_worker, &WatchIoWorker::connectionFailed, this, &WatchConnection::watchConnectionFailed);
+    connect(m_worker, &WatchIoWorker::incomingAvailable, this, &WatchConnection::drainIncoming);
+    m_ioThread.setObjectName("WatchConnection I/O");
+    m_ioThread.start();
+
+    static const char *const priorityNames[PriorityCount] = { "urgent", "interactive", "normal", "bulk" };
+    for (int i = 0; i < PriorityCount; i++) {
+        m_metrics->sampledGauge(QString("connection.queueDepth.") + priorityNames[i], this, [this, i]() {
+            return qint64(m_worker->queueDepth(i));
+        });
+    }
+    m_metrics->sampledGauge("connection.bytesInFlight", this, [this]() {
+        return m_worker->bytesInFlight();
+    });
 
+    m_linkProbe = new LinkProbe(this, this);
     m_uploadManager = new UploadManager(this, this);
 }
 
+WatchConnection::~WatchConnection()
+{
+    // The worker, and with it the transport, is deleted on the I/O thread once its loop has quit
+    m_ioThread.quit();
+    m_ioThread.wait();
+}
+
 UploadManager *WatchConnection::uploadManager() const
 {
     return m_uploadManager;
 }
 
-void WatchConnection::scheduleReconnect()
+LinkProbe *WatchConnection::linkProbe() const
 {
-    if (m_connectionAttempts == 0) {
-        reconnect();
-    } else if (m_connectionAttempts < 25) {
-        qDebug() << "Attempting to reconnect in 10 seconds";
-        m_reconnectTimer.start(1000 * 10);
-    } else if (m_connectionAttempts < 35) {
-        qDebug() << "Attempting to reconnect in 1 minute";
-        m_reconnectTimer.start(1000 * 60);
-    } else {
-        qDebug() << "Attempting to reconnect in 5 minutes";
-        m_reconnectTimer.start(1000 * 60 * 5);
-    }
+    return m_linkProbe;
 }
 
-void WatchConnection::reconnect()
+MetricsRegistry *WatchConnection::metrics() const
 {
-    QBluetoothLocalDevice localBtDev;
-    if (localBtDev.hostMode() == QBluetoothLocalDevice::HostPoweredOff) {
-        qDebug() << "Bluetooth powered off. Ceasing connection attempts";
-        if (m_reconnectTimer.isActive()) m_reconnectTimer.stop();
-        return;
-    }
-    if (localBtDev.pairingStatus(m_pebbleAddress) == QBluetoothLocalDevice::Unpaired) {
-        // Try again in one 10 secs, give the user some time to pair it
-        m_connectionAttempts = 1;
-        scheduleReconnect();
-        return;
-    }
+    return m_metrics;
+}
 
-    if (m_socket) {
-        if (m_socket->state() == QBluetoothSocket::ConnectedState) {
-            qDebug() << "Already connected.";
-            return;
-        }
-        delete m_socket;
+void WatchConnection::setTransport(WatchTransport *transport)
+{
+    if (transport) {
+        transport->moveToThread(&m_ioThread);
     }
+    m_transport = transport;
+    QMetaObject::invokeMethod(m_worker, "setTransport", Qt::QueuedConnection, Q_ARG(WatchTransport*, transport));
+}
 
-    m_socket = new QBluetoothSocket(QBluetoothServiceInfo::RfcommProtocol, this);
-    connect(m_socket, &QBluetoothSocket::connected, this, &WatchConnection::pebbleConnected);
-    connect(m_socket, &QBluetoothSocket::readyRead, this, &WatchConnection::readyRead);
-    connect(m_socket, SIGNAL(error(QBluetoothSocket::SocketError)), this, SLOT(socketError(QBluetoothSocket::SocketError)));
-    connect(m_socket, &QBluetoothSocket::disconnected, this, &WatchConnection::pebbleDisconnected);
-    //connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(onBytesWritten(qint64)));
-
-    m_connectionAttempts++;
-
-    // FIXME: Assuming port 1 (with Pebble)
-    m_socket->connectToService(m_pebbleAddress, 1);
+WatchTransport *WatchConnection::transport() const
+{
+    return m_transport;
 }
 
 void WatchConnection::connectPebble(const QBluetoothAddress &pebble)
 {
     m_pebbleAddress = pebble;
-    m_connectionAttempts = 0;
-    scheduleReconnect();
+    if (!m_transport) {
+        setTransport(WatchTransport::create("rfcomm", pebble));
+    }
+    QMetaObject::invokeMethod(m_worker, "connectPebble", Qt::QueuedConnection);
 }
 
 bool WatchConnection::isConnected()
 {
-    return m_socket && m_socket->state() == QBluetoothSocket::ConnectedState;
+    return m_connected;
 }
 
 void WatchConnection::writeToPebble(Endpoint endpoint, const QByteArray &data)
 {
-    if (!m_socket || m_socket->state() != QBluetoothSocket::ConnectedState) {
+    if (!isConnected()) {
+        if (m_replaying) {
+            // Replies of the handlers a capture is replayed into, there is no watch to take them
+            return;
+        }
         qWarning() << "Socket not open. Cannot send data to Pebble. (Endpoint:" << endpoint << ")";
+        m_droppedFrames->add();
         return;
     }
 
     //qDebug() << "sending message to endpoint" << endpoint;
-    QByteArray msg;
+    if (!m_deferred.isEmpty()) {
+        // The link wakes up for this one anyway, take the held frames along
+        writeDeferred(true);
+    }
+    post(endpointPriority(endpoint), endpoint, false, data);
+}
 
-    msg.append((data.length() & 0xFF00) >> 8);
-    msg.append(data.length() & 0xFF);
+void WatchConnection::deferToPebble(Endpoint endpoint, const QByteArray &data, int supersedeKey)
+{
+    if (!isConnected()) {
+        if (m_replaying) {
+            // Replies of the handlers a capture is replayed into, there is no watch to take them
+            return;
+        }
+        qWarning() << "Socket not open. Cannot send data to Pebble. (Endpoint:" << endpoint << ")";
+        m_droppedFrames->add();
+        return;
+    }
+    if (m_deferTimer->interval() == 0 || (m_lastIncoming.isValid() && m_lastIncoming.elapsed() < LINK_AWAKE_MSECS)) {
+        // Such as the next of a run of commands, sent from the handler of the reply to the previous one
+        post(endpointPriority(endpoint), endpoint, false, data);
+        return;
+    }
 
-    msg.append((endpoint & 0xFF00) >> 8);
-    msg.append(endpoint & 0xFF);
+    m_deferredFrames->add();
+    m_deferredWrites++;
+    if (supersedeKey >= 0) {
+        for (int i = 0; i < m_deferred.count(); i++) {
+            DeferredFrame &pending = m_deferred[i];
+            if (pending.endpoint == endpoint && pending.supersedeKey == supersedeKey) {
+                pending.data = data;
+                m_supersededFrames->add();
+                return;
+            }
+        }
+    }
+    DeferredFrame frame;
+    frame.endpoint = endpoint;
+    frame.supersedeKey = supersedeKey;
+    frame.data = data;
+    m_deferred.append(frame);
+    TRACE_COUNTER("connection", "deferred", m_deferred.count());
+
+    if (m_deferred.count() >= MAX_DEFERRED) {
+        writeDeferred(false);
+    } else if (!m_deferTimer->isActive()) {
+        m_deferTimer->start();
+    }
+}
 
-    msg.append(data);
-    writeRawData(msg);
-    emit rawOutgoingMsg(msg);
+void WatchConnection::flushDeferred()
+{
+    if (!m_deferred.isEmpty()) {
+        writeDeferred(true);
+    }
+}
+
+void WatchConnection::setDeferWindow(int msecs)
+{
+    m_deferTimer->setInterval(qMax(0, msecs));
+    if (msecs <= 0) {
+        flushDeferred();
+    }
+}
+
+int WatchConnection::deferWindow() const
+{
+    return m_deferTimer->interval();
+}
+
+void WatchConnection::writeDeferred(bool early)
+{
+    m_deferTimer->stop();
+    // Without coalescing every deferred write would have woken the link on its own
+    m_deferredBatches->add();
+    if (early) {
+        m_earlyFlushes->add();
+        m_wakeupsSaved->add(m_deferredWrites);
+    } else {
+        m_wakeupsSaved->add(m_deferredWrites - 1);
+    }
+    TRACE_EVENT1("connection", "flushDeferred", "frames", m_deferred.count());
+
+    // Taken first, post() may be reentered through rawOutgoingMsg
+    const QList<DeferredFrame> frames = m_deferred;
+    m_deferred.clear();
+    m_deferredWrites = 0;
+    TRACE_COUNTER("connection", "deferred", 0);
+    foreach (const DeferredFrame &frame, frames) {
+        post(endpointPriority(frame.endpoint), frame.endpoint, false, frame.data);
+    }
+}
+
+void WatchConnection::deferWindowExpired()
+{
+    if (!m_deferred.isEmpty()) {
+        writeDeferred(false);
+    }
 }
 
 void WatchConnection::writeRawData(const QByteArray &msg)
 {
     //qDebug() << "Writing:" << msg.toHex();
-    m_socket->write(msg);
+    if (!isConnected()) {
+        if (m_replaying) {
+            // Replies of the handlers a capture is replayed into, there is no watch to take them
+            return;
+        }
+        qWarning() << "Socket not open. Cannot send raw data to Pebble.";
+        m_droppedFrames->add();
+        return;
+    }
+    post(PriorityNormal, EndpointUnknownEndpoint, true, msg);
+}
+
+void WatchConnection::post(Priority priority, quint16 endpoint, bool framed, const QByteArray &data)
+{
+    // Reported when handed to the I/O thread, which writes it out in priority order
+    if (isSignalConnected(QMetaMethod::fromSignal(&WatchConnection::rawOutgoingMsg))) {
+        QByteArray msg;
+        if (!framed) {
+            uchar header[WatchFrameBuffer::HeaderLength];
+            qToBigEndian<quint16>(data.length(), &header[0]);
+            qToBigEndian<quint16>(endpoint, &header[2]);
+            msg.reserve(WatchFrameBuffer::HeaderLength + data.length());
+            msg.append(reinterpret_cast<const char *>(header), WatchFrameBuffer::HeaderLength);
+        }
+        msg.append(data);
+        emit rawOutgoingMsg(msg);
+    }
+
+    if (framed) {
+        // Raw writes carry their own headers, counted by the endpoint in them. A write may hold several
+        // frames, the last one cut short by the writer is counted with what it has.
+        int offset = 0;
+        while (offset + WatchFrameBuffer::HeaderLength <= data.length()) {
+            const uchar *header = reinterpret_cast<const uchar *>(data.constData()) + offset;
+            const int length = qFromBigEndian<quint16>(header);
+            const EndpointMetrics &metrics = endpointMetrics(qFromBigEndian<quint16>(header + 2));
+            metrics.txFrames->add();
+            metrics.txBytes->add(qMin(length, data.length() - offset - WatchFrameBuffer::HeaderLength));
+            offset += WatchFrameBuffer::HeaderLength + length;
+        }
+    } else {
+        const EndpointMetrics &metrics = endpointMetrics(endpoint);
+        metrics.txFrames->add();
+        metrics.txBytes->add(data.length());
+    }
+
+    WatchIoWorker::OutgoingFrame frame;
+    frame.priority = priority;
+    frame.endpoint = endpoint;
+    frame.framed = framed;
+    frame.data = data;
+    m_worker->post(frame);
+}
+
+WatchConnection::Priority WatchConnection::endpointPriority(Endpoint endpoint)
+{
+    switch (endpoint) {
+    case EndpointPhoneControl:
+    case EndpointPhoneVersion:
+    case EndpointWatchPing: // Queueing would count towards the measured round trip
+        return PriorityUrgent;
+    case EndpointNotification:
+    case EndpointMusicControl:
+    case EndpointApplicationMessage:
+    case EndpointLauncher:
+    case EndpointAppLaunch:
+    case EndpointActionHandler:
+    case EndpointAppFetch:
+        return PriorityInteractive;
+    case EndpointPutBytes:
+        return PriorityBulk;
+    default:
+        return PriorityNormal;
+    }
+}
+
+int WatchConnection::queueDepth(Priority priority) const
+{
+    return m_worker->queueDepth(priority);
+}
+
+qint64 WatchConnection::bytesInFlight() const
+{
+    return m_worker->bytesInFlight();
 }
 
 void WatchConnection::systemMessage(WatchConnection::SystemMessage msg)
@@ -129,120 +327,139 @@ void WatchConnection::systemMessage(WatchConnection::SystemMessage msg)
     writeToPebble(EndpointSystemMessage, data);
 }
 
-bool WatchConnection::registerEndpointHandler(WatchConnection::Endpoint endpoint, QObject *handler, const QString &method)
+bool WatchConnection::registerEndpointHandler(WatchConnection::Endpoint endpoint, QObject *receiver, const EndpointHandler &handler)
 {
-    if (m_endpointHandlers.contains(endpoint)) {
+    if (m_handlerSlots[endpoint] != 0) {
         qWarning() << "Already have a handlder for endpoint" << endpoint;
         return false;
     }
-    Callback cb;
-    cb.obj = handler;
-    cb.method = method;
-    m_endpointHandlers.insert(endpoint, cb);
+    if (m_handlers.size() == 0xFF) {
+        qWarning() << "Too many endpoint handlers, cannot register endpoint" << endpoint;
+        return false;
+    }
+    HandlerEntry entry;
+    entry.receiver = receiver;
+    entry.handler = handler;
+    m_handlers.append(entry);
+    m_handlerSlots[endpoint] = m_handlers.size();
     return true;
 }
 
+WatchFrameBuffer::Stats WatchConnection::receiveStats() const
+{
+    return m_worker->receiveStats();
+}
+
+WatchIoWorker::ReconnectStats WatchConnection::reconnectStats() const
+{
+    return m_worker->reconnectStats();
+}
+
+void WatchConnection::setReplaying(bool replaying)
+{
+    m_replaying = replaying;
+}
+
+void WatchConnection::injectIncomingFrame(const QByteArray &frame)
+{
+    if (frame.length() < WatchFrameBuffer::HeaderLength
+            || qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(frame.constData())) != frame.length() - WatchFrameBuffer::HeaderLength) {
+        qWarning() << "Ignoring malformed frame" << frame.left(16).toHex();
+        return;
+    }
+    WatchIoWorker::IncomingFrame incoming;
+    incoming.endpoint = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(frame.constData()) + 2);
+    incoming.data = frame;
+    handleFrame(incoming);
+}
+
 void WatchConnection::pebbleConnected()
 {
-    m_connectionAttempts = 0;
+    m_connected = true;
     emit watchConnected();
 }
 
 void WatchConnection::pebbleDisconnected()
 {
-    qDebug() << "Disconnected";
+    m_connected = false;
+    m_lastIncoming.invalidate();
+    m_deferTimer->stop();
+    m_droppedFrames->add(m_deferred.count());
+    m_deferred.clear();
+    m_deferredWrites = 0;
     emit watchDisconnected();
-    if (!m_reconnectTimer.isActive()) {
-        scheduleReconnect();
-    }
 }
 
-void WatchConnection::socketError(QBluetoothSocket::SocketError error)
+void WatchConnection::drainIncoming()
 {
-    Q_UNUSED(error); // We seem to get UnknownError anyways all the time
-    qDebug() << "SocketError" << error;
-    m_socket->close();
-    emit watchConnectionFailed();
-    if (!m_reconnectTimer.isActive()) {
-        scheduleReconnect();
+    m_worker->incomingTaken();
+    m_lastIncoming.start();
+    if (!m_deferred.isEmpty()) {
+        // The watch just talked to us, the link is awake
+        writeDeferred(true);
+    }
+    WatchIoWorker::IncomingFrame frame;
+    while (m_worker->takeIncoming(&frame)) {
+        handleFrame(frame);
     }
 }
 
-void WatchConnection::readyRead()
+void WatchConnection::handleFrame(const WatchIoWorker::IncomingFrame &frame)
 {
-//    QByteArray data = m_socket->readAll();
-//    qDebug() << "data from pebble" << data.toHex();
-
-//    QByteArray header = data.left(4);
-//    qDebug() << "header:" << header.toHex();
-    if (!m_socket) {
-        return;
+    if (isSignalConnected(QMetaMethod::fromSignal(&WatchConnection::rawIncomingMsg))) {
+        QByteArray msg = frame.data;
+        emit rawIncomingMsg(msg);
     }
-    int headerLength = 4;
-    uchar header[4];
-    m_socket->peek(reinterpret_cast<char*>(header), headerLength);
 
-    quint16 messageLength = qFromBigEndian<quint16>(&header[0]);
-    Endpoint endpoint = (Endpoint)qFromBigEndian<quint16>(&header[2]);
-
-    if (m_socket->bytesAvailable() < headerLength + messageLength) {
-//        qDebug() << "not enough data... waiting for more";
-        return;
-    }
-
-    QByteArray data = m_socket->read(headerLength + messageLength);
+    Endpoint endpoint = (Endpoint)frame.endpoint;
+    // Points into the frame, no copy involved
+    QByteArray data = QByteArray::fromRawData(frame.data.constData() + WatchFrameBuffer::HeaderLength,
+                                              frame.data.length() - WatchFrameBuffer::HeaderLength);
 //    qDebug() << "Have message for endpoint:" << endpoint << "data:" << data.toHex();
-    emit rawIncomingMsg(data);
-
-    data = data.right(data.length() - 4);
 
-    if (m_endpointHandlers.contains(endpoint)) {
-        if (m_endpointHandlers.contains(endpoint)) {
-            Callback cb = m_endpointHandlers.value(endpoint);
-            QMetaObject::invokeMethod(cb.obj.data(), cb.method.toLatin1(), Q_ARG(QByteArray, data));
+    // A copy, the handler may add endpoints to the table
+    const EndpointMetrics metrics = endpointMetrics(frame.endpoint);
+    metrics.rxFrames->add();
+    metrics.rxBytes->add(data.length());
+
+    const quint8 slot = m_handlerSlots[frame.endpoint];
+    if (slot != 0) {
+        const HandlerEntry &entry = m_handlers.at(slot - 1);
+        if (entry.receiver) {
+            TRACE_SPAN1("endpoint", "handle", "endpoint", frame.endpoint);
+            QElapsedTimer timer;
+            timer.start();
+            entry.handler(data);
+            metrics.handlerTime->record(timer.nsecsElapsed() / 1000);
         }
     } else {
         qWarning() << "Have message for unhandled endpoint" << endpoint << data.toHex();
-    }
-
-    if (m_socket->bytesAvailable() > 0) {
-        readyRead();
+        m_unhandledFrames->add();
     }
 }
 
-void WatchConnection::hostModeStateChanged(QBluetoothLocalDevice::HostMode state)
+WatchConnection::EndpointMetrics &WatchConnection::endpointMetrics(quint16 endpoint)
 {
-    qDebug() << "Bluetooth host changed state:" << state;
-    if (state == QBluetoothLocalDevice::HostPoweredOff)
-    {
-        qDebug() << "Bluetooth turned off. Stopping any reconnect attempts.";
-        m_reconnectTimer.stop();
-    }
-    else if (!isConnected() && !m_reconnectTimer.isActive())
-    {
-        qDebug() << "Bluetooth now active. Trying to reconnect";
-        m_connectionAttempts = 0;
-        scheduleReconnect();
+    QHash<quint16, EndpointMetrics>::iterator it = m_endpointMetrics.find(endpoint);
+    if (it == m_endpointMetrics.end()) {
+        const QString prefix = "endpoint." + QString::number(endpoint) + ".";
+        EndpointMetrics metrics;
+        metrics.rxFrames = m_metrics->counter(prefix + "rxFrames");
+        metrics.rxBytes = m_metrics->counter(prefix + "rxBytes");
+        metrics.txFrames = m_metrics->counter(prefix + "txFrames");
+        metrics.txBytes = m_metrics->counter(prefix + "txBytes");
+        metrics.handlerTime = m_metrics->histogram(prefix + "handlerUsecs");
+        it = m_endpointMetrics.insert(endpoint, metrics);
     }
+    return it.value();
 }
 
 QByteArray WatchConnection::buildData(QStringList data)
 {
-    QByteArray res;
-    for (QString d : data)
-    {
-        QByteArray tmp = d.left(0xEF).toUtf8();
-        res.append((tmp.length() + 1) & 0xFF);
-        res.append(tmp);
-        res.append('\0');
-    }
-    return res;
+    return PacketCodec::buildData(data);
 }
 
 QByteArray WatchConnection::buildMessageData(uint lead, QStringList data)
 {
-    QByteArray res;
-    res.append(lead & 0xFF);
-    res.append(buildData(data));
-    return res;
+    return PacketCodec::buildMessageData(lead, data);
 }
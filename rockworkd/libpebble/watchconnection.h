@@ -1,40 +1,50 @@
 #ifndef WATCHCONNECTION_H
 #define WATCHCONNECTION_H
 
+#include <functional>
 #include <QObject>
 #include <QBluetoothAddress>
-#include <QBluetoothSocket>
-#include <QBluetoothLocalDevice>
 #include <QtEndian>
 #include <QPointer>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
+#include <QThread>
+#include <QVector>
+
+#include "watchdatawriter.h"
+#include "watchframebuffer.h"
+#include "watchioworker.h"
+#include "watchtransport.h"
 
 class EndpointHandlerInterface;
+class LinkProbe;
+class MetricCounter;
+class MetricHistogram;
+class MetricsRegistry;
 class UploadManager;
 
 class PebblePacket {
 public:
     PebblePacket() {}
     virtual ~PebblePacket() = default;
-    virtual QByteArray serialize() const = 0;
-    QByteArray packString(const QString &string) const {
-        QByteArray tmp = string.left(0xEF).toUtf8();
-        QByteArray ret;
-        ret.append((tmp.length() + 1) & 0xFF);
-        ret.append(tmp);
-        ret.append('\0');
+    // Exact number of bytes writeTo() produces
+    virtual int serializedSize() const = 0;
+    virtual void writeTo(WatchDataWriter &writer) const = 0;
+    QByteArray serialize() const {
+        const int size = serializedSize();
+        QByteArray ret(size, Qt::Uninitialized);
+        WatchDataWriter writer(&ret, 0);
+        writeTo(writer);
+        if (writer.offset() != size) {
+            qWarning("Packet size mismatch, expected %d wrote %d", size, writer.offset());
+            ret.resize(writer.offset());
+        }
         return ret;
     }
 };
 
-class Callback
-{
-public:
-    QPointer<QObject> obj;
-    QString method;
-};
-
 class WatchConnection : public QObject
 {
     Q_OBJECT
@@ -52,7 +62,7 @@ public:
         EndpointLauncher = 49,
         EndpointAppLaunch = 52,
         EndpointWatchLogs = 2000,
-//        EndpointWatchPing = 2001,
+        EndpointWatchPing = 2001,
         EndpointLogDump = 2002,
 //        EndpointWatchReset = 2003,
 //        EndpointWatchApp = 2004,
@@ -108,20 +118,65 @@ public:
         UploadStatusSuccess
     };
 
+    // Outgoing frames are queued per class and the most urgent class is always written first
+    enum Priority {
+        PriorityUrgent,      // Phone control, must never wait behind anything else
+        PriorityInteractive, // The user is looking at the watch: notifications, music, app messages
+        PriorityNormal,
+        PriorityBulk,        // PutBytes transfers
+        PriorityCount
+    };
+
     explicit WatchConnection(QObject *parent = 0);
+    ~WatchConnection();
     UploadManager *uploadManager() const;
+    LinkProbe *linkProbe() const;
+    MetricsRegistry *metrics() const;
+
+    // Takes ownership and moves the transport to the I/O thread, it must not have a parent.
+    // Without a transport connectPebble() goes through RFCOMM.
+    void setTransport(WatchTransport *transport);
+    // Lives on the I/O thread, only connect to its signals
+    WatchTransport *transport() const;
 
     void connectPebble(const QBluetoothAddress &pebble);
     bool isConnected();
 
-    QByteArray buildData(QStringList data);
-    QByteArray buildMessageData(uint lead, QStringList data);
+    static QByteArray buildData(QStringList data);
+    static QByteArray buildMessageData(uint lead, QStringList data);
 
     void writeRawData(const QByteArray &data);
     void writeToPebble(Endpoint endpoint, const QByteArray &data);
+    // For traffic that may wait: held for up to deferWindow() and written together with everything else
+    // deferred meanwhile, or right away once another write or an incoming frame wakes the link anyway.
+    // Written at once while the link is still awake from an incoming frame.
+    // A pending frame with the same endpoint and supersedeKey (>= 0) is replaced instead of sent.
+    void deferToPebble(Endpoint endpoint, const QByteArray &data, int supersedeKey = -1);
+    void flushDeferred();
+    // Milliseconds, 0 writes deferrable frames immediately
+    void setDeferWindow(int msecs);
+    int deferWindow() const;
     void systemMessage(SystemMessage msg);
 
-    bool registerEndpointHandler(Endpoint endpoint, QObject *handler, const QString &method);
+    static Priority endpointPriority(Endpoint endpoint);
+    int queueDepth(Priority priority) const;
+    qint64 bytesInFlight() const;
+
+    // Handlers run on the main thread. They are called with a non-owning view into the received frame,
+    // it is only valid for the duration of the call, copy it if you need to keep it.
+    // Handlers are dropped silently once their receiver is destroyed.
+    typedef std::function<void(const QByteArray &)> EndpointHandler;
+    bool registerEndpointHandler(Endpoint endpoint, QObject *receiver, const EndpointHandler &handler);
+    template <typename T>
+    bool registerEndpointHandler(Endpoint endpoint, T *receiver, void (T::*method)(const QByteArray &));
+
+    WatchFrameBuffer::Stats receiveStats() const;
+    WatchIoWorker::ReconnectStats reconnectStats() const;
+
+    // Dispatches a complete frame, header included, as if the watch had sent it. Used to replay captures.
+    void injectIncomingFrame(const QByteArray &frame);
+    // While no watch is connected, writes are discarded without a warning and not counted as dropped
+    void setReplaying(bool replaying);
 
 signals:
     void watchConnected();
@@ -132,27 +187,73 @@ signals:
     void rawIncomingMsg(QByteArray &msg);
 
 private:
-    void scheduleReconnect();
-    void reconnect();
+    void post(Priority priority, quint16 endpoint, bool framed, const QByteArray &data);
+    void writeDeferred(bool early);
+    void handleFrame(const WatchIoWorker::IncomingFrame &frame);
+
+    struct EndpointMetrics {
+        MetricCounter *rxFrames;
+        MetricCounter *rxBytes;
+        MetricCounter *txFrames;
+        MetricCounter *txBytes;
+        MetricHistogram *handlerTime;
+    };
+    EndpointMetrics &endpointMetrics(quint16 endpoint);
 
 private slots:
-    void hostModeStateChanged(QBluetoothLocalDevice::HostMode state);
     void pebbleConnected();
     void pebbleDisconnected();
-    void socketError(QBluetoothSocket::SocketError error);
-    void readyRead();
-//    void logData(const QByteArray &data);
-
+    void drainIncoming();
+    void deferWindowExpired();
 
 private:
     QBluetoothAddress m_pebbleAddress;
-    QBluetoothLocalDevice *m_localDevice;
-    QBluetoothSocket *m_socket = nullptr;
-    int m_connectionAttempts = 0;
-    QTimer m_reconnectTimer;
+    QThread m_ioThread;
+    WatchIoWorker *m_worker;
+    WatchTransport *m_transport = nullptr;
+    bool m_connected = false;
+    bool m_replaying = false;
+
+    MetricsRegistry *m_metrics;
+    QHash<quint16, EndpointMetrics> m_endpointMetrics;
+    MetricCounter *m_unhandledFrames;
+    MetricCounter *m_droppedFrames;
+
+    struct DeferredFrame {
+        Endpoint endpoint;
+        int supersedeKey;
+        QByteArray data;
+    };
+    QList<DeferredFrame> m_deferred;
+    // deferToPebble() calls since the last flush, superseded ones included
+    int m_deferredWrites = 0;
+    QTimer *m_deferTimer;
+    // Since the watch was last heard from, deferrable writes go out right away while the link is awake
+    QElapsedTimer m_lastIncoming;
+    MetricCounter *m_deferredFrames;
+    MetricCounter *m_supersededFrames;
+    MetricCounter *m_deferredBatches;
+    MetricCounter *m_earlyFlushes;
+    MetricCounter *m_wakeupsSaved;
 
+    LinkProbe *m_linkProbe;
     UploadManager *m_uploadManager;
-    QHash<Endpoint, Callback> m_endpointHandlers;
+
+    struct HandlerEntry {
+        QPointer<QObject> receiver;
+        EndpointHandler handler;
+    };
+    // Endpoint -> 1-based index into m_handlers, 0 means unhandled
+    quint8 m_handlerSlots[0x10000] = {};
+    QVector<HandlerEntry> m_handlers;
 };
 
+template <typename T>
+bool WatchConnection::registerEndpointHandler(Endpoint endpoint, T *receiver, void (T::*method)(const QByteArray &))
+{
+    return registerEndpointHandler(endpoint, receiver, [receiver, method](const QByteArray &data) {
+        (receiver->*method)(data);
+    });
+}
+
 #endif // WATCHCONNECTION_H
@@ -1,6 +1,119 @@
 #include "watchdatareader.h"
 
+const int WatchDictView::TupleHeaderLength;
+
 bool WatchDataReader::bad() const
 {
     return m_bad;
 }
+
+WatchDictView WatchDataReader::readDictView()
+{
+    if (checkBad(1)) return WatchDictView();
+    const int n = readLE<quint8>();
+    const int start = m_offset;
+
+    // Walk the headers only, so the view can trust them later on
+    for (int i = 0; i < n; i++) {
+        if (checkBad(WatchDictView::TupleHeaderLength)) return WatchDictView();
+        const uchar *header = p();
+        const int type = header[4];
+        const int width = qFromLittleEndian<quint16>(header + 5);
+        m_offset += WatchDictView::TupleHeaderLength;
+
+        switch (type) {
+        case WatchConnection::DictItemTypeBytes:
+        case WatchConnection::DictItemTypeString:
+            break;
+        case WatchConnection::DictItemTypeUInt:
+        case WatchConnection::DictItemTypeInt:
+            if (width != 1 && width != 2 && width != 4) {
+                m_bad = true;
+                return WatchDictView();
+            }
+            break;
+        default:
+            m_bad = true;
+            return WatchDictView();
+        }
+        if (checkBad(width)) return WatchDictView();
+        m_offset += width;
+    }
+
+    return WatchDictView(m_data + start, m_offset - start, n);
+}
+
+WatchDictView::Tuple WatchDictView::const_iterator::operator*() const
+{
+    const uchar *header = reinterpret_cast<const uchar *>(m_p);
+    Tuple tuple;
+    tuple.key = qFromLittleEndian<qint32>(header); // For some reason, this is little endian.
+    tuple.type = header[4];
+    tuple.width = qFromLittleEndian<quint16>(header + 5);
+    tuple.data = m_p + TupleHeaderLength;
+    return tuple;
+}
+
+QVariant WatchDictView::Tuple::value() const
+{
+    const uchar *u = reinterpret_cast<const uchar *>(data);
+    switch (type) {
+    case WatchConnection::DictItemTypeBytes:
+        return QVariant::fromValue(QByteArray(data, width));
+    case WatchConnection::DictItemTypeString:
+        return QVariant::fromValue(QString::fromUtf8(data, strnlen(data, width)));
+    case WatchConnection::DictItemTypeUInt:
+        switch (width) {
+        case sizeof(quint8):
+            return QVariant::fromValue(qFromLittleEndian<quint8>(u));
+        case sizeof(quint16):
+            return QVariant::fromValue(qFromLittleEndian<quint16>(u));
+        default:
+            return QVariant::fromValue(qFromLittleEndian<quint32>(u));
+        }
+    case WatchConnection::DictItemTypeInt:
+        switch (width) {
+        case sizeof(qint8):
+            return QVariant::fromValue(qFromLittleEndian<qint8>(u));
+        case sizeof(qint16):
+            return QVariant::fromValue(qFromLittleEndian<qint16>(u));
+        default:
+            return QVariant::fromValue(qFromLittleEndian<qint32>(u));
+        }
+    }
+    return QVariant();
+}
+
+bool WatchDictView::find(int key, Tuple *tuple) const
+{
+    for (const_iterator it = begin(); it != end(); ++it) {
+        Tuple t = *it;
+        if (t.key == key) {
+            *tuple = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WatchDictView::contains(int key) const
+{
+    Tuple tuple;
+    return find(key, &tuple);
+}
+
+QVariant WatchDictView::value(int key) const
+{
+    Tuple tuple;
+    return find(key, &tuple) ? tuple.value() : QVariant();
+}
+
+WatchConnection::Dict WatchDictView::toDict() const
+{
+    WatchConnection::Dict d;
+    for (const_iterator it = begin(); it != end(); ++it) {
+        Tuple tuple = *it;
+        d.insert(tuple.key, tuple.value());
+    }
+    return d;
+}
@@ -10,12 +10,67 @@
 #include <QMap>
 #include <QDateTime>
 
+// Lazy view of an AppMessage dictionary. Only the tuple headers are checked when it is read,
+// values are decoded on access. Like the reader it came from it doesn't own the data.
+class WatchDictView {
+public:
+    struct Tuple {
+        int key = 0;
+        quint8 type = 0;
+        const char *data = nullptr;
+        int width = 0;
+
+        QVariant value() const;
+    };
+
+    class const_iterator {
+    public:
+        const_iterator(const char *p = nullptr): m_p(p) {}
+        Tuple operator*() const;
+        const_iterator &operator++() { m_p += TupleHeaderLength + qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(m_p) + 5); return *this; }
+        bool operator==(const const_iterator &other) const { return m_p == other.m_p; }
+        bool operator!=(const const_iterator &other) const { return m_p != other.m_p; }
+    private:
+        const char *m_p;
+    };
+
+    static const int TupleHeaderLength = 4 + 1 + 2;
+
+    WatchDictView() {}
+    WatchDictView(const char *data, int size, int count): m_data(data), m_size(size), m_count(count) {}
+
+    int count() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+    const_iterator begin() const { return const_iterator(m_data); }
+    const_iterator end() const { return const_iterator(m_data + m_size); }
+
+    bool find(int key, Tuple *tuple) const;
+    bool contains(int key) const;
+    QVariant value(int key) const;
+    WatchConnection::Dict toDict() const;
+
+private:
+    const char *m_data = nullptr;
+    int m_size = 0;
+    int m_count = 0;
+};
+
+// Reads from a byte view it does not own. The data must outlive the reader, and anything returned
+// as a view (peek(), readView(), readDictView()) is only valid as long as the data is.
 class WatchDataReader {
 public:
     WatchDataReader(const QByteArray &data):
-        m_data(data)
+        m_data(data.constData()),
+        m_size(data.size())
     {
     }
+    WatchDataReader(const char *data, int size):
+        m_data(data),
+        m_size(size)
+    {
+    }
+    // Would point into a temporary
+    WatchDataReader(QByteArray &&data) = delete;
 
     template <typename T>
     T read() {
@@ -27,20 +82,28 @@ public:
 
     inline bool checkBad(int n = 0)
     {
-        if (m_offset + n > m_data.size()) {
+        if (m_offset + n > m_size) {
             m_bad = true;
         }
         return m_bad;
     }
     inline const uchar * p()
     {
-        return reinterpret_cast<const uchar *>(&m_data.constData()[m_offset]);
+        return reinterpret_cast<const uchar *>(m_data + m_offset);
     }
     inline void skip(int n)
     {
         m_offset += n;
         checkBad();
     }
+    inline int offset() const
+    {
+        return m_offset;
+    }
+    inline int remaining() const
+    {
+        return m_size - m_offset;
+    }
 
     template <typename T>
     inline T readLE()
@@ -53,98 +116,51 @@ public:
     QString readFixedString(int n)
     {
         if (checkBad(n)) return QString();
-        const char *u = &m_data.constData()[m_offset];
+        const char *u = m_data + m_offset;
         m_offset += n;
         return QString::fromUtf8(u, strnlen(u, n));
     }
     QByteArray peek(int n) {
-        return m_data.left(m_offset + n).right(n);
+        if (m_offset + n > m_size) return QByteArray();
+        return QByteArray::fromRawData(m_data + m_offset, n);
     }
     QUuid readUuid()
     {
         if (checkBad(16)) return QString();
         m_offset += 16;
-        return QUuid::fromRfc4122(m_data.mid(m_offset - 16, 16));
+        return QUuid::fromRfc4122(QByteArray::fromRawData(m_data + m_offset - 16, 16));
     }
     QDateTime readTimestamp()
     {
         if (checkBad(4)) return QDateTime();
         return QDateTime::fromTime_t(readLE<quint32>());
     }
+    // Returns a copy, use readView() for data that doesn't leave the handler
     QByteArray readBytes(int n)
     {
         if (checkBad(n)) return QByteArray();
-        const char *u = &m_data.constData()[m_offset];
+        const char *u = m_data + m_offset;
         m_offset += n;
         return QByteArray(u, n);
     }
+    QByteArray readView(int n)
+    {
+        if (checkBad(n)) return QByteArray();
+        const char *u = m_data + m_offset;
+        m_offset += n;
+        return QByteArray::fromRawData(u, n);
+    }
+    WatchDictView readDictView();
     QMap<int, QVariant> readDict()
     {
-        QMap<int, QVariant> d;
-        if (checkBad(1)) return d;
-
-        const int n = readLE<quint8>();
-
-        for (int i = 0; i < n; i++) {
-            if (checkBad(4 + 1 + 2)) return d;
-            const int key = readLE<qint32>(); // For some reason, this is little endian.
-            const int type = readLE<quint8>();
-            const int width = readLE<quint16>();
-
-            switch (type) {
-            case WatchConnection::DictItemTypeBytes:
-                d.insert(key, QVariant::fromValue(readBytes(width)));
-                break;
-            case WatchConnection::DictItemTypeString:
-                d.insert(key, QVariant::fromValue(readFixedString(width)));
-                break;
-            case WatchConnection::DictItemTypeUInt:
-                switch (width) {
-                case sizeof(quint8):
-                    d.insert(key, QVariant::fromValue(readLE<quint8>()));
-                    break;
-                case sizeof(quint16):
-                    d.insert(key, QVariant::fromValue(readLE<quint16>()));
-                    break;
-                case sizeof(quint32):
-                    d.insert(key, QVariant::fromValue(readLE<quint32>()));
-                    break;
-                default:
-                    m_bad = true;
-                    return d;
-                }
-
-                break;
-            case WatchConnection::DictItemTypeInt:
-                switch (width) {
-                case sizeof(qint8):
-                    d.insert(key, QVariant::fromValue(readLE<qint8>()));
-                    break;
-                case sizeof(qint16):
-                    d.insert(key, QVariant::fromValue(readLE<qint16>()));
-                    break;
-                case sizeof(qint32):
-                    d.insert(key, QVariant::fromValue(readLE<qint32>()));
-                    break;
-                default:
-                    m_bad = true;
-                    return d;
-                }
-
-                break;
-            default:
-                m_bad = true;
-                return d;
-            }
-        }
-
-        return d;
+        return readDictView().toDict();
     }
     bool bad() const;
 
 
 private:
-    QByteArray m_data;
+    const char *m_data;
+    int m_size;
     int m_offset = 0;
     bool m_bad = false;
 };
@@ -1,42 +1,203 @@
 #include "watchdatawriter.h"
 #include "watchconnection.h"
 
-void WatchDataWriter::writeBytes(int n, const QByteArray &b)
+#include <cstring>
+
+// Bytes QString::toUtf8() produces for the character at s[i], consumed tells how many QChars that took.
+// Unpaired surrogates come out as '?', just like there.
+static inline int utf8CharLength(const QChar *s, int n, int i, int *consumed)
 {
-    if (b.size() > n) {
-        _buf->append(b.constData(), n);
-    } else {
-        int diff = n - b.size();
-        _buf->append(b);
-        if (diff > 0) {
-            _buf->append(QByteArray(diff, '\0'));
+    const ushort u = s[i].unicode();
+    *consumed = 1;
+    if (u < 0x80) {
+        return 1;
+    }
+    if (u < 0x800) {
+        return 2;
+    }
+    if (QChar::isSurrogate(u)) {
+        if (QChar::isHighSurrogate(u) && i + 1 < n && QChar::isLowSurrogate(s[i + 1].unicode())) {
+            *consumed = 2;
+            return 4;
         }
+        return 1;
+    }
+    return 3;
+}
+
+static int utf8Length(const QChar *s, int n)
+{
+    int length = 0;
+    int consumed;
+    for (int i = 0; i < n; i += consumed) {
+        length += utf8CharLength(s, n, i, &consumed);
     }
+    return length;
+}
+
+static int packedStringChars(const QString &s)
+{
+    return qMin(s.length(), 0xEF);
+}
+
+static int stringItemLength(const QString &s)
+{
+    // NUL terminated unless it already is
+    return utf8Length(s.constData(), s.length()) + ((s.isEmpty() || s.at(s.length() - 1) != QChar(0)) ? 1 : 0);
+}
+
+void WatchDataWriter::writeUtf8(const QChar *s, int n, int length)
+{
+    uchar *out = up(length);
+    int consumed;
+    for (int i = 0; i < n; i += consumed) {
+        const ushort u = s[i].unicode();
+        switch (utf8CharLength(s, n, i, &consumed)) {
+        case 1:
+            *out++ = QChar::isSurrogate(u) ? '?' : u;
+            break;
+        case 2:
+            *out++ = 0xC0 | (u >> 6);
+            *out++ = 0x80 | (u & 0x3F);
+            break;
+        case 3:
+            *out++ = 0xE0 | (u >> 12);
+            *out++ = 0x80 | ((u >> 6) & 0x3F);
+            *out++ = 0x80 | (u & 0x3F);
+            break;
+        case 4: {
+            const uint ucs4 = QChar::surrogateToUcs4(u, s[i + 1].unicode());
+            *out++ = 0xF0 | (ucs4 >> 18);
+            *out++ = 0x80 | ((ucs4 >> 12) & 0x3F);
+            *out++ = 0x80 | ((ucs4 >> 6) & 0x3F);
+            *out++ = 0x80 | (ucs4 & 0x3F);
+            break;
+        }
+        }
+    }
+}
+
+void WatchDataWriter::writeBytes(int n, const QByteArray &b)
+{
+    char *out = p(n);
+    const int copied = qMin(n, b.size());
+    memcpy(out, b.constData(), copied);
+    memset(out + copied, 0, n - copied);
 }
 
 void WatchDataWriter::writeFixedString(int n, const QString &s)
 {
-    _buf->append(s.left(n).toUtf8());
-    for (int i = s.left(n).length(); i < n; i++) {
-        _buf->append('\0');
+    // As many whole characters as fit into n bytes, padded with NULs
+    int chars = 0;
+    int length = 0;
+    int consumed;
+    while (chars < s.length()) {
+        const int charLength = utf8CharLength(s.constData(), s.length(), chars, &consumed);
+        if (length + charLength > n) {
+            break;
+        }
+        length += charLength;
+        chars += consumed;
     }
+    writeUtf8(s.constData(), chars, length);
+    memset(p(n - length), 0, n - length);
 }
 
 void WatchDataWriter::writeCString(const QString &s)
 {
-    _buf->append(s.toUtf8());
-    _buf->append('\0');
+    writeUtf8(s.constData(), s.length(), ::utf8Length(s.constData(), s.length()));
+    *p(1) = '\0';
 }
 
 void WatchDataWriter::writePascalString(const QString &s)
 {
-    _buf->append(s.length());
-    _buf->append(s.toLatin1());
+    *p(1) = s.length();
+    char *out = p(s.length());
+    for (int i = 0; i < s.length(); i++) {
+        const ushort u = s.at(i).unicode();
+        out[i] = u < 0x100 ? u : '?';
+    }
+}
+
+void WatchDataWriter::writePackedString(const QString &s)
+{
+    const int chars = packedStringChars(s);
+    const int length = ::utf8Length(s.constData(), chars);
+    *p(1) = (length + 1) & 0xFF;
+    writeUtf8(s.constData(), chars, length);
+    *p(1) = '\0';
 }
 
 void WatchDataWriter::writeUuid(const QUuid &uuid)
 {
-    writeBytes(16, uuid.toRfc4122());
+    uchar *out = up(16);
+    qToBigEndian(uuid.data1, out);
+    qToBigEndian(uuid.data2, out + 4);
+    qToBigEndian(uuid.data3, out + 6);
+    memcpy(out + 8, uuid.data4, 8);
+}
+
+int WatchDataWriter::utf8Length(const QString &s)
+{
+    return ::utf8Length(s.constData(), s.length());
+}
+
+int WatchDataWriter::cStringSize(const QString &s)
+{
+    return utf8Length(s) + 1;
+}
+
+int WatchDataWriter::pascalStringSize(const QString &s)
+{
+    return 1 + s.length();
+}
+
+int WatchDataWriter::packedStringSize(const QString &s)
+{
+    return 1 + ::utf8Length(s.constData(), packedStringChars(s)) + 1;
+}
+
+int WatchDataWriter::dictSize(const QMap<int, QVariant> &d)
+{
+    if (d.size() > 0xFF) {
+        return 1;
+    }
+
+    // Must match writeDict() case by case
+    const int header = 4 + 1 + 2;
+    int size = 1;
+    for (QMap<int, QVariant>::const_iterator it = d.constBegin(); it != d.constEnd(); ++it) {
+        switch (int(it.value().type())) {
+        case QMetaType::VoidStar:
+            continue;
+        case QMetaType::Char:
+        case QMetaType::UChar:
+        case QMetaType::SChar:
+        case QMetaType::Bool:
+            size += header + 1;
+            break;
+        case QMetaType::Short:
+        case QMetaType::UShort:
+            size += header + 2;
+            break;
+        case QMetaType::Int:
+        case QMetaType::UInt:
+        case QMetaType::Float:
+        case QMetaType::Double:
+            size += header + 4;
+            break;
+        case QMetaType::QByteArray:
+            size += header + it.value().toByteArray().size();
+            break;
+        case QMetaType::QVariantList:
+            size += header + it.value().toList().size();
+            break;
+        default:
+            size += header + stringItemLength(it.value().toString());
+            break;
+        }
+    }
+    return size;
 }
 
 void WatchDataWriter::writeDict(const QMap<int, QVariant> &d)
@@ -119,7 +280,7 @@ void WatchDataWriter::writeDict(const QMap<int, QVariant> &d)
             QByteArray ba = it.value().toByteArray();
             writeLE<quint8>(WatchConnection::DictItemTypeBytes);
             writeLE<quint16>(ba.size());
-            _buf->append(ba);
+            writeBytes(ba.size(), ba);
             break;
         }
 
@@ -127,16 +288,13 @@ void WatchDataWriter::writeDict(const QMap<int, QVariant> &d)
             // Generally a JS array, which we marshal as a byte array.
             writeLE<quint32>(it.key());
             QVariantList list = it.value().toList();
-            QByteArray ba;
-            ba.reserve(list.size());
 
+            writeLE<quint8>(WatchConnection::DictItemTypeBytes);
+            writeLE<quint16>(list.size());
+            char *out = p(list.size());
             Q_FOREACH (const QVariant &v, list) {
-                ba.append(v.toInt());
+                *out++ = v.toInt();
             }
-
-            writeLE<quint8>(WatchConnection::DictItemTypeBytes);
-            writeLE<quint16>(ba.size());
-            _buf->append(ba);
             break;
         }
 
@@ -147,14 +305,16 @@ void WatchDataWriter::writeDict(const QMap<int, QVariant> &d)
         case QMetaType::QUrl:
         {
             writeLE<quint32>(it.key());
-            QByteArray s = it.value().toString().toUtf8();
-            if (s.isEmpty() || s[s.size() - 1] != '\0') {
-                // Add null terminator if it doesn't have one
-                s.append('\0');
-            }
+            const QString s = it.value().toString();
+            const int length = ::utf8Length(s.constData(), s.length());
+            // Add null terminator if it doesn't have one
+            const bool terminate = s.isEmpty() || s.at(s.length() - 1) != QChar(0);
             writeLE<quint8>(WatchConnection::DictItemTypeString);
-            writeLE<quint16>(s.size());
-            _buf->append(s);
+            writeLE<quint16>(length + (terminate ? 1 : 0));
+            writeUtf8(s.constData(), s.length(), length);
+            if (terminate) {
+                *p(1) = '\0';
+            }
             break;
         }
         }
@@ -8,10 +8,19 @@
 #include <QVariantMap>
 #include <QLoggingCategory>
 
+/*
+ * Writes either at the end of a buffer, growing it with every write, or in place into a buffer
+ * that has been sized up front. The latter is what PebblePacket::serialize() does: the *Size()
+ * helpers below give the exact encoded size of everything that isn't fixed width, so a packet
+ * can be encoded with a single allocation.
+ */
 class WatchDataWriter
 {
 public:
+    // Appends to buf
     WatchDataWriter(QByteArray *buf);
+    // Overwrites buf starting at offset. Writing past its end still works, but resizes it.
+    WatchDataWriter(QByteArray *buf, int offset);
 
     template <typename T>
     void write(T v);
@@ -27,14 +36,28 @@ public:
 
     void writePascalString(const QString &s);
 
+    // Length prefixed and NUL terminated, at most 0xEF characters
+    void writePackedString(const QString &s);
+
     void writeUuid(const QUuid &uuid);
 
     void writeDict(const QMap<int, QVariant> &d);
 
+    // Position of the next write
+    int offset() const;
+
+    static int utf8Length(const QString &s);
+    static int cStringSize(const QString &s);
+    static int pascalStringSize(const QString &s);
+    static int packedStringSize(const QString &s);
+    static int dictSize(const QMap<int, QVariant> &d);
+
 private:
     char *p(int n);
     uchar *up(int n);
+    void writeUtf8(const QChar *s, int n, int length);
     QByteArray *_buf;
+    int _offset = -1; // -1 appends
 };
 
 inline WatchDataWriter::WatchDataWriter(QByteArray *buf)
@@ -42,6 +65,12 @@ inline WatchDataWriter::WatchDataWriter(QByteArray *buf)
 {
 }
 
+inline WatchDataWriter::WatchDataWriter(QByteArray *buf, int offset)
+    : _buf(buf),
+      _offset(offset)
+{
+}
+
 template <typename T>
 void WatchDataWriter::write(T v)
 {
@@ -54,11 +83,24 @@ void WatchDataWriter::writeLE(T v)
     qToLittleEndian(v, up(sizeof(T)));
 }
 
+inline int WatchDataWriter::offset() const
+{
+    return _offset < 0 ? _buf->size() : _offset;
+}
+
 inline char * WatchDataWriter::p(int n)
 {
-    int size = _buf->size();
-    _buf->resize(size + n);
-    return &_buf->data()[size];
+    if (_offset < 0) {
+        int size = _buf->size();
+        _buf->resize(size + n);
+        return &_buf->data()[size];
+    }
+    if (_offset + n > _buf->size()) {
+        _buf->resize(_offset + n);
+    }
+    char *ret = &_buf->data()[_offset];
+    _offset += n;
+    return ret;
 }
 
 inline uchar * WatchDataWriter::up(int n)
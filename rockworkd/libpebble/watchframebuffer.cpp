@@ -0,0 +1,51 @@
+#include "watchframebuffer.h"
+
+#include <cstring>
+
+const int WatchFrameBuffer::HeaderLength;
+const int WatchFrameBuffer::MaxFrameLength;
+
+WatchFrameBuffer::WatchFrameBuffer(int capacity):
+    m_buffer(qMax(capacity, MaxFrameLength), Qt::Uninitialized)
+{
+}
+
+qint64 WatchFrameBuffer::fill(QIODevice *device)
+{
+    if (m_tail == m_buffer.size()) {
+        compact();
+    }
+    qint64 n = device->read(m_buffer.data() + m_tail, m_buffer.size() - m_tail);
+    if (n > 0) {
+        m_tail += n;
+        m_stats.bytesRead += n;
+    }
+    return n;
+}
+
+void WatchFrameBuffer::clear()
+{
+    m_head = m_tail = 0;
+}
+
+void WatchFrameBuffer::startWakeup()
+{
+    m_stats.wakeups++;
+    m_stats.lastWakeupFrames = 0;
+}
+
+void WatchFrameBuffer::compact()
+{
+    // The buffer holds at least one maximum sized frame, so a full buffer always has
+    // something consumed at the front once all complete frames have been taken.
+    const int remaining = m_tail - m_head;
+    if (m_head == 0) {
+        return;
+    }
+    if (remaining > 0) {
+        memmove(m_buffer.data(), m_buffer.constData() + m_head, remaining);
+        m_stats.bytesCopied += remaining;
+    }
+    m_head = 0;
+    m_tail = remaining;
+}
@@ -0,0 +1,92 @@
+#ifndef WATCHFRAMEBUFFER_H
+#define WATCHFRAMEBUFFER_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QtEndian>
+
+/*
+ * Persistent receive buffer for the Pebble framing (16 bit length, 16 bit endpoint, payload).
+ *
+ * Socket data is read straight into the free tail of the buffer and complete frames are handed
+ * out as non-owning slices into it. A slice stays valid until the next call to fill() or clear().
+ * Once the write position reaches the end of the buffer the unconsumed tail (at most one partial
+ * frame) is moved back to the front. That move is the only copy done here and is accounted for in
+ * Stats::bytesCopied.
+ */
+class WatchFrameBuffer
+{
+public:
+    static const int HeaderLength = 4;
+    static const int MaxFrameLength = HeaderLength + 0xFFFF;
+
+    struct Frame {
+        quint16 endpoint = 0;
+        const char *data = nullptr; // header + payload
+        int length = 0;             // header + payload
+
+        const char *payload() const { return data + HeaderLength; }
+        int payloadLength() const { return length - HeaderLength; }
+    };
+
+    struct Stats {
+        quint64 wakeups = 0;
+        quint64 frames = 0;
+        quint64 bytesRead = 0;
+        quint64 bytesCopied = 0;
+        int lastWakeupFrames = 0;
+        int maxWakeupFrames = 0;
+    };
+
+    explicit WatchFrameBuffer(int capacity = 2 * MaxFrameLength);
+
+    // Reads as much as fits from the device. Returns the number of bytes read, 0 or -1 like QIODevice::read().
+    qint64 fill(QIODevice *device);
+    // Returns the next complete frame, if any. The frame points into the buffer.
+    bool takeFrame(Frame *frame);
+    void clear();
+
+    void startWakeup();
+    int bufferedBytes() const { return m_tail - m_head; }
+    const Stats &stats() const { return m_stats; }
+
+private:
+    void compact();
+
+    QByteArray m_buffer;
+    int m_head = 0;
+    int m_tail = 0;
+    Stats m_stats;
+};
+
+inline bool WatchFrameBuffer::takeFrame(Frame *frame)
+{
+    const int available = m_tail - m_head;
+    if (available < HeaderLength) {
+        if (available == 0) {
+            // Nothing is buffered, start over at the front so we don't need to compact later on
+            m_head = m_tail = 0;
+        }
+        return false;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar *>(m_buffer.constData() + m_head);
+    const int length = HeaderLength + qFromBigEndian<quint16>(header);
+    if (available < length) {
+        return false;
+    }
+
+    frame->endpoint = qFromBigEndian<quint16>(header + 2);
+    frame->data = m_buffer.constData() + m_head;
+    frame->length = length;
+    m_head += length;
+
+    m_stats.frames++;
+    m_stats.lastWakeupFrames++;
+    if (m_stats.lastWakeupFrames > m_stats.maxWakeupFrames) {
+        m_stats.maxWakeupFrames = m_stats.lastWakeupFrames;
+    }
+    return true;
+}
+
+#endif // WATCHFRAMEBUFFER_H
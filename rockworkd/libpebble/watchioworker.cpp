@@ -0,0 +1,361 @@
+#include "watchioworker.h"
+#include "tracing.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QMutexLocker>
+
+// Bytes handed to the socket but not yet reported written. Keeps the socket buffer short
+// so that urgent frames don't end up queued behind a pile of PutBytes chunks.
+static const qint64 MAX_BYTES_IN_FLIGHT = 4096;
+// Fallback reconnect delay, doubled per failed attempt. The transport's peerNearby() cuts it short.
+static const int RECONNECT_MIN_DELAY = 2000;
+static const int RECONNECT_MAX_DELAY = 5 * 60 * 1000;
+// Attempts while the watch isn't paired yet are kept at short delays to pick it up soon after pairing
+static const int NOT_PAIRED_MAX_ATTEMPTS = 3;
+
+WatchIoWorker::WatchIoWorker(int priorityCount):
+    QObject(nullptr),
+    m_txQueues(priorityCount),
+    m_queueDepths(priorityCount)
+{
+    m_reconnectTimer = new QTimer(this);
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &WatchIoWorker::reconnect);
+}
+
+void WatchIoWorker::post(const OutgoingFrame &frame)
+{
+    m_outgoing.push(frame);
+    if (!m_outgoingPosted.exchange(true)) {
+        QMetaObject::invokeMethod(this, "drainOutgoing", Qt::QueuedConnection);
+    }
+}
+
+bool WatchIoWorker::takeIncoming(IncomingFrame *frame)
+{
+    return m_incoming.pop(frame);
+}
+
+void WatchIoWorker::incomingTaken()
+{
+    // Rearm before taking frames, anything pushed after the last takeIncoming() signals again
+    m_incomingPosted.store(false);
+}
+
+int WatchIoWorker::queueDepth(int priority) const
+{
+    return m_queueDepths.at(priority).load();
+}
+
+qint64 WatchIoWorker::bytesInFlight() const
+{
+    return m_bytesInFlight.load();
+}
+
+WatchFrameBuffer::Stats WatchIoWorker::receiveStats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_stats;
+}
+
+WatchIoWorker::ReconnectStats WatchIoWorker::reconnectStats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_reconnectStats;
+}
+
+void WatchIoWorker::setTransport(WatchTransport *transport)
+{
+    if (m_transport) {
+        bool wasConnected = m_transport->isConnected();
+        m_transport->disconnect(this);
+        m_transport->close();
+        m_transport->deleteLater();
+        m_rxBuffer.clear();
+        clearOutgoing();
+        m_linkEstablished = false;
+        m_linkLost.invalidate();
+        m_linkUp.invalidate();
+        if (wasConnected) {
+            emit disconnected();
+        }
+    }
+
+    m_transport = transport;
+    if (!m_transport) {
+        return;
+    }
+    qDebug() << "Using transport" << m_transport->name();
+    m_transport->setParent(this);
+    connect(m_transport, &WatchTransport::connected, this, &WatchIoWorker::transportConnected);
+    connect(m_transport, &WatchTransport::disconnected, this, &WatchIoWorker::transportDisconnected);
+    connect(m_transport, &WatchTransport::readyRead, this, &WatchIoWorker::readyRead);
+    connect(m_transport, &WatchTransport::bytesWritten, this, &WatchIoWorker::bytesWritten);
+    connect(m_transport, &WatchTransport::error, this, &WatchIoWorker::transportError);
+    connect(m_transport, &WatchTransport::availabilityChanged, this, &WatchIoWorker::transportAvailabilityChanged);
+    connect(m_transport, &WatchTransport::peerNearby, this, &WatchIoWorker::transportPeerNearby);
+}
+
+void WatchIoWorker::connectPebble()
+{
+    // qrand() is seeded per thread, spread out the backoff of concurrently started daemons
+    qsrand(QDateTime::currentMSecsSinceEpoch() ^ quintptr(this));
+    m_connectionAttempts = 0;
+    scheduleReconnect();
+}
+
+void WatchIoWorker::scheduleReconnect()
+{
+    if (m_connectionAttempts == 0) {
+        reconnect();
+        return;
+    }
+
+    // Exponential backoff with jitter, anywhere between half and all of the current delay
+    int delay = RECONNECT_MAX_DELAY;
+    if (m_connectionAttempts < 16) {
+        delay = qMin(RECONNECT_MIN_DELAY << (m_connectionAttempts - 1), RECONNECT_MAX_DELAY);
+    }
+    delay = delay / 2 + qrand() % (delay / 2 + 1);
+    qDebug() << "Attempting to reconnect in" << delay << "ms";
+    m_reconnectTimer->start(delay);
+}
+
+void WatchIoWorker::reconnect()
+{
+    if (!m_transport) {
+        return;
+    }
+
+    switch (m_transport->availability()) {
+    case WatchTransport::AvailabilityUnavailable:
+        qDebug() << "Transport" << m_transport->name() << "unavailable. Ceasing connection attempts";
+        if (m_reconnectTimer->isActive()) m_reconnectTimer->stop();
+        return;
+    case WatchTransport::AvailabilityNotYet:
+        // Try again in a few secs, give the user some time to pair it
+        m_connectionAttempts = qBound(1, m_connectionAttempts + 1, NOT_PAIRED_MAX_ATTEMPTS);
+        scheduleReconnect();
+        return;
+    case WatchTransport::AvailabilityReady:
+        break;
+    }
+
+    if (m_transport->isConnected()) {
+        qDebug() << "Already connected.";
+        return;
+    }
+
+    m_rxBuffer.clear();
+    clearOutgoing();
+    m_connectionAttempts++;
+    {
+        QMutexLocker locker(&m_statsMutex);
+        m_reconnectStats.attempts++;
+    }
+    m_transport->connectToWatch();
+}
+
+void WatchIoWorker::drainOutgoing()
+{
+    m_outgoingPosted.store(false);
+    const bool connected = m_transport && m_transport->isConnected();
+    OutgoingFrame frame;
+    int dropped = 0;
+    while (m_outgoing.pop(&frame)) {
+        if (!connected) {
+            // Posted just before the main thread learned about the disconnect
+            dropped++;
+            continue;
+        }
+        m_txQueues[frame.priority].enqueue(frame);
+        updateQueueDepth(frame.priority);
+    }
+    if (dropped > 0) {
+        qDebug() << "Socket not open. Dropping" << dropped << "frames";
+    }
+    flushOutgoing();
+}
+
+void WatchIoWorker::flushOutgoing()
+{
+    while (m_transport && m_transport->isConnected() && m_txBytesInFlight < MAX_BYTES_IN_FLIGHT) {
+        int priority = 0;
+        while (priority < m_txQueues.count() && m_txQueues.at(priority).isEmpty()) {
+            priority++;
+        }
+        if (priority == m_txQueues.count()) {
+            return;
+        }
+        // Even a frame bigger than the window goes out once the window has room, it just overshoots a bit
+        writeFrame(m_txQueues[priority].dequeue());
+        updateQueueDepth(priority);
+    }
+}
+
+void WatchIoWorker::writeFrame(const OutgoingFrame &frame)
+{
+    QIODevice *device = m_transport->device();
+    if (frame.framed) {
+        m_txBytesInFlight += frame.data.length();
+        device->write(frame.data);
+    } else {
+        uchar header[WatchFrameBuffer::HeaderLength];
+        qToBigEndian<quint16>(frame.data.length(), &header[0]);
+        qToBigEndian<quint16>(frame.endpoint, &header[2]);
+
+        // Header and payload are handed to the socket separately, the payload is never copied into a frame
+        m_txBytesInFlight += WatchFrameBuffer::HeaderLength + frame.data.length();
+        device->write(reinterpret_cast<const char *>(header), WatchFrameBuffer::HeaderLength);
+        device->write(frame.data);
+    }
+    m_bytesInFlight.store(m_txBytesInFlight);
+    TRACE_COUNTER("bt", "bytesInFlight", m_txBytesInFlight);
+}
+
+void WatchIoWorker::clearOutgoing()
+{
+    OutgoingFrame frame;
+    while (m_outgoing.pop(&frame)) {
+        m_txQueues[frame.priority].enqueue(frame);
+    }
+    for (int i = 0; i < m_txQueues.count(); i++) {
+        if (!m_txQueues.at(i).isEmpty()) {
+            qDebug() << "Dropping" << m_txQueues.at(i).size() << "queued frames of priority" << i;
+            m_txQueues[i].clear();
+        }
+        updateQueueDepth(i);
+    }
+    m_txBytesInFlight = 0;
+    m_bytesInFlight.store(0);
+}
+
+void WatchIoWorker::updateQueueDepth(int priority)
+{
+    m_queueDepths[priority].store(m_txQueues.at(priority).size());
+}
+
+void WatchIoWorker::bytesWritten(qint64 bytes)
+{
+    m_txBytesInFlight = qMax<qint64>(0, m_txBytesInFlight - bytes);
+    m_bytesInFlight.store(m_txBytesInFlight);
+    TRACE_COUNTER("bt", "bytesInFlight", m_txBytesInFlight);
+    flushOutgoing();
+}
+
+void WatchIoWorker::readyRead()
+{
+    QIODevice *device = m_transport ? m_transport->device() : nullptr;
+    if (!device) {
+        return;
+    }
+
+    TRACE_SPAN("bt", "readyRead");
+    // Drain everything the socket has in one go instead of one frame per wakeup.
+    // Each frame is copied once here, it has to outlive the receive buffer on its way to the main thread.
+    m_rxBuffer.startWakeup();
+    WatchFrameBuffer::Frame frame;
+    int frames = 0;
+    while (m_rxBuffer.fill(device) > 0) {
+        while (m_rxBuffer.takeFrame(&frame)) {
+            IncomingFrame incoming;
+            incoming.endpoint = frame.endpoint;
+            incoming.data = QByteArray(frame.data, frame.length);
+            m_incoming.push(incoming);
+            TRACE_EVENT1("bt", "frame", "endpoint", frame.endpoint);
+            frames++;
+        }
+    }
+
+    {
+        QMutexLocker locker(&m_statsMutex);
+        m_stats = m_rxBuffer.stats();
+        if (frames > 0 && m_linkUp.isValid()) {
+            m_reconnectStats.timeToFirstPacket.addSample(m_linkUp.nsecsElapsed() / 1000);
+            m_linkUp.invalidate();
+        }
+    }
+    if (frames > 0 && !m_incomingPosted.exchange(true)) {
+        emit incomingAvailable();
+    }
+}
+
+void WatchIoWorker::transportConnected()
+{
+    m_connectionAttempts = 0;
+    m_linkEstablished = true;
+    m_linkUp.start();
+    if (m_linkLost.isValid()) {
+        const qint64 usecs = m_linkLost.nsecsElapsed() / 1000;
+        qDebug() << "Reconnected after" << usecs / 1000 << "ms" << (m_nearbyAttempt ? "(watch seen nearby)" : "(backoff)");
+        QMutexLocker locker(&m_statsMutex);
+        m_reconnectStats.timeToReconnect.addSample(usecs);
+        if (m_nearbyAttempt) {
+            m_reconnectStats.nearbyReconnects++;
+        } else {
+            m_reconnectStats.backoffReconnects++;
+        }
+        m_linkLost.invalidate();
+    }
+    m_nearbyAttempt = false;
+    emit connected();
+}
+
+void WatchIoWorker::transportDisconnected()
+{
+    const WatchFrameBuffer::Stats &stats = m_rxBuffer.stats();
+    qDebug() << "Disconnected. Received" << stats.frames << "frames in" << stats.wakeups << "wakeups (max"
+             << stats.maxWakeupFrames << "per wakeup)," << stats.bytesCopied << "of" << stats.bytesRead << "bytes copied";
+    clearOutgoing();
+    if (m_linkEstablished) {
+        // Failed connect attempts don't count, only losing a link we had
+        m_linkEstablished = false;
+        m_linkLost.start();
+    }
+    m_linkUp.invalidate();
+    m_nearbyAttempt = false;
+    emit disconnected();
+    if (!m_reconnectTimer->isActive()) {
+        scheduleReconnect();
+    }
+}
+
+void WatchIoWorker::transportError(const QString &message)
+{
+    qDebug() << "SocketError" << message;
+    m_transport->close();
+    m_nearbyAttempt = false;
+    emit connectionFailed();
+    if (!m_reconnectTimer->isActive()) {
+        scheduleReconnect();
+    }
+}
+
+void WatchIoWorker::transportAvailabilityChanged()
+{
+    if (m_transport->availability() == WatchTransport::AvailabilityUnavailable)
+    {
+        qDebug() << "Transport" << m_transport->name() << "went away. Stopping any reconnect attempts.";
+        m_reconnectTimer->stop();
+    }
+    else if (!m_transport->isConnected() && !m_reconnectTimer->isActive())
+    {
+        qDebug() << "Transport" << m_transport->name() << "now available. Trying to reconnect";
+        m_connectionAttempts = 0;
+        scheduleReconnect();
+    }
+}
+
+void WatchIoWorker::transportPeerNearby()
+{
+    // Only cuts a pending backoff short. Without one we are connected, connecting or not supposed to.
+    if (!m_reconnectTimer->isActive()) {
+        return;
+    }
+    qDebug() << "Transport" << m_transport->name() << "sees the watch. Reconnecting now";
+    m_reconnectTimer->stop();
+    m_connectionAttempts = 0;
+    m_nearbyAttempt = true;
+    reconnect();
+}
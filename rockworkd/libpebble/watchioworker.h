@@ -0,0 +1,115 @@
+#ifndef WATCHIOWORKER_H
+#define WATCHIOWORKER_H
+
+#include <atomic>
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QQueue>
+#include <QTimer>
+
+#include "latencyhistogram.h"
+#include "spscqueue.h"
+#include "watchframebuffer.h"
+#include "watchtransport.h"
+
+/*
+ * The socket side of WatchConnection. Lives on WatchConnection's I/O thread and owns the transport,
+ * the receive buffer, the outgoing priority queues and the reconnect logic.
+ *
+ * Frames cross between the threads through two SpscQueues. Apart from the read-only getters, only
+ * post(), takeIncoming() and incomingTaken() are called from the main thread. Everything else runs
+ * on the I/O thread.
+ */
+class WatchIoWorker : public QObject
+{
+    Q_OBJECT
+public:
+    struct OutgoingFrame {
+        int priority = 0;
+        quint16 endpoint = 0;
+        bool framed = false; // data already carries a header (raw writes from DevConnection)
+        QByteArray data;
+    };
+    struct IncomingFrame {
+        quint16 endpoint = 0;
+        QByteArray data; // header + payload
+    };
+    struct ReconnectStats {
+        // From losing the link to having it back, and from there to the first frame from the watch
+        LatencyHistogram timeToReconnect;
+        LatencyHistogram timeToFirstPacket;
+        int attempts = 0;
+        // Reconnects started by the transport seeing the watch vs. by the backoff timer
+        int nearbyReconnects = 0;
+        int backoffReconnects = 0;
+    };
+
+    explicit WatchIoWorker(int priorityCount);
+
+    // Main thread
+    void post(const OutgoingFrame &frame);
+    bool takeIncoming(IncomingFrame *frame);
+    void incomingTaken();
+
+    // Readable from any thread
+    int queueDepth(int priority) const;
+    qint64 bytesInFlight() const;
+    WatchFrameBuffer::Stats receiveStats() const;
+    ReconnectStats reconnectStats() const;
+
+public slots:
+    void setTransport(WatchTransport *transport);
+    void connectPebble();
+
+signals:
+    void connected();
+    void disconnected();
+    void connectionFailed();
+    // Emitted once for any number of frames pushed until incomingTaken() is called
+    void incomingAvailable();
+
+private slots:
+    void drainOutgoing();
+    void transportAvailabilityChanged();
+    void transportConnected();
+    void transportDisconnected();
+    void transportError(const QString &message);
+    void transportPeerNearby();
+    void readyRead();
+    void bytesWritten(qint64 bytes);
+
+private:
+    void scheduleReconnect();
+    void reconnect();
+    void flushOutgoing();
+    void writeFrame(const OutgoingFrame &frame);
+    void clearOutgoing();
+    void updateQueueDepth(int priority);
+
+    WatchTransport *m_transport = nullptr;
+    QTimer *m_reconnectTimer;
+    int m_connectionAttempts = 0;
+    bool m_nearbyAttempt = false;
+    bool m_linkEstablished = false;
+    QElapsedTimer m_linkLost;
+    QElapsedTimer m_linkUp;
+    WatchFrameBuffer m_rxBuffer;
+    QVector<QQueue<OutgoingFrame> > m_txQueues;
+    qint64 m_txBytesInFlight = 0;
+
+    SpscQueue<OutgoingFrame> m_outgoing;
+    std::atomic<bool> m_outgoingPosted{false};
+    SpscQueue<IncomingFrame> m_incoming;
+    std::atomic<bool> m_incomingPosted{false};
+
+    // Published copies of the I/O thread's state
+    QVector<QAtomicInt> m_queueDepths;
+    std::atomic<qint64> m_bytesInFlight{0};
+    mutable QMutex m_statsMutex;
+    WatchFrameBuffer::Stats m_stats;
+    ReconnectStats m_reconnectStats;
+};
+
+#endif // WATCHIOWORKER_H
@@ -12,7 +12,7 @@ WatchLogEndpoint::WatchLogEndpoint(Pebble *pebble, WatchConnection *connection):
     m_connection(connection)
 {
     qsrand(QDateTime::currentMSecsSinceEpoch());
-    m_connection->registerEndpointHandler(WatchConnection::EndpointLogDump, this, "logMessageReceived");
+    m_connection->registerEndpointHandler(WatchConnection::EndpointLogDump, this, &WatchLogEndpoint::logMessageReceived);
 }
 
 void WatchLogEndpoint::fetchLogs(const QString &fileName)
@@ -86,23 +86,18 @@ RequestLogPacket::RequestLogPacket(WatchLogEndpoint::LogCommand command, quint8
 
 }
 
-QByteArray RequestLogPacket::serialize() const
+void RequestLogPacket::writeTo(WatchDataWriter &writer) const
 {
-    QByteArray msg;
-    WatchDataWriter writer(&msg);
     writer.write<quint8>(m_command);
     writer.write<quint8>(m_generation);
     writer.write<quint32>(m_cookie);
-    return msg;
 }
 
 LogMessage::LogMessage(const QByteArray &data)
 {
     WatchDataReader reader(data);
-    m_cookie = reader.read<quint32>();
-    m_timestamp = QDateTime::fromTime_t(reader.read<quint32>());
-    int level = reader.read<quint8>();
-    switch (level) {
+    Header::read(reader, this);
+    switch (m_levelCode) {
     case 0:
         m_level = '*';
         break;
@@ -121,8 +116,11 @@ LogMessage::LogMessage(const QByteArray &data)
         m_level = 'V';
     }
 
-    m_length = reader.read<quint8>();
-    m_line = reader.read<quint16>();
-    m_filename = reader.readFixedString(16);
     m_message = reader.readFixedString(m_length);
 }
+
+void LogMessage::writeTo(WatchDataWriter &writer) const
+{
+    Header::write(writer, *this);
+    writer.writeFixedString(m_length, m_message);
+}
@@ -5,6 +5,7 @@
 #include <QDateTime>
 
 #include "watchconnection.h"
+#include "watchpacketschema.h"
 
 class Pebble;
 
@@ -21,15 +22,26 @@ public:
     QString filename() const { return m_filename; }
     QString message() const { return m_message; }
 
-    QByteArray serialize() const override { return QByteArray(); }
+    int serializedSize() const override { return Header::FixedSize + m_length; }
+    void writeTo(WatchDataWriter &writer) const override;
 private:
-    quint32 m_cookie;
+    quint32 m_cookie = 0;
     QDateTime m_timestamp;
+    quint8 m_levelCode = 0;
     QChar m_level;
-    quint8 m_length;
-    quint16 m_line;
+    quint8 m_length = 0;
+    quint16 m_line = 0;
     QString m_filename;
-    QString m_message;
+    QString m_message; // m_length bytes, follows the header
+
+    typedef PacketSchema::Layout<LogMessage,
+        PACKET_FIELD(LogMessage, m_cookie, PacketSchema::BigEndian<quint32>),
+        PACKET_FIELD(LogMessage, m_timestamp, PacketSchema::Timestamp<PacketSchema::BigEndian<quint32>>),
+        PACKET_FIELD(LogMessage, m_levelCode, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(LogMessage, m_length, PacketSchema::BigEndian<quint8>),
+        PACKET_FIELD(LogMessage, m_line, PacketSchema::BigEndian<quint16>),
+        PACKET_FIELD(LogMessage, m_filename, PacketSchema::FixedString<16>)
+    > Header;
 };
 
 class WatchLogEndpoint : public QObject
@@ -66,7 +78,8 @@ class RequestLogPacket: public PebblePacket
 {
 public:
     RequestLogPacket(WatchLogEndpoint::LogCommand command, quint8 generation, quint32 cookie);
-    QByteArray serialize() const;
+    int serializedSize() const override { return 6; }
+    void writeTo(WatchDataWriter &writer) const override;
 private:
     WatchLogEndpoint::LogCommand m_command;
     quint8 m_generation;
@@ -0,0 +1,194 @@
+#ifndef WATCHPACKETSCHEMA_H
+#define WATCHPACKETSCHEMA_H
+
+#include "watchdatareader.h"
+#include "watchdatawriter.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QUuid>
+
+/*
+ * Declarative packet layouts. A packet is declared once as a list of fields, each binding a member
+ * to its wire encoding, and Layout generates the encoder, the decoder and the encoded size from it:
+ *
+ *     typedef PacketSchema::Layout<Header,
+ *         PACKET_FIELD(Header, command, PacketSchema::BigEndian<quint8>),
+ *         PACKET_FIELD(Header, token, PacketSchema::LittleEndian<quint16>)
+ *     > Schema;
+ *
+ *     Schema::write(writer, header);
+ *     Schema::read(reader, &header);
+ *
+ * When every field has a fixed width the size is a compile-time constant (Schema::FixedSize) and
+ * encoding is a straight sequence of stores. Fields are written and read in declaration order.
+ */
+namespace PacketSchema {
+
+enum { Variable = -1 };
+
+// Integers and enums, converted to Wire on the way out and back on the way in
+template <typename Wire>
+struct BigEndian {
+    enum { Size = sizeof(Wire) };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { writer.write<Wire>(static_cast<Wire>(v)); }
+    template <typename T> static T read(WatchDataReader &reader) { return static_cast<T>(reader.read<Wire>()); }
+};
+
+template <typename Wire>
+struct LittleEndian {
+    enum { Size = sizeof(Wire) };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { writer.writeLE<Wire>(static_cast<Wire>(v)); }
+    template <typename T> static T read(WatchDataReader &reader) { return static_cast<T>(reader.readLE<Wire>()); }
+};
+
+// QDateTime as seconds since the epoch, stored as Wire
+template <typename Wire>
+struct Timestamp {
+    enum { Size = Wire::Size };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { Wire::write(writer, v.toMSecsSinceEpoch() / 1000); }
+    template <typename T> static T read(WatchDataReader &reader) { return QDateTime::fromTime_t(Wire::template read<quint32>(reader)); }
+};
+
+struct Uuid {
+    enum { Size = 16 };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { writer.writeUuid(v); }
+    template <typename T> static T read(WatchDataReader &reader) { return reader.readUuid(); }
+};
+
+// UTF-8, NUL padded to N bytes
+template <int N>
+struct FixedString {
+    enum { Size = N };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { writer.writeFixedString(N, v); }
+    template <typename T> static T read(WatchDataReader &reader) { return reader.readFixedString(N); }
+};
+
+// QByteArray preceded by its length, encoded as Length
+template <typename Length>
+struct Bytes {
+    enum { Size = Variable };
+    template <typename T> static int size(const T &v) { return Length::Size + v.size(); }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) {
+        Length::write(writer, v.size());
+        writer.writeBytes(v.size(), v);
+    }
+    template <typename T> static T read(WatchDataReader &reader) { return reader.readBytes(Length::template read<int>(reader)); }
+};
+
+// Anything with serializedSize() and writeTo(), preceded by its length. Encode only.
+template <typename Length>
+struct Packet {
+    enum { Size = Variable };
+    template <typename T> static int size(const T &v) { return Length::Size + v->serializedSize(); }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) {
+        Length::write(writer, v->serializedSize());
+        v->writeTo(writer);
+    }
+    template <typename T> static T read(WatchDataReader &) { static_assert(sizeof(T) == 0, "Packet fields can't be decoded"); return T(); }
+};
+
+// Element count of a container, encoded as Length. Encode only.
+template <typename Length>
+struct Count {
+    enum { Size = Length::Size };
+    template <typename T> static int size(const T &) { return Size; }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) { Length::write(writer, v.count()); }
+    template <typename T> static T read(WatchDataReader &) { static_assert(sizeof(T) == 0, "Count fields can't be decoded"); return T(); }
+};
+
+// The elements of a container, each written with its own writeTo(). Encode only.
+struct Elements {
+    enum { Size = Variable };
+    template <typename T> static int size(const T &v) {
+        int size = 0;
+        for (typename T::const_iterator it = v.constBegin(); it != v.constEnd(); ++it) {
+            size += it->serializedSize();
+        }
+        return size;
+    }
+    template <typename T> static void write(WatchDataWriter &writer, const T &v) {
+        for (typename T::const_iterator it = v.constBegin(); it != v.constEnd(); ++it) {
+            it->writeTo(writer);
+        }
+    }
+    template <typename T> static T read(WatchDataReader &) { static_assert(sizeof(T) == 0, "Element fields can't be decoded"); return T(); }
+};
+
+// A data member of S
+template <typename S, typename T, T S::*Member, typename Codec>
+struct Field {
+    enum { Size = Codec::Size };
+    static int size(const S &s) { return int(Size) != int(Variable) ? int(Size) : Codec::size(s.*Member); }
+    static void write(WatchDataWriter &writer, const S &s) { Codec::write(writer, s.*Member); }
+    static void read(WatchDataReader &reader, S *s) { s->*Member = Codec::template read<T>(reader); }
+};
+
+// A value computed by a const getter of S. Decoding skips it.
+template <typename S, typename T, T (S::*Getter)() const, typename Codec>
+struct Derived {
+    enum { Size = Codec::Size };
+    static int size(const S &s) { return int(Size) != int(Variable) ? int(Size) : Codec::size((s.*Getter)()); }
+    static void write(WatchDataWriter &writer, const S &s) { Codec::write(writer, (s.*Getter)()); }
+    static void read(WatchDataReader &reader, S *) { Codec::template read<T>(reader); }
+};
+
+template <typename... Fields>
+struct SizeOf;
+
+template <>
+struct SizeOf<> {
+    enum { Value = 0 };
+};
+
+template <typename F, typename... Rest>
+struct SizeOf<F, Rest...> {
+    enum { Value = (int(F::Size) == int(Variable) || int(SizeOf<Rest...>::Value) == int(Variable))
+           ? int(Variable) : int(F::Size) + int(SizeOf<Rest...>::Value) };
+};
+
+template <typename S, typename... Fields>
+struct Layout {
+    enum { FixedSize = SizeOf<Fields...>::Value };
+
+    static int size(const S &s) {
+        if (int(FixedSize) != int(Variable)) {
+            return FixedSize;
+        }
+        const int sizes[] = { 0, Fields::size(s)... };
+        int total = 0;
+        for (int n : sizes) {
+            total += n;
+        }
+        return total;
+    }
+
+    static void write(WatchDataWriter &writer, const S &s) {
+        // Braced initializers are evaluated in order
+        const int order[] = { 0, (Fields::write(writer, s), 0)... };
+        Q_UNUSED(order);
+    }
+
+    // Returns false if the data ended early
+    static bool read(WatchDataReader &reader, S *s) {
+        if (int(FixedSize) != int(Variable) && reader.checkBad(FixedSize)) {
+            return false;
+        }
+        const int order[] = { 0, (Fields::read(reader, s), 0)... };
+        Q_UNUSED(order);
+        return !reader.bad();
+    }
+};
+
+}
+
+#define PACKET_FIELD(S, member, ...) PacketSchema::Field<S, decltype(S::member), &S::member, __VA_ARGS__>
+#define PACKET_DERIVED(S, T, getter, ...) PacketSchema::Derived<S, T, &S::getter, __VA_ARGS__>
+
+#endif // WATCHPACKETSCHEMA_H
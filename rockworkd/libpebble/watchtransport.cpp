@@ -0,0 +1,38 @@
+#include "watchtransport.h"
+#include "rfcommtransport.h"
+#include "tcptransport.h"
+#include "socketpairtransport.h"
+
+#include <QDebug>
+
+WatchTransport::WatchTransport(QObject *parent):
+    QObject(parent)
+{
+}
+
+WatchTransport *WatchTransport::create(const QString &spec, const QBluetoothAddress &address, QObject *parent)
+{
+    if (spec.isEmpty() || spec == "rfcomm") {
+        return new RfcommTransport(address, parent);
+    }
+    if (spec == "socketpair") {
+        return new SocketPairTransport(parent);
+    }
+    if (spec.startsWith("tcp:")) {
+        // The host may contain colons itself (IPv6), the port always comes last
+        int portSeparator = spec.lastIndexOf(':');
+        QString host = spec.mid(4, portSeparator - 4);
+        bool ok = false;
+        quint16 port = spec.mid(portSeparator + 1).toUShort(&ok);
+        if (portSeparator > 4 && !host.isEmpty() && ok) {
+            return new TcpTransport(host, port, parent);
+        }
+    }
+    qWarning() << "Invalid transport" << spec;
+    return nullptr;
+}
+
+WatchTransport::Availability WatchTransport::availability() const
+{
+    return AvailabilityReady;
+}
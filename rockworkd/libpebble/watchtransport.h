@@ -0,0 +1,49 @@
+#ifndef WATCHTRANSPORT_H
+#define WATCHTRANSPORT_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QBluetoothAddress>
+
+/*
+ * Byte stream WatchConnection runs the Pebble framing over.
+ *
+ * A transport owns its socket and may replace it on every connectToWatch(), so don't hold on to
+ * device() across reconnects. Implementations forward their socket's signals through the ones below.
+ */
+class WatchTransport : public QObject
+{
+    Q_OBJECT
+public:
+    enum Availability {
+        AvailabilityReady,
+        AvailabilityNotYet,     // Try again later, e.g. the watch is not paired yet
+        AvailabilityUnavailable // Stop trying until availabilityChanged() is emitted
+    };
+
+    explicit WatchTransport(QObject *parent = 0);
+
+    // Spec is one of "rfcomm", "tcp:<host>:<port>" or "socketpair". Returns nullptr for an invalid spec.
+    static WatchTransport *create(const QString &spec, const QBluetoothAddress &address, QObject *parent = 0);
+
+    virtual QString name() const = 0;
+    virtual Availability availability() const;
+
+    virtual void connectToWatch() = 0;
+    virtual void close() = 0;
+    virtual bool isConnected() const = 0;
+    virtual QIODevice *device() const = 0;
+
+signals:
+    void connected();
+    void disconnected();
+    void readyRead();
+    void bytesWritten(qint64 bytes);
+    void error(const QString &message);
+    void availabilityChanged();
+    // The watch can probably be reached right now, e.g. it just showed up on the radio.
+    // A hint to skip any reconnect delay, not a promise.
+    void peerNearby();
+};
+
+#endif // WATCHTRANSPORT_H
@@ -12,7 +12,7 @@ ZipHelper::ZipHelper()
 
 }
 
-bool ZipHelper::unpackArchive(const QString &archiveFilename, const QString &targetDir)
+bool ZipHelper::unpackArchive(const QString &archiveFilename, const QString &targetDir, const QStringList &entries)
 {
     QuaZip zipFile(archiveFilename);
     if (!zipFile.open(QuaZip::mdUnzip)) {
@@ -21,6 +21,9 @@ bool ZipHelper::unpackArchive(const QString &archiveFilename, const QString &tar
     }
 
     foreach (const QuaZipFileInfo &fi, zipFile.getFileInfoList()) {
+        if (!entries.isEmpty() && !entries.contains(fi.name)) {
+            continue;
+        }
         QuaZipFile f(archiveFilename, fi.name);
         if (!f.open(QFile::ReadOnly)) {
             qWarning() << "could not extract file" << fi.name;
@@ -49,6 +52,20 @@ bool ZipHelper::unpackArchive(const QString &archiveFilename, const QString &tar
     return true;
 }
 
+QIODevice *ZipHelper::openEntry(const QString &archiveFilename, const QString &entryName, qint64 *size)
+{
+    QuaZipFile *f = new QuaZipFile(archiveFilename, entryName);
+    if (!f->open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open" << entryName << "in" << archiveFilename;
+        delete f;
+        return nullptr;
+    }
+    if (size) {
+        *size = f->usize();
+    }
+    return f;
+}
+
 bool ZipHelper::packArchive(const QString &archiveFilename, const QString &sourceDir)
 {
     QuaZip zip(archiveFilename);
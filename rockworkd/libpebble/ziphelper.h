@@ -2,13 +2,19 @@
 #define ZIPHELPER_H
 
 #include <QString>
+#include <QStringList>
+
+class QIODevice;
 
 class ZipHelper
 {
 public:
     ZipHelper();
 
-    static bool unpackArchive(const QString &archiveFilename, const QString &targetDir);
+    // Only the given entries if any are given
+    static bool unpackArchive(const QString &archiveFilename, const QString &targetDir, const QStringList &entries = QStringList());
+    // An entry opened for reading, inflated as it is read. The caller owns it. Null if there is no such entry.
+    static QIODevice *openEntry(const QString &archiveFilename, const QString &entryName, qint64 *size = nullptr);
     static bool packArchive(const QString &archiveFilename, const QString &sourceDir);
 };
 
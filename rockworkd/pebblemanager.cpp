@@ -5,6 +5,9 @@
 #include "libpebble/platforminterface.h"
 
 #include <QHash>
+#include <QMap>
+#include <QSettings>
+#include <QStandardPaths>
 
 #ifdef ENABLE_TESTING
 #include <QQuickView>
@@ -24,9 +27,44 @@ QList<Pebble *> PebbleManager::pebbles() const
     return m_pebbles;
 }
 
+// transports.conf maps watch addresses (with '_' instead of ':') to a transport, e.g.
+// 00_00_00_00_00_01=tcp:localhost:12344. Watches with a non RFCOMM transport don't need
+// to be paired, they are loaded straight from there.
+QMap<QBluetoothAddress, QString> PebbleManager::configuredTransports() const
+{
+    QMap<QBluetoothAddress, QString> ret;
+    QSettings settings(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/transports.conf", QSettings::IniFormat);
+    foreach (const QString &key, settings.childKeys()) {
+        QBluetoothAddress address(QString(key).replace('_', ':'));
+        if (address.isNull()) {
+            qWarning() << "Invalid watch address in transports.conf:" << key;
+            continue;
+        }
+        ret.insert(address, settings.value(key).toString());
+    }
+    return ret;
+}
+
 void PebbleManager::loadPebbles()
 {
     QList<Device> pairedPebbles = m_bluezClient->pairedPebbles();
+    QMap<QBluetoothAddress, QString> transports = configuredTransports();
+    foreach (const QBluetoothAddress &address, transports.keys()) {
+        if (transports.value(address) == "rfcomm") {
+            continue;
+        }
+        bool paired = false;
+        foreach (const Device &dev, pairedPebbles) {
+            paired |= dev.address == address;
+        }
+        if (!paired) {
+            Device device;
+            device.address = address;
+            device.name = "Pebble " + transports.value(address);
+            pairedPebbles.append(device);
+        }
+    }
+
     foreach (const Device &device, pairedPebbles) {
         qDebug() << "loading pebble" << device.address.toString();
         Pebble *pebble = get(device.address);
@@ -34,6 +72,9 @@ void PebbleManager::loadPebbles()
             qDebug() << "creating new pebble";
             pebble = new Pebble(device.address, this);
             pebble->setName(device.name);
+            if (transports.contains(device.address)) {
+                pebble->setTransport(transports.value(device.address));
+            }
             setupPebble(pebble);
             m_pebbles.append(pebble);
             qDebug() << "have pebbles:" << m_pebbles.count() << this;
@@ -5,6 +5,7 @@
 #include "libpebble/bluez/bluezclient.h"
 
 #include <QObject>
+#include <QMap>
 
 class PebbleManager : public QObject
 {
@@ -25,6 +26,7 @@ private slots:
     void pebbleConnected();
 
 private:
+    QMap<QBluetoothAddress, QString> configuredTransports() const;
     void setupPebble(Pebble *pebble);
 
     BluezClient *m_bluezClient;
@@ -17,9 +17,22 @@ INCLUDEPATH += /usr/include/mkcal-qt5 /usr/include/kcalcoren-qt5
 
 SOURCES += main.cpp \
     libpebble/watchconnection.cpp \
+    libpebble/packetcodec.cpp \
     libpebble/pebble.cpp \
     libpebble/watchdatareader.cpp \
     libpebble/watchdatawriter.cpp \
+    libpebble/watchframebuffer.cpp \
+    libpebble/watchioworker.cpp \
+    libpebble/watchcapture.cpp \
+    libpebble/watchcapturereplay.cpp \
+    libpebble/linkprobe.cpp \
+    libpebble/latencyhistogram.cpp \
+    libpebble/metricsregistry.cpp \
+    libpebble/tracing.cpp \
+    libpebble/watchtransport.cpp \
+    libpebble/rfcommtransport.cpp \
+    libpebble/tcptransport.cpp \
+    libpebble/socketpairtransport.cpp \
     libpebble/devconnection.cpp \
     libpebble/notificationendpoint.cpp \
     libpebble/musicendpoint.cpp \
@@ -44,6 +57,7 @@ SOURCES += main.cpp \
     libpebble/bluez/bluez_device1.cpp \
     libpebble/bluez/freedesktop_objectmanager.cpp \
     libpebble/bluez/freedesktop_properties.cpp \
+    libpebble/bluez/bluezdevicemonitor.cpp \
     core.cpp \
     pebblemanager.cpp \
     dbusinterface.cpp \
@@ -52,6 +66,7 @@ SOURCES += main.cpp \
     platformintegration/sailfish/voicecallmanager.cpp \
     platformintegration/sailfish/voicecallhandler.cpp \
     libpebble/blobdb.cpp \
+    libpebble/blobdbjournal.cpp \
     libpebble/timelineitem.cpp \
     libpebble/notification.cpp \
     libpebble/timelinemanager.cpp \
@@ -62,6 +77,7 @@ SOURCES += main.cpp \
     libpebble/screenshotendpoint.cpp \
     libpebble/firmwaredownloader.cpp \
     libpebble/bundle.cpp \
+    libpebble/stm32crc.cpp \
     libpebble/watchlogendpoint.cpp \
     libpebble/ziphelper.cpp \
     libpebble/healthparams.cpp \
@@ -74,9 +90,24 @@ SOURCES += main.cpp \
 
 HEADERS += \
     libpebble/watchconnection.h \
+    libpebble/packetcodec.h \
     libpebble/pebble.h \
     libpebble/watchdatareader.h \
     libpebble/watchdatawriter.h \
+    libpebble/watchpacketschema.h \
+    libpebble/watchframebuffer.h \
+    libpebble/watchioworker.h \
+    libpebble/watchcapture.h \
+    libpebble/watchcapturereplay.h \
+    libpebble/linkprobe.h \
+    libpebble/latencyhistogram.h \
+    libpebble/metricsregistry.h \
+    libpebble/tracing.h \
+    libpebble/spscqueue.h \
+    libpebble/watchtransport.h \
+    libpebble/rfcommtransport.h \
+    libpebble/tcptransport.h \
+    libpebble/socketpairtransport.h \
     libpebble/devconnection.h \
     libpebble/notificationendpoint.h \
     libpebble/musicendpoint.h \
@@ -102,6 +133,7 @@ HEADERS += \
     libpebble/bluez/bluez_device1.h \
     libpebble/bluez/freedesktop_objectmanager.h \
     libpebble/bluez/freedesktop_properties.h \
+    libpebble/bluez/bluezdevicemonitor.h \
     core.h \
     pebblemanager.h \
     dbusinterface.h \
@@ -113,6 +145,7 @@ HEADERS += \
     platformintegration/sailfish/musiccontroller.h \
     platformintegration/sailfish/notificationmonitor.h \
     libpebble/blobdb.h \
+    libpebble/blobdbjournal.h \
     libpebble/timelineitem.h \
     libpebble/notification.h \
     libpebble/calendarevent.h \
@@ -123,6 +156,7 @@ HEADERS += \
     libpebble/screenshotendpoint.h \
     libpebble/firmwaredownloader.h \
     libpebble/bundle.h \
+    libpebble/stm32crc.h \
     libpebble/watchlogendpoint.h \
     libpebble/ziphelper.h \
     libpebble/healthparams.h \
@@ -140,6 +174,11 @@ testing: {
     QT += qml quick
 }
 
+# Compiles in the TRACE_* instrumentation, see libpebble/tracing.h
+tracing: {
+    DEFINES += ENABLE_TRACING
+}
+
 INSTALLS += target systemd layout
 
 systemd.files = $${TARGET}.service